@@ -235,6 +235,44 @@ extern const char *FamErrlist[];
  */
 extern int FAMNoExists		(FAMConnection *fc);
 
+/**
+ * FAMSettled:
+ *
+ * Specific extension for the core FAM API where files being written to
+ * don't produce a Changed event for each write but a single one once
+ * the writer closes the file, or every few seconds while it stays open.
+ * This applies to the monitors created after the call.
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+extern int FAMSettled		(FAMConnection *fc);
+
+/**
+ * FAMGetStats:
+ *
+ * Specific extension for the core FAM API returning the runtime
+ * statistics of the server as "name value" lines, such as the number
+ * of kernel events read, events sent and bytes written, the depth of
+ * each connection queue and the polling activity. It uses a connection
+ * of its own, so events pending on the application ones are untouched.
+ *
+ * Returns the length of the statistics, possibly more than what fitted
+ * in @buf, or -1 in case of error.
+ */
+extern int FAMGetStats		(char *buf, int size);
+
+/**
+ * FAMSnapshot:
+ *
+ * Specific extension for the core FAM API asking the server to write
+ * a JSON snapshot of its listeners, subscriptions, watched directories
+ * and queues. The path of the file is stored in @buf, the file appears
+ * there once completely written.
+ *
+ * Returns the length of the path, or -1 in case of error.
+ */
+extern int FAMSnapshot		(char *buf, int size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -569,6 +569,12 @@ gamin_send_request(GAMReqType type, int fd, const char *filename,
     GAMPacket req;
     int ret;
 
+    /* kept with the request so that it survives a reconnection */
+    if (((type == GAM_REQ_FILE) || (type == GAM_REQ_DIR)) &&
+        (gamin_data_get_settled(data) == 1)) {
+        type |= GAM_OPT_SETTLED;
+    }
+
 #ifdef GAMIN_DEBUG_API
     if (type == GAM_REQ_DEBUG) {
         len = strlen(filename);
@@ -618,7 +624,7 @@ gamin_send_request(GAMReqType type, int fd, const char *filename,
     req.version = GAM_PROTO_VERSION;
     req.seq = reqnum;
     req.type = (unsigned short) type;
-    if ((type == GAM_REQ_DIR) && (gamin_data_get_exists(data) == 0)) {
+    if (((type & 0xF) == GAM_REQ_DIR) && (gamin_data_get_exists(data) == 0)) {
         req.type |= GAM_OPT_NOEXISTS;
     }
         
@@ -1480,6 +1486,168 @@ int FAMNoExists(FAMConnection *fc) {
     return(0);
 }
 
+/**
+ * FAMSettled:
+ * @fc: pointer to a connection structure.
+ *
+ * Specific extension for the core FAM API where files being written to
+ * don't produce a Changed event for each write but a single one once
+ * the writer closes the file, or every few seconds while it stays open.
+ * This applies to the monitors created after the call.
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+int FAMSettled(FAMConnection *fc) {
+    int ret;
+    GAMDataPtr conn;
+
+    if (fc == NULL) {
+	GAM_DEBUG(DEBUG_INFO, "FAMSettled() arg error\n");
+        FAMErrno = FAM_ARG;
+        return (-1);
+    }
+    conn = fc->client;
+
+    gamin_data_lock(conn);
+    ret = gamin_data_settled(conn);
+    gamin_data_unlock(conn);
+    if (ret < 0) {
+	GAM_DEBUG(DEBUG_INFO, "FAMSettled() arg error\n");
+        FAMErrno = FAM_ARG;
+        return(-1);
+    }
+    return(0);
+}
+
+/*
+ * Sends a request of @type answered by the server with text, on a
+ * connection of its own so that the events pending on the application
+ * ones are left alone, and returns that text or NULL.
+ */
+static char *
+gamin_query(GAMReqType type)
+{
+    FAMConnection fc;
+    FAMRequest fr;
+    char *ret = NULL;
+
+    if (FAMOpen2(&fc, "gamin-stats") < 0)
+        return (NULL);
+
+    GAM_DEBUG(DEBUG_INFO, "gamin_query(fd = %d, type = %d)\n", fc.fd, type);
+
+    gamin_data_lock(fc.client);
+    fr.reqnum = 0;
+    if (gamin_send_request(type, fc.fd, NULL, &fr, NULL,
+                           fc.client, 0) < 0)
+        goto done;
+    while (gamin_data_stats_ready(fc.client) == 0) {
+        if (gamin_read_data(fc.client, fc.fd, 1) < 0) {
+	    FAMErrno = FAM_CONNECT;
+	    goto done;
+	}
+    }
+    ret = gamin_data_get_stats(fc.client);
+    if (ret == NULL)
+        FAMErrno = FAM_CONNECT;
+
+done:
+    gamin_data_unlock(fc.client);
+    FAMClose(&fc);
+    return (ret);
+}
+
+/*
+ * Copies @str to @buf like snprintf() would, frees it and returns its
+ * length.
+ */
+static int
+gamin_copy_reply(char *str, char *buf, int size)
+{
+    int ret, len;
+
+    ret = strlen(str);
+    if (size > 0) {
+        len = (ret < size) ? ret : size - 1;
+        memcpy(buf, str, len);
+        buf[len] = 0;
+    }
+    free(str);
+    return (ret);
+}
+
+/**
+ * FAMGetStats:
+ * @buf: where to store the statistics
+ * @size: the size of @buf
+ *
+ * Specific extension for the core FAM API returning the runtime
+ * statistics of the server as "name value" lines. They are truncated
+ * to fit in @buf, which is always zero terminated if @size isn't 0.
+ * A connection of its own is used so that the events pending on the
+ * application ones are left alone.
+ *
+ * Returns the length of the statistics, possibly more than what fitted
+ * in @buf, or -1 in case of error.
+ */
+int
+FAMGetStats(char *buf, int size)
+{
+    char *stats;
+
+    if ((size < 0) || ((buf == NULL) && (size != 0))) {
+	GAM_DEBUG(DEBUG_INFO, "FAMGetStats() arg error\n");
+        FAMErrno = FAM_ARG;
+        return (-1);
+    }
+
+    stats = gamin_query(GAM_REQ_STATS);
+    if (stats == NULL)
+        return (-1);
+    return (gamin_copy_reply(stats, buf, size));
+}
+
+/**
+ * FAMSnapshot:
+ * @buf: where to store the path of the snapshot
+ * @size: the size of @buf
+ *
+ * Specific extension for the core FAM API asking the server to write
+ * a JSON snapshot of its state. The server writes it in the background
+ * and the file only appears at the returned path once complete. The
+ * path is truncated to fit in @buf like with FAMGetStats().
+ *
+ * Returns the length of the path, or -1 in case of error.
+ */
+int
+FAMSnapshot(char *buf, int size)
+{
+    char *reply, *path;
+
+    if ((size < 0) || ((buf == NULL) && (size != 0))) {
+	GAM_DEBUG(DEBUG_INFO, "FAMSnapshot() arg error\n");
+        FAMErrno = FAM_ARG;
+        return (-1);
+    }
+
+    reply = gamin_query(GAM_REQ_SNAPSHOT);
+    if (reply == NULL)
+        return (-1);
+    if (strncmp(reply, "snapshot ", 9)) {
+        free(reply);
+        FAMErrno = FAM_CONNECT;
+        return (-1);
+    }
+    path = strdup(reply + 9);
+    free(reply);
+    if (path == NULL) {
+        FAMErrno = FAM_MEM;
+        return (-1);
+    }
+    path[strcspn(path, "\n")] = 0;
+    return (gamin_copy_reply(path, buf, size));
+}
+
 #ifdef GAMIN_DEBUG_API
 /**
  * FAMDebug:
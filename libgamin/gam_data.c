@@ -73,6 +73,7 @@ struct GAMData {
     int auth;			/* did authentication took place */
     int restarted;		/* did authentication took place */
     int noexist;		/* no EXISTS activated */
+    int settled;		/* settled Changed activated */
 
     int evn_ready;              /* do we have a full event ready */
     int evn_read;               /* how many bytes were read for the event */
@@ -84,6 +85,10 @@ struct GAMData {
     int req_max;                /* the size of req_tab */
     GAMReqDataPtr *req_tab;     /* pointer to the array of requests */
 
+    char *stats;                /* statistics received so far */
+    int stats_len;              /* their length */
+    int stats_done;             /* did the last chunk arrive */
+
 #ifdef HAVE_PTHREAD_H
     pthread_mutex_t lock;	/* mutex protecting this structure,
 				   it's connection, and everything related */
@@ -510,6 +515,8 @@ gamin_data_free(GAMDataPtr conn)
         }
         free(conn->req_tab);
     }
+    if (conn->stats != NULL)
+        free(conn->stats);
 
 #ifdef HAVE_PTHREAD_H
     pthread_mutex_unlock(&conn->lock);
@@ -635,6 +642,21 @@ gamin_data_conn_event(GAMDataPtr conn, GAMPacketPtr evn)
     if ((conn == NULL) || (evn == NULL))
         return (-1);
 
+    if ((evn->type == GAM_REPLY_STATS) || (evn->type == GAM_REPLY_STATS_END)) {
+        char *tmp;
+
+        tmp = realloc(conn->stats, conn->stats_len + evn->pathlen + 1);
+        if (tmp == NULL)
+            return (-1);
+        conn->stats = tmp;
+        memcpy(&conn->stats[conn->stats_len], &evn->path[0], evn->pathlen);
+        conn->stats_len += evn->pathlen;
+        conn->stats[conn->stats_len] = 0;
+        if (evn->type == GAM_REPLY_STATS_END)
+            conn->stats_done = 1;
+        return (0);
+    }
+
 #ifdef GAMIN_DEBUG_API
     if (evn->type >= 50) {
         GAM_DEBUG(DEBUG_INFO, "Got Debug Event: type %d, seq %d\n",
@@ -943,3 +965,79 @@ gamin_data_get_exists(GAMDataPtr conn)
     return(1);
 }
 
+/**
+ * gamin_data_settled:
+ * @conn:  a connection data structure
+ *
+ * Switch the connection to a mode where new monitors get a single
+ * Changed event once a file being written to is closed.
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+int
+gamin_data_settled(GAMDataPtr conn)
+{
+    if (conn == NULL)
+        return (-1);
+    conn->settled = 1;
+    return(0);
+}
+
+/**
+ * gamin_data_get_settled:
+ * @conn:  a connection data structure
+ *
+ * Get the settled Changed flag for the connection
+ *
+ * Returns 0 or 1 in case or -1 in case of error.
+ */
+int
+gamin_data_get_settled(GAMDataPtr conn)
+{
+    if (conn == NULL)
+        return (-1);
+    if (conn->settled)
+        return(1);
+    return(0);
+}
+
+/**
+ * gamin_data_stats_ready:
+ * @conn:  a connection data structure
+ *
+ * Did the whole reply to a GAM_REQ_STATS arrive
+ *
+ * Returns 1 if true, 0 if false and -1 in case of error
+ */
+int
+gamin_data_stats_ready(GAMDataPtr conn)
+{
+    if (conn == NULL)
+        return (-1);
+    if ((!conn->stats_done) && (conn->evn_read != 0))
+        gamin_data_conn_data(conn, 0);
+    return (conn->stats_done);
+}
+
+/**
+ * gamin_data_get_stats:
+ * @conn:  a connection data structure
+ *
+ * Get the statistics received from the server, the caller takes
+ * ownership of them and the next request starts afresh.
+ *
+ * Returns the "name value" lines, to be freed with free(), or NULL
+ */
+char *
+gamin_data_get_stats(GAMDataPtr conn)
+{
+    char *ret;
+
+    if ((conn == NULL) || (!conn->stats_done))
+        return (NULL);
+    ret = conn->stats;
+    conn->stats = NULL;
+    conn->stats_len = 0;
+    conn->stats_done = 0;
+    return (ret);
+}
@@ -85,6 +85,10 @@ int		gamin_data_read_event	(GAMDataPtr conn,
 int		gamin_data_event_ready	(GAMDataPtr conn);
 int		gamin_data_no_exists	(GAMDataPtr conn);
 int		gamin_data_get_exists	(GAMDataPtr conn);
+int		gamin_data_settled	(GAMDataPtr conn);
+int		gamin_data_get_settled	(GAMDataPtr conn);
+int		gamin_data_stats_ready	(GAMDataPtr conn);
+char *		gamin_data_get_stats	(GAMDataPtr conn);
 
 #ifdef __cplusplus
 }
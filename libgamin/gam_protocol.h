@@ -56,7 +56,9 @@ typedef enum {
     GAM_REQ_FILE = 1,	/* monitoring a file */
     GAM_REQ_DIR = 2,	/* monitoring a directory */
     GAM_REQ_CANCEL = 3,	/* cancelling a monitor */
-    GAM_REQ_DEBUG = 4 	/* debugging request */
+    GAM_REQ_DEBUG = 4, 	/* debugging request */
+    GAM_REQ_STATS = 5,	/* runtime statistics of the server */
+    GAM_REQ_SNAPSHOT = 6	/* write a snapshot of the server state */
 } GAMReqType;
 
 /**
@@ -65,9 +67,25 @@ typedef enum {
  * Option for FAM requests
  */
 typedef enum {
-    GAM_OPT_NOEXISTS=16	/* don't send Exists on directory monitoting */
+    GAM_OPT_NOEXISTS=16,	/* don't send Exists on directory monitoting */
+    GAM_OPT_SETTLED=32	/* report Changed once the writer closed the file */
 } GAMReqOpts;
 
+/**
+ * GAMReplyType:
+ *
+ * Type of the packets the server sends back which are not FAM events,
+ * kept out of the range of the FAM codes and of the debug events.
+ * A GAM_REQ_STATS is answered by "name value" lines split over as many
+ * GAM_REPLY_STATS packets as needed, the last one being a
+ * GAM_REPLY_STATS_END. A GAM_REQ_SNAPSHOT is answered the same way
+ * with a single "snapshot path" line giving the file being written.
+ */
+typedef enum {
+    GAM_REPLY_STATS = 0x4000,	/* a chunk of the statistics */
+    GAM_REPLY_STATS_END = 0x4001	/* the last chunk of the statistics */
+} GAMReplyType;
+
 /**
  * GAMPacket:
  *
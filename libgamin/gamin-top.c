@@ -0,0 +1,290 @@
+/*
+ * gamin-top: show which clients of the gamin server use it the most
+ *
+ * Queries the server statistics every few seconds and lists its clients
+ * by the number of events they receive, with the subscriptions, kernel
+ * watches and poll nodes kept on their behalf. Meant to find the process
+ * responsible when gam_server is busy.
+ *
+ *   gamin-top [-d seconds] [-n iterations] [-b]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fam.h"
+
+typedef struct {
+    int fd;
+    long pid;
+    long subscriptions;
+    long kernel_watches;
+    long poll_nodes;
+    long queue;
+    long events_sent;
+    long events_dropped;
+    long events_last_minute;
+    long bytes_written;
+    long p99;
+    double rate;
+} client_t;
+
+typedef struct {
+    client_t *clients;
+    int nb;
+    int max;
+    long events_sent;
+    long kernel_watches;
+    long poll_nodes;
+    long connections;
+} sample_t;
+
+static client_t *
+get_client(sample_t *sample, int fd)
+{
+    int i;
+
+    for (i = 0; i < sample->nb; i++)
+        if (sample->clients[i].fd == fd)
+            return (&sample->clients[i]);
+
+    if (sample->nb >= sample->max) {
+        sample->max = sample->max ? sample->max * 2 : 32;
+        sample->clients = realloc(sample->clients,
+                                  sample->max * sizeof(client_t));
+        if (sample->clients == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memset(&sample->clients[sample->nb], 0, sizeof(client_t));
+    sample->clients[sample->nb].fd = fd;
+    return (&sample->clients[sample->nb++]);
+}
+
+static void
+parse_line(sample_t *sample, const char *name, long value)
+{
+    client_t *client;
+    const char *field;
+    int fd;
+
+    if (!strcmp(name, "events_sent"))
+        sample->events_sent = value;
+    else if (!strcmp(name, "kernel_watches"))
+        sample->kernel_watches = value;
+    else if (!strcmp(name, "poll_nodes"))
+        sample->poll_nodes = value;
+    else if (!strcmp(name, "connections"))
+        sample->connections = value;
+    if (strncmp(name, "connection.", 11))
+        return;
+
+    fd = atoi(name + 11);
+    field = strchr(name + 11, '.');
+    if (field == NULL)
+        return;
+    field++;
+    client = get_client(sample, fd);
+
+    if (!strcmp(field, "pid"))
+        client->pid = value;
+    else if (!strcmp(field, "subscriptions"))
+        client->subscriptions = value;
+    else if (!strcmp(field, "kernel_watches"))
+        client->kernel_watches = value;
+    else if (!strcmp(field, "poll_nodes"))
+        client->poll_nodes = value;
+    else if (!strcmp(field, "queue"))
+        client->queue = value;
+    else if (!strcmp(field, "events_sent"))
+        client->events_sent = value;
+    else if (!strcmp(field, "events_dropped"))
+        client->events_dropped = value;
+    else if (!strcmp(field, "events_last_minute"))
+        client->events_last_minute = value;
+    else if (!strcmp(field, "bytes_written"))
+        client->bytes_written = value;
+    else if (!strcmp(field, "latency.p99"))
+        client->p99 = value;
+}
+
+static int
+get_sample(sample_t *sample)
+{
+    static char *buf = NULL;
+    static int size = 64 * 1024;
+    char *line, *next, *space;
+    int len;
+
+    do {
+        if (buf == NULL)
+            buf = malloc(size);
+        if (buf == NULL)
+            return (-1);
+        len = FAMGetStats(buf, size);
+        if (len < 0)
+            return (-1);
+        if (len >= size) {
+            free(buf);
+            buf = NULL;
+            size = len + 4096;
+        }
+    } while (buf == NULL);
+
+    memset(sample, 0, sizeof(sample_t));
+    for (line = buf; (line != NULL) && (*line != 0); line = next) {
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = 0;
+        space = strchr(line, ' ');
+        if (space == NULL)
+            continue;
+        *space = 0;
+        parse_line(sample, line, atol(space + 1));
+    }
+    return (0);
+}
+
+static const char *
+pid_command(long pid)
+{
+    static char comm[64];
+    char path[64];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%ld/comm", pid);
+    f = fopen(path, "r");
+    if ((f == NULL) || (fgets(comm, sizeof(comm), f) == NULL)) {
+        if (f != NULL)
+            fclose(f);
+        return ("?");
+    }
+    fclose(f);
+    comm[strcspn(comm, "\n")] = 0;
+    return (comm);
+}
+
+static int
+compare_clients(const void *a, const void *b)
+{
+    const client_t *ca = a, *cb = b;
+
+    if (ca->rate != cb->rate)
+        return ((ca->rate < cb->rate) ? 1 : -1);
+    if (ca->events_last_minute != cb->events_last_minute)
+        return ((ca->events_last_minute < cb->events_last_minute) ? 1 : -1);
+    return ((ca->subscriptions < cb->subscriptions) ? 1 :
+            (ca->subscriptions > cb->subscriptions) ? -1 : 0);
+}
+
+/*
+ * The rate is taken over the interval when the client was already there,
+ * or from its last minute otherwise.
+ */
+static void
+compute_rates(sample_t *cur, sample_t *prev, int delay)
+{
+    client_t *c, *p;
+    int i, j;
+
+    for (i = 0; i < cur->nb; i++) {
+        c = &cur->clients[i];
+        c->rate = c->events_last_minute / 60.0;
+        if (prev == NULL)
+            continue;
+        for (j = 0; j < prev->nb; j++) {
+            p = &prev->clients[j];
+            if ((p->fd == c->fd) && (p->pid == c->pid) &&
+                (c->events_sent >= p->events_sent)) {
+                c->rate = (double) (c->events_sent - p->events_sent) / delay;
+                break;
+            }
+        }
+    }
+}
+
+static void
+show(sample_t *sample, int clear)
+{
+    client_t *c;
+    int i;
+    long self = getpid();
+
+    if (clear)
+        printf("\033[H\033[2J");
+    printf("gam_server: %ld connections, %ld kernel watches, "
+           "%ld poll nodes, %ld events sent\n\n",
+           sample->connections, sample->kernel_watches,
+           sample->poll_nodes, sample->events_sent);
+    printf("%7s %-16s %6s %6s %6s %6s %8s %8s %10s %8s %12s %8s\n",
+           "PID", "COMMAND", "SUBS", "KWATCH", "POLL", "QUEUE", "EV/S",
+           "EV/MIN", "SENT", "DROPPED", "BYTES", "P99(us)");
+    for (i = 0; i < sample->nb; i++) {
+        c = &sample->clients[i];
+        if (c->pid == self)
+            continue;
+        printf("%7ld %-16.16s %6ld %6ld %6ld %6ld %8.1f %8ld %10ld %8ld "
+               "%12ld %8ld\n",
+               c->pid, pid_command(c->pid), c->subscriptions,
+               c->kernel_watches, c->poll_nodes, c->queue, c->rate,
+               c->events_last_minute, c->events_sent, c->events_dropped,
+               c->bytes_written, c->p99);
+    }
+    fflush(stdout);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-d seconds] [-n iterations] [-b]\n", name);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    sample_t samples[2];
+    sample_t *cur, *prev = NULL;
+    int delay = 2, iterations = -1, batch = 0;
+    int i, opt;
+
+    while ((opt = getopt(argc, argv, "d:n:b")) != -1) {
+        switch (opt) {
+            case 'd':
+                delay = atoi(optarg);
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'b':
+                batch = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if ((delay <= 0) || (optind != argc))
+        usage(argv[0]);
+    if (!isatty(1))
+        batch = 1;
+
+    memset(samples, 0, sizeof(samples));
+    for (i = 0; (iterations < 0) || (i < iterations); i++) {
+        if (i > 0)
+            sleep(delay);
+        cur = &samples[i % 2];
+        free(cur->clients);
+        if (get_sample(cur) < 0) {
+            fprintf(stderr, "Failed to get the statistics of the server\n");
+            return (1);
+        }
+        compute_rates(cur, prev, delay);
+        qsort(cur->clients, cur->nb, sizeof(client_t), compare_clients);
+        show(cur, !batch);
+        if (batch)
+            printf("\n");
+        prev = cur;
+    }
+    return (0);
+}
@@ -301,6 +301,66 @@ gamin_MonitorNoExists(PyObject *self, PyObject * args) {
     return(PyInt_FromLong(FAMNoExists(conn)));
 }
 
+static PyObject *
+gamin_MonitorSettled(PyObject *self, PyObject * args) {
+    int no;
+    FAMConnection *conn;
+
+    if (!PyArg_ParseTuple(args, (char *)"i:MonitorSettled", &no))
+	return(NULL);
+
+    conn = check_connection(no);
+    if (conn == NULL) {
+	return(PyInt_FromLong(-1));
+    }
+    return(PyInt_FromLong(FAMSettled(conn)));
+}
+
+static PyObject *
+gamin_GetStats(PyObject *self, PyObject * args) {
+    char *buf;
+    int len, size = 4096;
+    PyObject *ret;
+
+    if (!PyArg_ParseTuple(args, (char *)":GetStats"))
+	return(NULL);
+
+    while (1) {
+	buf = malloc(size);
+	if (buf == NULL)
+	    return(PyErr_NoMemory());
+	len = FAMGetStats(buf, size);
+	if ((len < 0) || (len < size))
+	    break;
+	free(buf);
+	size = len + 1;
+    }
+    if (len < 0) {
+	free(buf);
+	Py_INCREF(Py_None);
+	return(Py_None);
+    }
+    ret = PyString_FromStringAndSize(buf, len);
+    free(buf);
+    return(ret);
+}
+
+static PyObject *
+gamin_Snapshot(PyObject *self, PyObject * args) {
+    char buf[4096];
+    int len;
+
+    if (!PyArg_ParseTuple(args, (char *)":Snapshot"))
+	return(NULL);
+
+    len = FAMSnapshot(buf, sizeof(buf));
+    if ((len < 0) || (len >= (int) sizeof(buf))) {
+	Py_INCREF(Py_None);
+	return(Py_None);
+    }
+    return(PyString_FromStringAndSize(buf, len));
+}
+
 static PyObject *
 gamin_MonitorDirectory(PyObject *self, PyObject * args) {
     PyObject *userdata;
@@ -434,12 +494,15 @@ static PyMethodDef gaminMethods[] = {
     {(char *)"MonitorFile", gamin_MonitorFile, METH_VARARGS, NULL},
     {(char *)"MonitorCancel", gamin_MonitorCancel, METH_VARARGS, NULL},
     {(char *)"MonitorNoExists", gamin_MonitorNoExists, METH_VARARGS, NULL},
+    {(char *)"MonitorSettled", gamin_MonitorSettled, METH_VARARGS, NULL},
     {(char *)"EventPending", gamin_EventPending, METH_VARARGS, NULL},
     {(char *)"ProcessOneEvent", gamin_ProcessOneEvent, METH_VARARGS, NULL},
     {(char *)"ProcessEvents", gamin_ProcessEvents, METH_VARARGS, NULL},
     {(char *)"MonitorClose", gamin_MonitorClose, METH_VARARGS, NULL},
     {(char *)"GetFd", gamin_GetFd, METH_VARARGS, NULL},
     {(char *)"Errno", gamin_Errno, METH_VARARGS, NULL},
+    {(char *)"GetStats", gamin_GetStats, METH_VARARGS, NULL},
+    {(char *)"Snapshot", gamin_Snapshot, METH_VARARGS, NULL},
 #ifdef GAMIN_DEBUG_API
     {(char *)"MonitorDebug", gamin_MonitorDebug, METH_VARARGS, NULL},
 #endif
@@ -55,6 +55,29 @@ def GaminErrmsg(err = None):
         msg = ""
     return msg
 
+def GaminStats():
+    """Returns the runtime statistics of the server as a dictionary,
+       or None if they couldn't be obtained"""
+    stats = _gamin.GetStats()
+    if stats == None:
+        return None
+    ret = {}
+    for line in stats.splitlines():
+        try:
+	    (name, value) = line.split(' ', 1)
+	except ValueError:
+	    continue
+	try:
+	    ret[name] = int(value)
+	except ValueError:
+	    ret[name] = value
+    return ret
+
+def GaminSnapshot():
+    """Asks the server for a JSON snapshot of its state and returns the
+       path of the file, which appears once written, or None"""
+    return _gamin.Snapshot()
+
 class GaminException(Exception):
     def __init__(self, value):
         Exception.__init__(self)
@@ -191,6 +214,12 @@ class WatchMonitor:
 	ret = _gamin.MonitorNoExists(self.__no)
 	return ret
 
+    def settled(self):
+        if (self.__no < 0):
+	    return
+	ret = _gamin.MonitorSettled(self.__no)
+	return ret
+
     def stop_watch(self, path):
         if (self.__no < 0):
 	    return
@@ -0,0 +1,55 @@
+#!/usr/bin/env python
+#
+# The Exists listing of a large directory is sent in several chunks,
+# a file created meanwhile must still be reported after the EndExist.
+#
+import gamin
+import time
+import os
+import sys
+import shutil
+
+events = []
+
+def callback(path, event):
+#    print "Got callback: %s, %s" % (path, event)
+    events.append((os.path.basename(path), event))
+
+shutil.rmtree ("temp_dir", True)
+os.mkdir ("temp_dir")
+for i in range(20000):
+    os.close(os.open("temp_dir/%d" % (i), os.O_CREAT | os.O_WRONLY))
+
+mon = gamin.WatchMonitor()
+mon.watch_directory("temp_dir", callback)
+# once the listing started
+while len(events) == 0:
+    mon.handle_one_event()
+open("temp_dir/new", "w").close()
+for i in range(100):
+    time.sleep(0.1)
+    mon.handle_events()
+    if ("new", gamin.GAMCreated) in events and \
+       ("temp_dir", gamin.GAMEndExist) in events:
+        break
+mon.stop_watch("temp_dir")
+mon.disconnect()
+del mon
+shutil.rmtree ("temp_dir", True)
+
+end = [i for i in range(len(events)) if events[i][1] == gamin.GAMEndExist]
+created = [i for i in range(len(events))
+           if events[i] == ("new", gamin.GAMCreated)]
+exists = [i for i in range(len(events)) if events[i][1] == gamin.GAMExists]
+if len(end) != 1:
+    print 'error : got %d EndExist events' % (len(end))
+elif len(exists) < 20001 or exists[-1] > end[0]:
+    print 'error : %d Exists events, the last at %d after the EndExist at %d' % \
+          (len(exists), exists[-1], end[0])
+elif len(created) == 0:
+    print 'error : no Created event for the new file'
+elif created[0] < end[0]:
+    print 'error : Created at %d before the EndExist at %d' % \
+          (created[0], end[0])
+else:
+    print 'OK'
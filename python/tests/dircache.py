@@ -0,0 +1,61 @@
+#!/usr/bin/env python
+#
+# A directory listed by a first watcher and then modified must give
+# the up to date Exists listing to the watchers coming after it.
+#
+import gamin
+import time
+import os
+import sys
+import shutil
+
+exists=[]
+
+def callback(path, event):
+    global exists
+#    print "Got callback: %s, %s" % (path, event)
+    if event == gamin.GAMExists and os.path.basename(path) != "temp_dir":
+        exists.append(path)
+
+def listing(mon):
+    global exists
+    exists = []
+    mon.watch_directory("temp_dir", callback)
+    time.sleep(1)
+    mon.handle_events()
+    exists.sort()
+    return exists
+
+shutil.rmtree ("temp_dir", True)
+os.mkdir ("temp_dir")
+open("temp_dir/a", "w").close()
+open("temp_dir/b", "w").close()
+
+mon = gamin.WatchMonitor()
+first = listing(mon)
+
+os.unlink("temp_dir/a")
+open("temp_dir/c", "w").close()
+os.mkdir("temp_dir/d")
+time.sleep(1)
+mon.handle_events()
+
+mon2 = gamin.WatchMonitor()
+second = listing(mon2)
+mon3 = gamin.WatchMonitor()
+third = listing(mon3)
+
+for m in (mon, mon2, mon3):
+    m.stop_watch("temp_dir")
+    m.disconnect()
+del mon, mon2, mon3
+shutil.rmtree ("temp_dir", True)
+
+if first != ["a", "b"]:
+    print 'error : first listing was %s' % (first)
+elif second != ["b", "c", "d"]:
+    print 'error : second listing was %s' % (second)
+elif third != second:
+    print 'error : third listing was %s' % (third)
+else:
+    print 'OK'
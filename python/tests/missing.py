@@ -0,0 +1,65 @@
+#!/usr/bin/env python
+#
+# Monitor a file and a directory below directories which don't exist
+# yet, then create the whole path. The creation must be noticed right
+# away, not on the next scan of the missing list.
+#
+import gamin
+import time
+import os
+import sys
+import shutil
+
+ok = 1
+top = 0
+top2 = 0
+expect = [gamin.GAMDeleted, gamin.GAMEndExist, gamin.GAMCreated]
+expect2 = [gamin.GAMDeleted, gamin.GAMEndExist, gamin.GAMCreated]
+
+def callback(path, event):
+    global top, expect, ok
+#    print "Got callback: %s, %s" % (path, event)
+    if top >= len(expect):
+        return
+    if expect[top] != event:
+        print "Error got event %d expected %d" % (event, expect[top])
+	ok = 0
+    top = top + 1
+
+def callback2(path, event):
+    global top2, expect2, ok
+#    print "Got callback2: %s, %s" % (path, event)
+    if top2 >= len(expect2):
+        return
+    if expect2[top2] != event:
+        print "Error got event %d expected %d" % (event, expect2[top2])
+	ok = 0
+    top2 = top2 + 1
+
+shutil.rmtree ("temp_dir", True)
+os.mkdir ("temp_dir")
+
+mon = gamin.WatchMonitor()
+mon.watch_file("temp_dir/a/b/foo", callback)
+mon.watch_directory("temp_dir/c/d", callback2)
+time.sleep(1)
+mon.handle_events()
+os.makedirs("temp_dir/a/b")
+time.sleep(0.2)
+f = open("temp_dir/a/b/foo", "w")
+f.close()
+os.makedirs("temp_dir/c/d")
+time.sleep(1)
+mon.handle_events()
+mon.stop_watch("temp_dir/a/b/foo")
+mon.stop_watch("temp_dir/c/d")
+mon.disconnect()
+del mon
+shutil.rmtree ("temp_dir", True)
+
+if top != 3:
+    print "Error: file monitor got %d events insteads of 3" % (top)
+elif top2 != 3:
+    print "Error: directory monitor got %d events insteads of 3" % (top2)
+elif ok == 1:
+    print "OK"
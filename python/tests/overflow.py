@@ -0,0 +1,80 @@
+#!/usr/bin/env python
+#
+# When the fanotify queue overflows the server must tell the watchers
+# that their directory changed instead of silently losing the events.
+# Needs a server running the fanotify backend, i.e. with CAP_SYS_ADMIN.
+#
+import gamin
+import time
+import os
+import sys
+import shutil
+import signal
+import json
+
+nb_changed = 0
+
+def callback(path, event):
+    global nb_changed
+#    print "Got callback: %s, %s" % (path, event)
+    if path == top and event == gamin.GAMChanged:
+        nb_changed = nb_changed + 1
+
+shutil.rmtree ("temp_dir", True)
+shutil.rmtree ("temp_flood", True)
+os.mkdir ("temp_dir")
+os.mkdir ("temp_flood")
+top = os.path.abspath("temp_dir")
+
+mon = gamin.WatchMonitor()
+mon.watch_directory("temp_dir", callback)
+time.sleep(1)
+mon.handle_events()
+
+stats = gamin.GaminStats()
+if stats == None or not stats.has_key("fanotify_overflows"):
+    mon.stop_watch("temp_dir")
+    mon.disconnect()
+    del mon
+    shutil.rmtree ("temp_dir", True)
+    shutil.rmtree ("temp_flood", True)
+    print "server not using fanotify, test skipped"
+    print "OK"
+    sys.exit(0)
+
+path = gamin.GaminSnapshot()
+pid = 0
+if path != None:
+    for i in range(50):
+        if os.path.exists(path):
+            pid = json.load(open(path))["pid"]
+            os.unlink(path)
+            break
+        time.sleep(0.1)
+if pid == 0:
+    print 'error : no server pid in the snapshot'
+    sys.exit(1)
+
+# The whole filesystem is marked, fill the kernel queue while the
+# server can't read it.
+os.kill(pid, signal.SIGSTOP)
+for i in range(20000):
+    os.close(os.open("temp_flood/%d" % (i), os.O_CREAT | os.O_WRONLY))
+open("temp_dir/a", "w").close()
+os.kill(pid, signal.SIGCONT)
+time.sleep(2)
+mon.handle_events()
+
+after = gamin.GaminStats()
+mon.stop_watch("temp_dir")
+mon.disconnect()
+del mon
+shutil.rmtree ("temp_dir", True)
+shutil.rmtree ("temp_flood", True)
+
+if after["fanotify_overflows"] <= stats["fanotify_overflows"]:
+    print 'error : the queue did not overflow'
+elif nb_changed < 1:
+    print 'error : no Changed event for the directory after the overflow'
+else:
+    print 'OK'
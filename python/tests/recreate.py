@@ -0,0 +1,52 @@
+#!/usr/bin/env python
+#
+# Remove a watched directory and create it again right away, both
+# before the server processes its events. The client must see it come
+# back and be told about what is created in it afterwards.
+#
+import gamin
+import time
+import os
+import sys
+import shutil
+
+ok = 1
+top = 0
+expect = [gamin.GAMExists, gamin.GAMEndExist, gamin.GAMDeleted,
+          gamin.GAMCreated, gamin.GAMCreated]
+
+def callback(path, event):
+    global top, expect, ok
+#    print "Got callback: %s, %s" % (path, event)
+    if top >= len(expect):
+        return
+    if expect[top] != event:
+        print "Error got event %d expected %d" % (event, expect[top])
+	ok = 0
+    top = top + 1
+
+shutil.rmtree ("temp_dir", True)
+os.mkdir ("temp_dir")
+os.mkdir ("temp_dir/d")
+
+mon = gamin.WatchMonitor()
+mon.watch_directory("temp_dir/d", callback)
+time.sleep(1)
+mon.handle_events()
+os.rmdir("temp_dir/d")
+os.mkdir("temp_dir/d")
+time.sleep(2)
+mon.handle_events()
+f = open("temp_dir/d/a", "w")
+f.close()
+time.sleep(2)
+mon.handle_events()
+mon.stop_watch("temp_dir/d")
+mon.disconnect()
+del mon
+shutil.rmtree ("temp_dir", True)
+
+if top != 5:
+    print "Error: monitor got %d events insteads of 5" % (top)
+elif ok == 1:
+    print "OK"
@@ -0,0 +1,44 @@
+#!/usr/bin/env python
+#
+# Changing the attributes of a watched directory must be reported as
+# a Changed event on the directory itself, whatever the backend.
+#
+import gamin
+import time
+import os
+import sys
+import shutil
+
+ok = 1
+top = 0
+expect = [gamin.GAMExists, gamin.GAMEndExist, gamin.GAMChanged]
+
+def callback(path, event):
+    global top, expect, ok
+#    print "Got callback: %s, %s" % (path, event)
+    if top >= len(expect):
+        return
+    if expect[top] != event:
+        print "Error got event %d expected %d" % (event, expect[top])
+	ok = 0
+    top = top + 1
+
+shutil.rmtree ("temp_dir", True)
+os.mkdir ("temp_dir")
+
+mon = gamin.WatchMonitor()
+mon.watch_directory("temp_dir", callback)
+time.sleep(1)
+mon.handle_events()
+os.chmod("temp_dir", 0700)
+time.sleep(2)
+mon.handle_events()
+mon.stop_watch("temp_dir")
+mon.disconnect()
+del mon
+shutil.rmtree ("temp_dir", True)
+
+if top != 3:
+    print "Error: monitor got %d events insteads of 3" % (top)
+elif ok == 1:
+    print "OK"
@@ -0,0 +1,59 @@
+#!/usr/bin/env python
+#
+# In settled mode a file written to several times gets a single
+# Changed event once it is closed.
+#
+import gamin
+import time
+import os
+import sys
+import shutil
+
+nb_changed=0
+nb_created=0
+
+def callback(path, event):
+    global nb_changed, nb_created
+#    print "Got callback: %s, %s" % (path, event)
+    if os.path.basename(path) != "foo":
+        return
+    if event == gamin.GAMChanged:
+        nb_changed = nb_changed + 1
+    if event == gamin.GAMCreated:
+        nb_created = nb_created + 1
+
+shutil.rmtree ("temp_dir", True)
+os.mkdir ("temp_dir")
+
+mon = gamin.WatchMonitor()
+mon.settled()
+mon.watch_directory("temp_dir", callback)
+time.sleep(1)
+mon.handle_events()
+
+f = open("temp_dir/foo", "w")
+for i in range(5):
+    f.write("line %d\n" % (i))
+    f.flush()
+    time.sleep(0.2)
+    mon.handle_events()
+if nb_changed != 0:
+    print 'error : no changed event expected while the file is open'
+    shutil.rmtree ("temp_dir", True)
+    sys.exit(1)
+
+f.close()
+# inotify events are processed once a second
+time.sleep(2)
+mon.handle_events()
+mon.stop_watch("temp_dir")
+mon.disconnect()
+del mon
+shutil.rmtree ("temp_dir", True)
+
+if nb_created != 1:
+    print 'error : got %d created events instead of 1' % (nb_created)
+elif nb_changed != 1:
+    print 'error : got %d changed events instead of 1' % (nb_changed)
+else:
+    print 'OK'
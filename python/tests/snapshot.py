@@ -0,0 +1,62 @@
+#!/usr/bin/env python
+#
+# A snapshot of the server state must list the subscription of the
+# client and the directory watched for it, and be valid JSON.
+#
+import gamin
+import time
+import os
+import sys
+import shutil
+import json
+
+def callback(path, event):
+#    print "Got callback: %s, %s" % (path, event)
+    pass
+
+shutil.rmtree ("temp_dir", True)
+os.mkdir ("temp_dir")
+top = os.path.abspath("temp_dir")
+
+mon = gamin.WatchMonitor()
+mon.watch_directory("temp_dir", callback)
+time.sleep(1)
+mon.handle_events()
+
+path = gamin.GaminSnapshot()
+state = None
+if path != None:
+    for i in range(50):
+        if os.path.exists(path):
+            state = json.load(open(path))
+            break
+        time.sleep(0.1)
+
+mon.stop_watch("temp_dir")
+mon.disconnect()
+del mon
+shutil.rmtree ("temp_dir", True)
+
+if path == None:
+    print 'error : no snapshot'
+    sys.exit(1)
+if state == None:
+    print 'error : %s never appeared' % (path)
+    sys.exit(1)
+os.unlink(path)
+
+found = 0
+for listener in state["listeners"]:
+    for sub in listener["subscriptions"]:
+        if sub["path"] == top and sub["dir"]:
+            found = 1
+if not found:
+    print 'error : subscription on %s not in the snapshot' % (top)
+elif not state["stats"].has_key("events_sent"):
+    print 'error : no statistics in the snapshot'
+elif not state.has_key("watched_dirs") or not state.has_key("missing"):
+    print 'error : no backend state in the snapshot'
+elif top not in [dir["path"] for dir in state["watched_dirs"]]:
+    print 'error : %s not in the watched directories' % (top)
+else:
+    print 'OK'
@@ -0,0 +1,67 @@
+#!/usr/bin/env python
+#
+# The server statistics must account for the events it sent and list
+# the connections of the watchers.
+#
+import gamin
+import time
+import os
+import sys
+import shutil
+
+def callback(path, event):
+#    print "Got callback: %s, %s" % (path, event)
+    pass
+
+shutil.rmtree ("temp_dir", True)
+os.mkdir ("temp_dir")
+open("temp_dir/a", "w").close()
+
+mon = gamin.WatchMonitor()
+mon.watch_directory("temp_dir", callback)
+time.sleep(1)
+mon.handle_events()
+open("temp_dir/b", "w").close()
+time.sleep(1)
+mon.handle_events()
+
+stats = gamin.GaminStats()
+
+mon.stop_watch("temp_dir")
+mon.disconnect()
+del mon
+shutil.rmtree ("temp_dir", True)
+
+if stats == None:
+    print 'error : no statistics'
+    sys.exit(1)
+for name in ("events_sent", "bytes_written", "events_coalesced",
+             "connections", "poll_nodes", "poll_ticks",
+             "latency.write.count", "latency.write.p99",
+             "latency.total.p50", "latency.total.p99", "latency.total.p999"):
+    if not stats.has_key(name):
+        print 'error : no %s in the statistics' % (name)
+	sys.exit(1)
+queues = [n for n in stats.keys() if n.endswith(".queue")]
+watchers = [n[:-len(".subscriptions")] for n in stats.keys()
+            if n.endswith(".subscriptions") and stats[n] == 1]
+if stats["connections"] < 2 or len(queues) != stats["connections"]:
+    print 'error : %d connections, queues %s' % (stats["connections"], queues)
+elif stats["events_sent"] < 4:
+    print 'error : only %d events sent' % (stats["events_sent"])
+elif stats["bytes_written"] <= stats["events_sent"] * 10:
+    print 'error : only %d bytes written' % (stats["bytes_written"])
+elif len(watchers) != 1:
+    print 'error : expected one client with a subscription, got %s' % (watchers)
+elif stats[watchers[0] + ".kernel_watches"] + \
+     stats[watchers[0] + ".poll_nodes"] != 1:
+    print 'error : the subscription of the client is not accounted'
+elif stats[watchers[0] + ".events_sent"] < 4 or \
+     stats[watchers[0] + ".events_last_minute"] < 4:
+    print 'error : only %d events sent to the client' % \
+          (stats[watchers[0] + ".events_sent"])
+elif stats["latency.write.count"] < stats["events_sent"]:
+    print 'error : %d writes timed for %d events' % \
+          (stats["latency.write.count"], stats["events_sent"])
+else:
+    print 'OK'
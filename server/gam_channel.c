@@ -373,7 +373,6 @@ gam_get_socket_path(const char *session)
 }
 
 
-#ifndef HAVE_ABSTRACT_SOCKETS
 /**
  * gam_get_socket_dir:
  *
@@ -514,6 +513,24 @@ create:
     return(FALSE);
 }
 
+/**
+ * gam_get_state_dir:
+ *
+ * Get the directory where the server writes files about its state,
+ * the one holding the socket when abstract sockets aren't available.
+ * It is created with the same checks as for the socket.
+ *
+ * Returns a new string or NULL in case of error.
+ */
+gchar *
+gam_get_state_dir(void)
+{
+    if (!gam_check_secure_dir())
+        return (NULL);
+    return (gam_get_socket_dir());
+}
+
+#ifndef HAVE_ABSTRACT_SOCKETS
 /**
  * gam_check_secure_path:
  * @path: path to the (possibly abstract) socket
@@ -24,6 +24,7 @@ gboolean	gam_client_conn_write	(GIOChannel *target,
 					 gpointer data,
 					 size_t len);
 void		gam_conn_shutdown	(const char *session);
+gchar *		gam_get_state_dir	(void);
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,8 @@
 #include "gam_fs.h"
 #include "gam_excludes.h"
 
+static int inotify_shards = 1;
+
 static gam_fs_mon_type
 gam_conf_string_to_mon_type (const char *method)
 {
@@ -72,6 +74,13 @@ gam_conf_read_internal (const char *filename)
 				g_strfreev(words);
 				continue;
 			} 
+			if (!strcmp(words[0], "inotify_shards")) {
+				/* We need: inotify_shards <count> */
+				if (words[1] && words[1][0])
+					inotify_shards = atoi (words[1]);
+				g_strfreev(words);
+				continue;
+			}
 			if (!strcmp(words[0], "poll")) {
 				exclude = 1;
 			} else if (!strcmp(words[0], "notify")) {
@@ -105,6 +114,18 @@ gam_conf_read_internal (const char *filename)
 	g_free(contents);
 }
 
+/**
+ * gam_conf_get_inotify_shards:
+ *
+ * Returns the number of inotify instances the watches are spread over,
+ * each of them having its own reader thread when there are several.
+ */
+int
+gam_conf_get_inotify_shards (void)
+{
+	return inotify_shards;
+}
+
 void
 gam_conf_read (void)
 {
@@ -2,5 +2,6 @@
 #define __GAM_CONF_H
 
 void		gam_conf_read (void);
+int		gam_conf_get_inotify_shards (void);
 
 #endif
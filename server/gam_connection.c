@@ -12,6 +12,11 @@
 #include "gam_error.h"
 #include "gam_pidname.h"
 #include "gam_eq.h"
+#include "gam_stats.h"
+#include "gam_probes.h"
+#include "gam_snapshot.h"
+#include "gam_trace.h"
+#include "gam_record.h"
 #ifdef GAMIN_DEBUG_API
 #include "gam_debugging.h"
 #endif
@@ -28,6 +33,10 @@
 
 static GList *gamConnList;
 
+/* totals over all the connections, for the statistics */
+static gulong events_sent = 0;
+static gulong bytes_written = 0;
+
 struct GamConnData {
     GamConnState state;         /* the state for the connection */
     int fd;                     /* the file descriptor */
@@ -40,6 +49,7 @@ struct GamConnData {
     GamListener *listener;      /* the listener associated with the connection */
     gam_eq_t *eq;               /* the event queue */
     guint eq_source;            /* the event queue GSource id */
+    GamHistogram latency;       /* from the kernel to this client */
 };
 
 static void gam_cancel_server_timeout (void);
@@ -58,6 +68,10 @@ gam_reqtype_to_string (GAMReqType type)
 		return "CANCEL";
 	case GAM_REQ_DEBUG:
 		return "4";
+	case GAM_REQ_STATS:
+		return "STATS";
+	case GAM_REQ_SNAPSHOT:
+		return "SNAPSHOT";
 	}
 
 	return "";
@@ -116,6 +130,7 @@ gam_connection_close(GamConnDataPtr conn)
     gam_eq_free (conn->eq);
 
     if (conn->listener != NULL) {
+        gam_record_close(conn->fd);
         gam_listener_free(conn->listener);
     }
 
@@ -123,6 +138,8 @@ gam_connection_close(GamConnDataPtr conn)
     gam_debug_release(conn);
 #endif
     GAM_DEBUG(DEBUG_INFO, "Closing connection %d\n", conn->fd);
+    GAM_PROBE2(connection_close, conn, conn->fd);
+    GAM_TRACE(CONN_CLOSE, conn->fd, conn->pid, 0, 0, NULL);
 
     g_io_channel_unref(conn->source);
     gamConnList = g_list_remove(gamConnList, conn);
@@ -177,6 +194,28 @@ gam_connection_eq_flush (gpointer data)
 	return work;
 }
 
+/**
+ * gam_connections_flush:
+ *
+ * Writes out the event queues of all the connections now rather than
+ * at their next timeout.
+ */
+void
+gam_connections_flush(void)
+{
+    GamConnDataPtr conn;
+    GList *cur;
+
+    for (cur = gamConnList; cur != NULL; cur = g_list_next(cur)) {
+        conn = (GamConnDataPtr) cur->data;
+        if (conn->eq_source != 0) {
+            g_source_remove(conn->eq_source);
+            conn->eq_source = 0;
+        }
+        gam_eq_flush(conn->eq, conn);
+    }
+}
+
 /**
  * gam_connection_new:
  * @loop: the Glib loop
@@ -209,6 +248,8 @@ gam_connection_new(GMainLoop *loop, GIOChannel *source)
     gam_cancel_server_timeout ();
     
     GAM_DEBUG(DEBUG_INFO, "Created connection %d\n", ret->fd);
+    GAM_PROBE2(connection_open, ret, ret->fd);
+    GAM_TRACE(CONN_OPEN, ret->fd, 0, 0, 0, NULL);
 
     return (ret);
 }
@@ -228,6 +269,21 @@ gam_connection_get_fd(GamConnDataPtr conn)
     return (conn->fd);
 }
 
+/**
+ * gam_connection_get_listener:
+ * @conn: a connection data structure.
+ *
+ * Get the listener of a connection, NULL until it is authenticated
+ *
+ * Returns the listener
+ */
+GamListener *
+gam_connection_get_listener(GamConnDataPtr conn)
+{
+    g_assert(conn);
+    return (conn->listener);
+}
+
 /**
  * gam_connection_get_pid:
  * @conn: a connection data structure.
@@ -280,6 +336,7 @@ gam_connection_set_pid(GamConnDataPtr conn, int pid)
         conn->state = GAM_STATE_ERROR;
         return (-1);
     }
+    gam_record_open(conn->fd, pid);
     return (0);
 }
 
@@ -351,6 +408,7 @@ gam_connection_request(GamConnDataPtr conn, GAMPacketPtr req)
     options = req->type & 0xFFF0;
     GAM_DEBUG(DEBUG_INFO, "%s request: from %s, seq %d, type %x options %x\n",
               gam_reqtype_to_string (type), conn->pidname, req->seq, type, options);
+    GAM_PROBE4(request, conn, conn->pid, type, req->seq);
 
     if (req->pathlen >= MAXPATHLEN)
         return (-1);
@@ -361,6 +419,8 @@ gam_connection_request(GamConnDataPtr conn, GAMPacketPtr req)
      */
     byte_save = req->path[req->pathlen];
     req->path[req->pathlen] = 0;
+    GAM_TRACE(REQUEST, conn->fd, conn->pid, type, req->seq, req->path);
+    gam_record_request(conn->fd, req->type, req->seq, req->path, req->pathlen);
 
     switch (type) {
         case GAM_REQ_FILE:
@@ -378,6 +438,7 @@ gam_connection_request(GamConnDataPtr conn, GAMPacketPtr req)
         case GAM_REQ_CANCEL: {
             char *path;
             int pathlen;
+            gboolean excluded;
 
             sub = gam_listener_get_subscription_by_reqno(conn->listener,
 							 req->seq);
@@ -395,11 +456,13 @@ gam_connection_request(GamConnDataPtr conn, GAMPacketPtr req)
 	       it.  */
 	    path = g_strdup(gam_subscription_get_path(sub));
 	    pathlen = gam_subscription_pathlen(sub);
+	    /* from the subscription's cache, while it is still there */
+	    excluded = gam_subscription_is_excluded(sub);
 
 	    gam_listener_remove_subscription(conn->listener, sub);
 	    gam_remove_subscription(sub);
 #ifdef ENABLE_INOTIFY
-	    if ((gam_inotify_is_running()) && (!gam_exclude_check(path))) {
+	    if ((gam_inotify_is_running()) && (!excluded)) {
 		gam_fs_mon_type type;
 
                 type = gam_fs_get_mon_type (path);
@@ -415,6 +478,33 @@ gam_connection_request(GamConnDataPtr conn, GAMPacketPtr req)
 	    g_free(path);
 	    break;
         }   
+        case GAM_REQ_STATS: {
+            GString *stats;
+
+            stats = gam_stats_collect();
+            if (gam_send_stats(conn, req->seq, stats->str, stats->len) < 0) {
+		GAM_DEBUG(DEBUG_INFO, "Failed to send statistics to PID %d\n",
+			  gam_connection_get_pid(conn));
+	    }
+            g_string_free(stats, TRUE);
+            break;
+        }
+        case GAM_REQ_SNAPSHOT: {
+            const char *snapshot;
+            char *reply;
+
+            snapshot = gam_snapshot_start();
+            if (snapshot == NULL)
+                reply = g_strdup("");
+            else
+                reply = g_strdup_printf("snapshot %s\n", snapshot);
+            if (gam_send_stats(conn, req->seq, reply, strlen(reply)) < 0) {
+		GAM_DEBUG(DEBUG_INFO, "Failed to send the snapshot path to PID %d\n",
+			  gam_connection_get_pid(conn));
+	    }
+            g_free(reply);
+            break;
+        }
         case GAM_REQ_DEBUG:
 #ifdef GAMIN_DEBUG_API
 	    gam_debug_add(conn, req->path, options);
@@ -482,7 +572,8 @@ gam_connection_data(GamConnDataPtr conn, int len)
             GAM_DEBUG(DEBUG_INFO, "unsupported version %d\n", req->version);
             return (-1);
         }
-	if (GAM_REQ_CANCEL != req->type) {
+	if ((GAM_REQ_CANCEL != req->type) && (GAM_REQ_STATS != req->type) &&
+	    (GAM_REQ_SNAPSHOT != req->type)) {
     	    /* double check pathlen and total length */
     	    if ((req->pathlen <= 0) || (req->pathlen > MAXPATHLEN)) {
         	GAM_DEBUG(DEBUG_INFO,
@@ -533,26 +624,24 @@ gam_connection_data(GamConnDataPtr conn, int len)
 
 
 /**
- * gam_send_event:
- * @conn: the connection
+ * gam_event_packet_fill:
+ * @req: the packet to fill
  * @event: the event type
  * @path: the path
+ * @len: the length of @path
  *
- * Send an event over a connection
+ * Serializes an event, everything but the request number which
+ * gam_send_event_packet() sets for each recipient.
  *
- * Returns 0 on success; -1 on failure
+ * Returns the packet length on success; -1 on failure
  */
 int
-gam_send_event(GamConnDataPtr conn, int reqno, int event,
-               const char *path, int len)
+gam_event_packet_fill(GAMPacketPtr req, int event, const char *path, int len)
 {
-    GAMPacket req;
     size_t tlen;
-    int ret;
     int type;
 
-    g_assert(conn);
-    g_assert(conn->fd >= 0);
+    g_assert(req);
     g_assert(path);
     g_assert(path[len] == '\0');
 
@@ -583,55 +672,175 @@ gam_send_event(GamConnDataPtr conn, int reqno, int event,
         case GAMIN_EVENT_ENDEXISTS:
             type = FAMEndExist;
             break;
-#ifdef GAMIN_DEBUG_API
-	case 50:
-	    type = 50 + reqno;
-	    break;
-#endif
         default:
             GAM_DEBUG(DEBUG_INFO, "Unknown event type %d\n", event);
             return (-1);
     }
 
-    GAM_DEBUG(DEBUG_INFO, "Event to %s : %d, %d, %s %s\n", conn->pidname,
-              reqno, type, path, gam_event_to_string(event));
     /*
      * prepare the packet
      */
     tlen = GAM_PACKET_HEADER_LEN + len;
     /* We use only local socket so no need for network byte order conversion */
-    req.len = (unsigned short) tlen;
-    req.version = GAM_PROTO_VERSION;
-    req.seq = reqno;
-    req.type = (unsigned short) type;
-    req.pathlen = len;
-    memcpy(req.path, path, len);
-    ret = gam_client_conn_write(conn->source, conn->fd, (gpointer) &req, tlen);
+    req->len = (unsigned short) tlen;
+    req->version = GAM_PROTO_VERSION;
+    req->seq = 0;
+    req->type = (unsigned short) type;
+    req->pathlen = len;
+    memcpy(req->path, path, len);
+    return ((int) tlen);
+}
+
+/**
+ * gam_event_packet_new:
+ * @event: the event type
+ * @path: the path reported
+ * @len: the length of @path
+ *
+ * Serializes an event in a packet allocated to its length, the path
+ * being kept NUL terminated after it for tracing.
+ *
+ * Returns the packet with one reference, or NULL if it can't be sent
+ */
+GamEventPacket *
+gam_event_packet_new(int event, const char *path, int len)
+{
+    GamEventPacket *packet;
+
+    packet = g_malloc(G_STRUCT_OFFSET(GamEventPacket, req.path) + len + 1);
+    if (gam_event_packet_fill(&packet->req, event, path, len) < 0) {
+        g_free(packet);
+        return (NULL);
+    }
+    packet->req.path[len] = '\0';
+    packet->refs = 1;
+    packet->event = event;
+    return (packet);
+}
+
+GamEventPacket *
+gam_event_packet_ref(GamEventPacket *packet)
+{
+    g_assert(packet);
+
+    packet->refs++;
+    return (packet);
+}
+
+void
+gam_event_packet_unref(GamEventPacket *packet)
+{
+    if ((packet != NULL) && (--packet->refs == 0))
+        g_free(packet);
+}
+
+/**
+ * gam_send_event_packet:
+ * @conn: the connection
+ * @req: a packet filled by gam_event_packet_fill()
+ * @reqno: the request number of the recipient
+ *
+ * Send a serialized event over a connection. The same packet can be
+ * sent to several connections in a row.
+ *
+ * Returns 0 on success; -1 on failure
+ */
+int
+gam_send_event_packet(GamConnDataPtr conn, GAMPacketPtr req, int reqno)
+{
+    int ret;
+
+    g_assert(conn);
+    g_assert(conn->fd >= 0);
+    g_assert(req);
+
+    GAM_TRACE(SEND, conn->fd, reqno, req->type, req->len, NULL);
+    req->seq = reqno;
+    ret = gam_client_conn_write(conn->source, conn->fd, (gpointer) req,
+                                req->len);
     if (!ret) {
         GAM_DEBUG(DEBUG_INFO, "Failed to send event to %s\n", conn->pidname);
+        GAM_TRACE(SEND_FAILED, conn->fd, reqno, 0, 0, NULL);
+        gam_listener_event_dropped(conn->listener);
         return (-1);
     }
+    events_sent++;
+    bytes_written += req->len;
+    gam_listener_event_sent(conn->listener, req->len);
     return (0);
 }
 
 /**
- * gam_queue_event:
+ * gam_connection_latency:
+ * @conn: the connection
+ * @origin: when the event was read from the kernel, 0 if unknown
+ * @end: when it was written to the connection
+ *
+ * Accounts for the latency of an event sent to this client.
+ */
+void
+gam_connection_latency(GamConnDataPtr conn, gint64 origin, gint64 end)
+{
+    g_assert(conn);
+
+    if (origin != 0)
+        gam_histogram_add(&conn->latency, end - origin);
+}
+
+/**
+ * gam_send_event:
  * @conn: the connection
  * @event: the event type
  * @path: the path
  *
+ * Send an event over a connection
+ *
+ * Returns 0 on success; -1 on failure
+ */
+int
+gam_send_event(GamConnDataPtr conn, int reqno, int event,
+               const char *path, int len)
+{
+    GAMPacket req;
+
+    g_assert(conn);
+    g_assert(conn->fd >= 0);
+
+#ifdef GAMIN_DEBUG_API
+    if (event == 50) {
+        if (gam_event_packet_fill(&req, GAMIN_EVENT_CHANGED, path, len) < 0)
+            return (-1);
+        req.type = (unsigned short) (50 + reqno);
+        return (gam_send_event_packet(conn, &req, reqno));
+    }
+#endif
+    if (gam_event_packet_fill(&req, event, path, len) < 0)
+        return (-1);
+    return (gam_send_event_packet(conn, &req, reqno));
+}
+
+/**
+ * gam_queue_event:
+ * @conn: the connection
+ * @reqno: the request number of the recipient
+ * @packet: the serialized event, possibly queued for other connections
+ *
  * Queue an event to be sent over a connection within the next second.
  * If an identical event is found at the tail of the event queue 
  * no event will be queued.
  */
 void
-gam_queue_event(GamConnDataPtr conn, int reqno, int event,
-                const char *path, int len)
+gam_queue_event(GamConnDataPtr conn, int reqno, GamEventPacket *packet)
 {
+	gboolean queued;
+
 	g_assert (conn);
 	g_assert (conn->eq);
 
-	gam_eq_queue (conn->eq, reqno, event, path, len);
+	queued = gam_eq_queue (conn->eq, reqno, packet);
+	GAM_TRACE (QUEUE, conn->fd, reqno, packet->event, !queued,
+		   packet->req.path);
+	gam_listener_event_queued (conn->listener, !queued);
 	if (!conn->eq_source)
 	    conn->eq_source = g_timeout_add (100 /* 100 milisecond */, gam_connection_eq_flush, conn);
 }
@@ -688,6 +897,66 @@ gam_send_ack(GamConnDataPtr conn, int reqno,
         GAM_DEBUG(DEBUG_INFO, "Failed to send event to %s\n", conn->pidname);
         return (-1);
     }
+    bytes_written += tlen;
+    return (0);
+}
+
+/**
+ * gam_send_stats:
+ * @conn: the connection data
+ * @reqno: the request number of the GAM_REQ_STATS
+ * @stats: the "name value" lines to send
+ * @len: the length of @stats
+ *
+ * Sends the server statistics over the connection, split at line
+ * boundaries into as many packets as needed.
+ *
+ * Returns 0 on success; -1 on failure
+ */
+int
+gam_send_stats(GamConnDataPtr conn, int reqno, const char *stats, int len)
+{
+    GAMPacket req;
+    int chunk, tlen;
+
+    g_assert(conn);
+    g_assert(conn->fd >= 0);
+    g_assert(stats);
+
+    do {
+        chunk = len;
+        if (chunk > MAXPATHLEN - 1) {
+            chunk = MAXPATHLEN - 1;
+            while ((chunk > 0) && (stats[chunk - 1] != '\n'))
+                chunk--;
+            if (chunk == 0)
+                chunk = MAXPATHLEN - 1;
+        }
+
+        tlen = GAM_PACKET_HEADER_LEN + (chunk > 0 ? chunk : 1);
+        req.len = (unsigned short) tlen;
+        req.version = GAM_PROTO_VERSION;
+        req.seq = reqno;
+        req.type = (chunk == len) ? GAM_REPLY_STATS_END : GAM_REPLY_STATS;
+        if (chunk > 0) {
+            req.pathlen = chunk;
+            memcpy(req.path, stats, chunk);
+        } else {
+            /* the client wants some payload */
+            req.pathlen = 1;
+            req.path[0] = '\n';
+        }
+
+        if (!gam_client_conn_write(conn->source, conn->fd, (gpointer) &req,
+                                   tlen)) {
+            GAM_DEBUG(DEBUG_INFO, "Failed to send statistics to %s\n",
+                      conn->pidname);
+            return (-1);
+        }
+        bytes_written += tlen;
+        stats += chunk;
+        len -= chunk;
+    } while (len > 0);
     return (0);
 }
 
@@ -737,6 +1006,62 @@ gam_schedule_server_timeout (void)
     g_timeout_add(MAX_IDLE_TIMEOUT_MSEC, (GSourceFunc) gam_connections_check, NULL);
 }
 
+/**
+ * gam_connections_stats:
+ * @out: the statistics being collected
+ *
+ * Reports the event traffic and the state of every connection.
+ */
+void
+gam_connections_stats(GString *out)
+{
+    GamConnDataPtr conn;
+    GList *cur;
+    char name[64];
+
+    gam_stats_add(out, "events_sent", events_sent);
+    gam_stats_add(out, "bytes_written", bytes_written);
+    gam_stats_add(out, "events_coalesced", gam_eq_coalesced());
+    gam_stats_add(out, "connections", g_list_length(gamConnList));
+
+    for (cur = gamConnList; cur; cur = g_list_next(cur)) {
+        conn = (GamConnDataPtr) cur->data;
+        snprintf(name, sizeof(name), "connection.%d.pid", conn->fd);
+        gam_stats_add(out, name, conn->pid);
+        snprintf(name, sizeof(name), "connection.%d.queue", conn->fd);
+        gam_stats_add(out, name, gam_eq_size(conn->eq));
+        snprintf(name, sizeof(name), "connection.%d.latency", conn->fd);
+        gam_stats_add_histogram(out, name, &conn->latency);
+        if (conn->listener != NULL) {
+            snprintf(name, sizeof(name), "connection.%d", conn->fd);
+            gam_listener_stats(conn->listener, out, name);
+        }
+    }
+}
+
+/**
+ * gam_connections_next:
+ * @fd: a file descriptor, -1 to start
+ *
+ * Walks the connections in the order of their file descriptors, which
+ * unlike a list link stays valid while the main loop runs.
+ *
+ * Returns the connection with the lowest descriptor above @fd, or NULL
+ */
+GamConnDataPtr
+gam_connections_next(int fd)
+{
+    GamConnDataPtr conn, ret = NULL;
+    GList *cur;
+
+    for (cur = gamConnList; cur; cur = g_list_next(cur)) {
+        conn = (GamConnDataPtr) cur->data;
+        if ((conn->fd > fd) && ((ret == NULL) || (conn->fd < ret->fd)))
+            ret = conn;
+    }
+    return (ret);
+}
+
 /**
  * gam_connections_debug:
  *
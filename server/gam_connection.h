@@ -2,6 +2,8 @@
 #define __GAM_CONNECTION_H__ 1
 
 #include <glib.h>
+#include "gam_protocol.h"
+#include "gam_listener.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,6 +15,18 @@ extern "C" {
 typedef struct GamConnData GamConnData;
 typedef GamConnData *GamConnDataPtr;
 
+/**
+ * An event serialized once and sent to, or queued for, any number of
+ * connections, only the request number differs from one to the next.
+ * It is allocated to the length of its path.
+ */
+typedef struct GamEventPacket GamEventPacket;
+struct GamEventPacket {
+    int refs;
+    int event;
+    GAMPacket req;
+};
+
 /**
  * the different states the connection can be in
  */
@@ -25,6 +39,7 @@ typedef enum {
 
 int		gam_connections_init	(void);
 int		gam_connections_close	(void);
+void		gam_connections_flush	(void);
 void            gam_schedule_server_timeout (void);
 
 GamConnDataPtr	gam_connection_new	(GMainLoop *loop,
@@ -36,6 +51,7 @@ int		gam_connection_close	(GamConnDataPtr conn);
 
 int		gam_connection_get_fd	(GamConnDataPtr conn);
 int		gam_connection_get_pid  (GamConnDataPtr conn);
+GamListener *	gam_connection_get_listener (GamConnDataPtr conn);
 gchar *		gam_connection_get_pidname (GamConnDataPtr conn);
 GamConnState	gam_connection_get_state(GamConnDataPtr conn);
 int		gam_connection_get_data	(GamConnDataPtr conn,
@@ -43,20 +59,39 @@ int		gam_connection_get_data	(GamConnDataPtr conn,
 					 int *size);
 int		gam_connection_data	(GamConnDataPtr conn,
 					 int len);
-int		gam_send_event		(GamConnDataPtr conn,
-					 int reqno,
+int		gam_event_packet_fill	(GAMPacketPtr req,
 					 int event,
 					 const char *path,
 					 int len);
-void		gam_queue_event		(GamConnDataPtr conn,
+GamEventPacket *gam_event_packet_new	(int event,
+					 const char *path,
+					 int len);
+GamEventPacket *gam_event_packet_ref	(GamEventPacket *packet);
+void		gam_event_packet_unref	(GamEventPacket *packet);
+int		gam_send_event_packet	(GamConnDataPtr conn,
+					 GAMPacketPtr req,
+					 int reqno);
+int		gam_send_event		(GamConnDataPtr conn,
 					 int reqno,
 					 int event,
 					 const char *path,
 					 int len);
+void		gam_queue_event		(GamConnDataPtr conn,
+					 int reqno,
+					 GamEventPacket *packet);
 int		gam_send_ack		(GamConnDataPtr conn,
 					 int reqno,
 					 const char *path,
 					 int len);
+int		gam_send_stats		(GamConnDataPtr conn,
+					 int reqno,
+					 const char *stats,
+					 int len);
+void		gam_connections_stats	(GString *out);
+GamConnDataPtr	gam_connections_next	(int fd);
+void		gam_connection_latency	(GamConnDataPtr conn,
+					 gint64 origin,
+					 gint64 end);
 void		gam_connections_debug	(void);
 #ifdef __cplusplus
 }
@@ -0,0 +1,344 @@
+/* Gamin
+ * Copyright (C) 2004 Daniel Veillard, Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A server wide cache of directory listings, so that a new subscriber
+ * to a directory somebody already listed gets its Exists events from
+ * memory instead of another readdir and a stat per entry.
+ *
+ * A listing is dropped as soon as a backend reports a Created or a
+ * Deleted in its directory. It also remembers the identity and mtime
+ * the directory had when it was read and is only trusted if a stat at
+ * lookup time still agrees, one syscall per lookup. That catches the
+ * changes no event told us about, such as those lost in an inotify
+ * queue overflow, as long as they moved the mtime: the stamp is never
+ * taken again after the read.
+ */
+
+#include "server_config.h"
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "gam_error.h"
+#include "gam_dircache.h"
+
+/* Bounds on what the cache may hold, the least recently used go first */
+#define GAM_DIRCACHE_MAX_DIRS		512
+#define GAM_DIRCACHE_MAX_ENTRIES	(256 * 1024)
+
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	long mtime_nsec;
+} GamDirStamp;
+
+typedef struct {
+	char *path;
+	GHashTable *entries;	/* name -> is_dir + 1 */
+	GamDirStamp stamp;
+	GList *link;		/* in lru */
+} GamCachedDir;
+
+struct _GamDirFill {
+	char *path;
+	GHashTable *entries;
+	GamDirStamp stamp;
+};
+
+static GHashTable *dircache = NULL;
+static GQueue lru = { NULL, NULL, 0 };
+static guint total_entries = 0;
+
+static gulong hits = 0;
+static gulong misses = 0;
+static gulong invalidations = 0;
+static gulong evictions = 0;
+
+static gboolean
+gam_dircache_stamp(const char *path, GamDirStamp *stamp)
+{
+	struct stat sbuf;
+
+	if ((stat(path, &sbuf) < 0) || (!S_ISDIR(sbuf.st_mode)))
+		return FALSE;
+
+	stamp->dev = sbuf.st_dev;
+	stamp->ino = sbuf.st_ino;
+	stamp->mtime = sbuf.st_mtime;
+#ifdef ST_MTIM_NSEC
+	stamp->mtime_nsec = sbuf.st_mtim.tv_nsec;
+#else
+	stamp->mtime_nsec = 0;
+#endif
+	return TRUE;
+}
+
+static gboolean
+gam_dircache_stamp_equal(const GamDirStamp *a, const GamDirStamp *b)
+{
+	return ((a->dev == b->dev) && (a->ino == b->ino) &&
+		(a->mtime == b->mtime) && (a->mtime_nsec == b->mtime_nsec));
+}
+
+static void
+gam_dircache_drop(GamCachedDir *dir)
+{
+	g_hash_table_remove(dircache, dir->path);
+	g_queue_delete_link(&lru, dir->link);
+	total_entries -= g_hash_table_size(dir->entries);
+	g_hash_table_destroy(dir->entries);
+	g_free(dir->path);
+	g_free(dir);
+}
+
+static void
+gam_dircache_collect(gpointer key, gpointer value, gpointer user_data)
+{
+	GArray *entries = user_data;
+	GamDirEntry entry;
+
+	entry.name = g_strdup(key);
+	entry.is_dir = GPOINTER_TO_INT(value) - 1;
+	g_array_append_val(entries, entry);
+}
+
+/**
+ * gam_dircache_get:
+ * @path: the directory path
+ * @entries: where to store the listing
+ *
+ * Looks for an up to date listing of @path. On success @entries is
+ * set to a copy of it, a GArray of GamDirEntry the caller releases
+ * with gam_dircache_entries_free().
+ *
+ * Returns TRUE on a cache hit, FALSE otherwise.
+ */
+gboolean
+gam_dircache_get(const char *path, GArray **entries)
+{
+	GamCachedDir *dir = NULL;
+	GamDirStamp stamp;
+
+	*entries = NULL;
+
+	if (dircache != NULL)
+		dir = g_hash_table_lookup(dircache, path);
+
+	if (dir != NULL) {
+		if ((gam_dircache_stamp(path, &stamp)) &&
+		    (gam_dircache_stamp_equal(&stamp, &dir->stamp))) {
+			hits++;
+			g_queue_unlink(&lru, dir->link);
+			g_queue_push_head_link(&lru, dir->link);
+
+			*entries = g_array_sized_new(FALSE, FALSE,
+				sizeof(GamDirEntry),
+				g_hash_table_size(dir->entries));
+			g_hash_table_foreach(dir->entries,
+					     gam_dircache_collect, *entries);
+			return TRUE;
+		}
+		GAM_DEBUG(DEBUG_INFO, "Cached listing of %s is stale\n", path);
+		gam_dircache_drop(dir);
+	}
+
+	misses++;
+	return FALSE;
+}
+
+/**
+ * gam_dircache_entries_free:
+ * @entries: a listing returned by gam_dircache_get()
+ *
+ * Frees the listing and the names in it.
+ */
+void
+gam_dircache_entries_free(GArray *entries)
+{
+	guint i;
+
+	if (entries == NULL)
+		return;
+	for (i = 0; i < entries->len; i++)
+		g_free(g_array_index(entries, GamDirEntry, i).name);
+	g_array_free(entries, TRUE);
+}
+
+/**
+ * gam_dircache_fill_begin:
+ * @path: the directory path
+ *
+ * Starts recording the listing of @path while the caller reads the
+ * directory. It only becomes visible once gam_dircache_fill_end() is
+ * called, stamped with the state the directory had at this point so
+ * a change made during the read is noticed by the next lookup.
+ *
+ * Returns the fill handle, or NULL if @path can't be cached.
+ */
+GamDirFill *
+gam_dircache_fill_begin(const char *path)
+{
+	GamDirFill *fill;
+	GamDirStamp stamp;
+
+	if (!gam_dircache_stamp(path, &stamp))
+		return NULL;
+
+	fill = g_new0(GamDirFill, 1);
+	fill->path = g_strdup(path);
+	fill->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, NULL);
+	fill->stamp = stamp;
+	return fill;
+}
+
+/**
+ * gam_dircache_fill_add:
+ * @fill: the fill handle or NULL
+ * @name: the name of the entry
+ * @is_dir: is the entry a directory
+ *
+ * Adds an entry to the listing being recorded. Listings too large for
+ * the cache are silently given up.
+ */
+void
+gam_dircache_fill_add(GamDirFill *fill, const char *name, int is_dir)
+{
+	if ((fill == NULL) || (fill->entries == NULL))
+		return;
+
+	if (g_hash_table_size(fill->entries) >= GAM_DIRCACHE_MAX_ENTRIES) {
+		g_hash_table_destroy(fill->entries);
+		fill->entries = NULL;
+		return;
+	}
+	g_hash_table_replace(fill->entries, g_strdup(name),
+			     GINT_TO_POINTER(is_dir ? 2 : 1));
+}
+
+/**
+ * gam_dircache_fill_end:
+ * @fill: the fill handle or NULL
+ * @complete: was the whole directory read
+ *
+ * Stores the recorded listing if it is complete and frees @fill.
+ */
+void
+gam_dircache_fill_end(GamDirFill *fill, gboolean complete)
+{
+	GamCachedDir *dir;
+
+	if (fill == NULL)
+		return;
+
+	if ((complete) && (fill->entries != NULL)) {
+		if (dircache == NULL)
+			dircache = g_hash_table_new(g_str_hash, g_str_equal);
+
+		dir = g_hash_table_lookup(dircache, fill->path);
+		if (dir != NULL)
+			gam_dircache_drop(dir);
+
+		dir = g_new0(GamCachedDir, 1);
+		dir->path = fill->path;
+		dir->entries = fill->entries;
+		dir->stamp = fill->stamp;
+		g_queue_push_head(&lru, dir);
+		dir->link = lru.head;
+		g_hash_table_insert(dircache, dir->path, dir);
+		total_entries += g_hash_table_size(dir->entries);
+		fill->path = NULL;
+		fill->entries = NULL;
+
+		while ((lru.length > GAM_DIRCACHE_MAX_DIRS) ||
+		       ((total_entries > GAM_DIRCACHE_MAX_ENTRIES) &&
+			(lru.length > 1))) {
+			evictions++;
+			gam_dircache_drop(lru.tail->data);
+		}
+	}
+
+	if (fill->entries != NULL)
+		g_hash_table_destroy(fill->entries);
+	g_free(fill->path);
+	g_free(fill);
+}
+
+/**
+ * gam_dircache_event:
+ * @path: the path the event is about
+ * @is_dir: is it a directory
+ * @event: the event type
+ *
+ * Forgets the cached listing of the parent directory when a backend
+ * reports a Created or Deleted event in it, and the listing of a
+ * directory which went away.
+ */
+void
+gam_dircache_event(const char *path, int is_dir, GaminEventType event)
+{
+	GamCachedDir *dir;
+	const char *slash;
+	char *parent;
+
+	if ((dircache == NULL) || (g_hash_table_size(dircache) == 0))
+		return;
+	if ((event != GAMIN_EVENT_CREATED) && (event != GAMIN_EVENT_DELETED))
+		return;
+
+	if (event == GAMIN_EVENT_DELETED) {
+		dir = g_hash_table_lookup(dircache, path);
+		if (dir != NULL) {
+			invalidations++;
+			gam_dircache_drop(dir);
+		}
+	}
+
+	slash = strrchr(path, '/');
+	if ((slash == NULL) || (slash[1] == 0))
+		return;
+	if (slash == path)
+		parent = g_strdup("/");
+	else
+		parent = g_strndup(path, slash - path);
+	dir = g_hash_table_lookup(dircache, parent);
+	g_free(parent);
+	if (dir == NULL)
+		return;
+
+	/* the next subscriber reads it again, stamped anew */
+	invalidations++;
+	gam_dircache_drop(dir);
+}
+
+/**
+ * gam_dircache_debug:
+ *
+ * Reports the state and efficiency of the directory cache.
+ */
+void
+gam_dircache_debug(void)
+{
+	GAM_DEBUG(DEBUG_INFO,
+		  "Directory cache: %u dirs, %u entries, %lu hits, %lu misses, "
+		  "%lu invalidations, %lu evictions\n",
+		  lru.length, total_entries, hits, misses, invalidations,
+		  evictions);
+}
@@ -0,0 +1,34 @@
+#ifndef __GAM_DIRCACHE_H__
+#define __GAM_DIRCACHE_H__
+
+#include <glib.h>
+#include "gam_event.h"
+
+G_BEGIN_DECLS
+
+typedef struct {
+	char *name;
+	int is_dir;
+} GamDirEntry;
+
+typedef struct _GamDirFill GamDirFill;
+
+gboolean	gam_dircache_get		(const char *path,
+						 GArray **entries);
+void		gam_dircache_entries_free	(GArray *entries);
+
+GamDirFill *	gam_dircache_fill_begin		(const char *path);
+void		gam_dircache_fill_add		(GamDirFill *fill,
+						 const char *name,
+						 int is_dir);
+void		gam_dircache_fill_end		(GamDirFill *fill,
+						 gboolean complete);
+
+void		gam_dircache_event		(const char *path,
+						 int is_dir,
+						 GaminEventType event);
+void		gam_dircache_debug		(void);
+
+G_END_DECLS
+
+#endif /* __GAM_DIRCACHE_H__ */
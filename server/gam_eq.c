@@ -12,25 +12,31 @@
 #include "gam_protocol.h"
 #include "gam_error.h"
 #include "gam_eq.h"
+#include "gam_stats.h"
+#include "gam_probes.h"
+#include "gam_trace.h"
 
 // #define GAM_EQ_VERBOSE
 typedef struct {
 	int reqno;
-	int event;
-	char *path;
-	int len;
+	GamEventPacket *packet;
+	gint64 origin;		/* when read from the kernel, 0 if unknown */
+	gint64 queued;
 } gam_eq_event_t;
 
+/* events dropped as duplicates, over all the queues */
+static gulong coalesced = 0;
+
 static gam_eq_event_t *
-gam_eq_event_new (int reqno, int event, const char *path, int len)
+gam_eq_event_new (int reqno, GamEventPacket *packet)
 {
 	gam_eq_event_t *eq_event = NULL;
 
 	eq_event = g_new0(gam_eq_event_t, 1);
 	eq_event->reqno = reqno;
-	eq_event->event = event;
-	eq_event->path = g_strdup (path);
-	eq_event->len = len;
+	eq_event->packet = gam_event_packet_ref (packet);
+	eq_event->origin = gam_stats_get_origin ();
+	eq_event->queued = gam_stats_now ();
 
 	return eq_event;
 }
@@ -41,10 +47,19 @@ gam_eq_event_free (gam_eq_event_t *event)
 	if (!event)
 		return;
 
-	g_free (event->path);
+	gam_event_packet_unref (event->packet);
 	g_free (event);
 }
 
+static gboolean
+gam_eq_packet_equal (GamEventPacket *a, GamEventPacket *b)
+{
+	return (a == b) ||
+		((a->event == b->event) &&
+		 (a->req.pathlen == b->req.pathlen) &&
+		 !memcmp (a->req.path, b->req.path, a->req.pathlen));
+}
+
 struct _gam_eq {
 	GQueue *event_queue;
 };
@@ -76,13 +91,13 @@ gam_eq_free (gam_eq_t *eq)
 	g_free (eq);
 }
 
-void
-gam_eq_queue (gam_eq_t *eq, int reqno, int event, const char *path, int len)
+gboolean
+gam_eq_queue (gam_eq_t *eq, int reqno, GamEventPacket *packet)
 {
 	gam_eq_event_t *eq_event;
 
 	if (!eq)
-		return;
+		return FALSE;
 
 	eq_event = g_queue_peek_tail (eq->event_queue);
 
@@ -90,17 +105,19 @@ gam_eq_queue (gam_eq_t *eq, int reqno, int event, const char *path, int len)
 	 * if it is, we can throw this new event away
 	 */
 	if (eq_event && eq_event->reqno == reqno &&
-		eq_event->len == len &&
-		eq_event->event == event &&
-		!strcmp(eq_event->path, path))
+		gam_eq_packet_equal (eq_event->packet, packet))
 	{
 #ifdef GAM_EQ_VERBOSE
 		GAM_DEBUG(DEBUG_INFO, "gam_eq: Didn't queue duplicate event\n");
 #endif
-		return;
+		coalesced++;
+		GAM_PROBE4 (eq_queue, eq, reqno, packet->event, 1);
+		return FALSE;
 	}
-	eq_event = gam_eq_event_new (reqno, event, path, len);
+	GAM_PROBE4 (eq_queue, eq, reqno, packet->event, 0);
+	eq_event = gam_eq_event_new (reqno, packet);
 	g_queue_push_tail (eq->event_queue, eq_event);
+	return TRUE;
 }
 
 guint
@@ -112,10 +129,24 @@ gam_eq_size (gam_eq_t *eq)
 	return g_queue_get_length (eq->event_queue);
 }
 
+gulong
+gam_eq_coalesced (void)
+{
+	return coalesced;
+}
+
 static void
 gam_eq_flush_callback (gam_eq_t *eq, gam_eq_event_t *event, GamConnDataPtr conn)
 {
-	gam_send_event (conn, event->reqno, event->event, event->path, event->len);
+	gint64 start, end;
+
+	start = gam_stats_now ();
+	gam_stats_latency (GAM_LATENCY_CLIENT_QUEUE, event->queued, start);
+	gam_send_event_packet (conn, &event->packet->req, event->reqno);
+	end = gam_stats_now ();
+	gam_stats_latency (GAM_LATENCY_WRITE, start, end);
+	gam_stats_latency (GAM_LATENCY_TOTAL, event->origin, end);
+	gam_connection_latency (conn, event->origin, end);
 	gam_eq_event_free (event);
 }
 
@@ -129,6 +160,9 @@ gam_eq_flush (gam_eq_t *eq, GamConnDataPtr conn)
 #ifdef GAM_EQ_VERBOSE
 	GAM_DEBUG(DEBUG_INFO, "gam_eq: Flushing event queue for %s\n", gam_connection_get_pidname (conn));
 #endif
+	GAM_PROBE2 (eq_flush, conn, eq->event_queue->length);
+	GAM_TRACE (FLUSH, gam_connection_get_fd (conn), eq->event_queue->length,
+		   0, 0, NULL);
 	while (!g_queue_is_empty (eq->event_queue))
 	{
 		done_work = TRUE;
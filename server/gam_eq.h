@@ -7,8 +7,9 @@ typedef struct _gam_eq gam_eq_t;
 
 gam_eq_t *		gam_eq_new	(void);
 void			gam_eq_free	(gam_eq_t *eq);
-void			gam_eq_queue	(gam_eq_t *eq, int reqno, int event, const char *path, int len); 
+gboolean		gam_eq_queue	(gam_eq_t *eq, int reqno, GamEventPacket *packet);
 guint			gam_eq_size	(gam_eq_t *eq);
+gulong			gam_eq_coalesced (void);
 gboolean		gam_eq_flush	(gam_eq_t *eq, GamConnDataPtr conn);
 
 #endif
@@ -11,14 +11,41 @@
 typedef struct _gam_exclude gam_exclude;
 typedef gam_exclude* gam_exclude_ptr;
 
+/* How much of a pattern is left once its literal prefix matched */
+typedef enum {
+    GAM_EXCLUDE_EXACT,		/* nothing, the name must end there */
+    GAM_EXCLUDE_PREFIX,		/* only '*', anything matches */
+    GAM_EXCLUDE_GLOB		/* run the GPatternSpec */
+} gam_exclude_kind;
+
 struct _gam_exclude {
     const char *pattern;
     GPatternSpec *comp;
     int exclude;	/* 0 == notify, 1 == poll */
+    int rank;		/* position in the list, the lowest match wins */
+    gam_exclude_kind kind;
+};
+
+/*
+ * The patterns are compiled into a trie of their literal prefixes, the
+ * part before the first wildcard. Checking a name walks it once, only
+ * the patterns whose prefix matched get looked at, and of those only
+ * the ones ranked before the best match found so far.
+ */
+typedef struct _gam_exclude_trie gam_exclude_trie;
+
+struct _gam_exclude_trie {
+    char c;
+    gam_exclude_trie *child;
+    gam_exclude_trie *sibling;
+    GSList *patterns;		/* the prefixes ending here */
 };
 
 static int initialized = 0;
 static GList *excludes = NULL;
+static int nb_excludes = 0;
+static gam_exclude_trie exclude_root = { 0, NULL, NULL, NULL };
+static guint exclude_serial = 1;
 static char *static_excludes[] = {
 #ifdef HAVE_LINUX
     "/media/*",
@@ -29,6 +56,34 @@ static char *static_excludes[] = {
     NULL
 };
 
+static void
+gam_exclude_compile(gam_exclude_ptr ptr) {
+    gam_exclude_trie *node, *child;
+    const char *p;
+
+    node = &exclude_root;
+    for (p = ptr->pattern; (*p != 0) && (*p != '*') && (*p != '?'); p++) {
+        for (child = node->child; child != NULL; child = child->sibling)
+	    if (child->c == *p)
+	        break;
+	if (child == NULL) {
+	    child = g_new0(gam_exclude_trie, 1);
+	    child->c = *p;
+	    child->sibling = node->child;
+	    node->child = child;
+	}
+	node = child;
+    }
+
+    if (*p == 0)
+        ptr->kind = GAM_EXCLUDE_EXACT;
+    else if (p[strspn(p, "*")] == 0)
+        ptr->kind = GAM_EXCLUDE_PREFIX;
+    else
+        ptr->kind = GAM_EXCLUDE_GLOB;
+    node->patterns = g_slist_append(node->patterns, ptr);
+}
+
 /**
  * gam_exclude_add:
  * @pattern: the pattern to exclude
@@ -54,7 +109,10 @@ gam_exclude_add(const char *pattern, int exclude) {
     ptr->pattern = g_strdup(pattern);
     ptr->comp = comp;
     ptr->exclude = exclude;
+    ptr->rank = nb_excludes++;
     excludes = g_list_append(excludes, ptr);
+    gam_exclude_compile(ptr);
+    exclude_serial++;
     GAM_DEBUG(DEBUG_INFO, "added %s,%d to excludes\n", pattern, exclude);
     return(0);
 }
@@ -70,24 +128,41 @@ gam_exclude_add(const char *pattern, int exclude) {
  */
 static int
 gam_exclude_check_all(const char *filename) {
-    GList *cur;
-    gam_exclude_ptr ptr;
-    unsigned int len;
+    gam_exclude_trie *node;
+    gam_exclude_ptr ptr, best = NULL;
+    GSList *cur;
+    unsigned int len, depth;
 
     if ((filename == NULL) || (excludes == NULL))
         return(0);
-    
-    cur = excludes;
+
     len = strlen(filename);
-    while (cur != NULL) {
-        ptr = cur->data;
-	if ((ptr != NULL) && (ptr->comp != NULL) &&
-	    (g_pattern_match(ptr->comp, len, filename, NULL))) {
-	    return(ptr->exclude);
+    node = &exclude_root;
+    depth = 0;
+    while (node != NULL) {
+        for (cur = node->patterns; cur != NULL; cur = cur->next) {
+	    ptr = cur->data;
+	    if ((best != NULL) && (best->rank < ptr->rank))
+	        break;
+	    if ((ptr->kind == GAM_EXCLUDE_PREFIX) ||
+	        ((ptr->kind == GAM_EXCLUDE_EXACT) && (depth == len)) ||
+	        ((ptr->kind == GAM_EXCLUDE_GLOB) &&
+		 (g_pattern_match(ptr->comp, len, filename, NULL)))) {
+		best = ptr;
+		break;
+	    }
 	}
-	cur = g_list_next(cur);
+	if (depth == len)
+	    break;
+	for (node = node->child; node != NULL; node = node->sibling)
+	    if (node->c == filename[depth])
+	        break;
+	depth++;
     }
-    return(0);
+
+    if (best == NULL)
+        return(0);
+    return(best->exclude);
 }
 
 /************************************************************************
@@ -136,6 +211,29 @@ gam_exclude_check(const char *filename) {
     return(FALSE);
 }
 
+/**
+ * gam_exclude_check_cached:
+ * @filename: the absolute file path
+ * @serial: the serial of the cached decision
+ * @excluded: the cached decision
+ *
+ * Same as gam_exclude_check() for an object remembering the answer,
+ * the check is only redone if patterns were added since @serial.
+ * A zeroed cache is never valid.
+ *
+ * Returns TRUE if the file should not be monitored by dnotify, and FALSE
+ *         otherwise.
+ */
+gboolean
+gam_exclude_check_cached(const char *filename, guint *serial,
+                         gboolean *excluded) {
+    if (*serial != exclude_serial) {
+        *excluded = gam_exclude_check(filename);
+	*serial = exclude_serial;
+    }
+    return(*excluded);
+}
+
 void            gam_exclude_debug       (void)
 {
 	GList *l;
@@ -0,0 +1,750 @@
+/* gamin fanotify backend
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Unlike inotify, which needs one watch per directory, this backend puts
+ * a single mark on each filesystem holding a subscription. The kernel
+ * reports every directory entry change on that filesystem as the file
+ * handle of the parent directory plus the entry name. We only ever
+ * resolve handles we computed ourselves for subscribed directories, any
+ * other handle is dropped without touching the filesystem.
+ *
+ * fanotify_init needs CAP_SYS_ADMIN, a regular per-user gam_server
+ * won't be able to use it and falls back to inotify.
+ */
+
+#include "server_config.h"
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/fanotify.h>
+#include <glib.h>
+#include "gam_error.h"
+#include "gam_event.h"
+#include "gam_server.h"
+#include "gam_subscription.h"
+#include "gam_listener.h"
+#include "gam_poll_basic.h"
+#include "gam_fanotify.h"
+#include "gam_stats.h"
+#include "gam_snapshot.h"
+#include "gam_probes.h"
+#include "gam_trace.h"
+
+#define GAM_FANOTIFY_MASK (FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO|FAN_MODIFY|FAN_ATTRIB|FAN_DELETE_SELF|FAN_MOVE_SELF|FAN_ONDIR)
+#define GAM_FANOTIFY_BUFSIZE 16384
+#ifndef MAX_HANDLE_SZ
+#define MAX_HANDLE_SZ 128
+#endif
+
+/* A directory we resolved a handle for */
+typedef struct {
+	char *path;
+	char *key;		/* fsid and file handle, see gam_fanotify_key */
+	char *fsid;		/* key of the filesystem mark we hold a ref on */
+	GList *subs;		/* subscriptions on path or on files in path */
+	GList *parked;		/* subscriptions waiting for a child of path */
+} FanDir;
+
+/* The mark on one filesystem */
+typedef struct {
+	char *path;
+	int refs;
+} FanMark;
+
+static int fan_fd = -1;
+static gboolean fan_running = FALSE;
+static gulong fan_events = 0;
+static gulong fan_overflows = 0;
+/* handle key -> FanDir */
+static GHashTable *key_dir_hash = NULL;
+/* GamSubscription -> FanDir */
+static GHashTable *sub_dir_hash = NULL;
+/* fsid key -> FanMark */
+static GHashTable *fsid_mark_hash = NULL;
+
+static gboolean gam_fanotify_attach (GamSubscription *sub);
+static void gam_fanotify_detach (GamSubscription *sub);
+
+static char *
+gam_fanotify_fsid_key (const int *fsid)
+{
+	return g_strdup_printf ("%x.%x", fsid[0], fsid[1]);
+}
+
+static char *
+gam_fanotify_key (const int *fsid, const struct file_handle *fh)
+{
+	GString *key;
+	unsigned int i;
+
+	key = g_string_new (NULL);
+	g_string_printf (key, "%x.%x.%x.", fsid[0], fsid[1], fh->handle_type);
+	for (i = 0; i < fh->handle_bytes; i++)
+		g_string_append_printf (key, "%02x", fh->f_handle[i]);
+
+	return g_string_free (key, FALSE);
+}
+
+/* Computes the handle key and filesystem key of path, returns FALSE and
+ * leaves errno set if path can't be resolved.
+ */
+static gboolean
+gam_fanotify_resolve (const char *path, char **key, char **fsid_key)
+{
+	struct file_handle *fh;
+	struct statfs sfs;
+	int fsid[2];
+	int mount_id;
+
+	if (statfs (path, &sfs) < 0)
+		return FALSE;
+	memcpy (fsid, &sfs.f_fsid, sizeof (fsid));
+
+	fh = g_malloc (sizeof (struct file_handle) + MAX_HANDLE_SZ);
+	fh->handle_bytes = MAX_HANDLE_SZ;
+	if (name_to_handle_at (AT_FDCWD, path, fh, &mount_id, 0) < 0) {
+		int e = errno;
+
+		g_free (fh);
+		errno = e;
+		return FALSE;
+	}
+
+	*key = gam_fanotify_key (fsid, fh);
+	*fsid_key = gam_fanotify_fsid_key (fsid);
+	g_free (fh);
+
+	return TRUE;
+}
+
+static gboolean
+gam_fanotify_mark_ref (const char *fsid_key, const char *path)
+{
+	FanMark *mark;
+
+	mark = g_hash_table_lookup (fsid_mark_hash, fsid_key);
+	if (mark) {
+		mark->refs++;
+		return TRUE;
+	}
+
+	if (fanotify_mark (fan_fd, FAN_MARK_ADD|FAN_MARK_FILESYSTEM,
+			   GAM_FANOTIFY_MASK, AT_FDCWD, path) < 0) {
+		GAM_DEBUG (DEBUG_INFO, "fanotify: can't mark filesystem of %s: %s\n",
+			   path, strerror (errno));
+		return FALSE;
+	}
+
+	GAM_DEBUG (DEBUG_INFO, "fanotify: marked filesystem %s through %s\n", fsid_key, path);
+	mark = g_new0 (FanMark, 1);
+	mark->path = g_strdup (path);
+	mark->refs = 1;
+	g_hash_table_insert (fsid_mark_hash, g_strdup (fsid_key), mark);
+
+	return TRUE;
+}
+
+static void
+gam_fanotify_mark_unref (const char *fsid_key)
+{
+	FanMark *mark;
+
+	mark = g_hash_table_lookup (fsid_mark_hash, fsid_key);
+	if (mark == NULL || --mark->refs > 0)
+		return;
+
+	/* The path may be gone, the mark then goes with the filesystem */
+	fanotify_mark (fan_fd, FAN_MARK_REMOVE|FAN_MARK_FILESYSTEM,
+		       GAM_FANOTIFY_MASK, AT_FDCWD, mark->path);
+	g_hash_table_remove (fsid_mark_hash, fsid_key);
+	g_free (mark->path);
+	g_free (mark);
+}
+
+static void
+gam_fanotify_dir_free (FanDir *dir)
+{
+	g_hash_table_remove (key_dir_hash, dir->key);
+	gam_fanotify_mark_unref (dir->fsid);
+	g_free (dir->path);
+	g_free (dir->key);
+	g_free (dir->fsid);
+	g_free (dir);
+}
+
+static char *
+gam_fanotify_sub_dirname (GamSubscription *sub)
+{
+	if (gam_subscription_is_dir (sub))
+		return g_strdup (gam_subscription_get_path (sub));
+
+	return g_path_get_dirname (gam_subscription_get_path (sub));
+}
+
+/* A subscription is parked when the directory it wants does not exist
+ * yet and it hangs off its nearest existing ancestor.
+ */
+static gboolean
+gam_fanotify_is_parked (GamSubscription *sub)
+{
+	FanDir *dir;
+
+	dir = g_hash_table_lookup (sub_dir_hash, sub);
+	return dir != NULL && g_list_find (dir->parked, sub) != NULL;
+}
+
+static gboolean
+gam_fanotify_attach (GamSubscription *sub)
+{
+	char *dirname, *path, *key, *fsid_key;
+	gboolean parked = FALSE;
+	FanDir *dir;
+
+	dirname = gam_fanotify_sub_dirname (sub);
+	path = g_strdup (dirname);
+
+	while (!gam_fanotify_resolve (path, &key, &fsid_key)) {
+		char *parent;
+
+		if ((errno != ENOENT && errno != ENOTDIR) || !strcmp (path, "/")) {
+			g_free (path);
+			g_free (dirname);
+			return FALSE;
+		}
+
+		parent = g_path_get_dirname (path);
+		g_free (path);
+		path = parent;
+		parked = TRUE;
+	}
+	g_free (dirname);
+
+	dir = g_hash_table_lookup (key_dir_hash, key);
+	if (dir == NULL) {
+		if (!gam_fanotify_mark_ref (fsid_key, path)) {
+			g_free (key);
+			g_free (fsid_key);
+			g_free (path);
+			return FALSE;
+		}
+
+		dir = g_new0 (FanDir, 1);
+		dir->path = path;
+		dir->key = key;
+		dir->fsid = fsid_key;
+		g_hash_table_insert (key_dir_hash, dir->key, dir);
+	} else {
+		g_free (key);
+		g_free (fsid_key);
+		g_free (path);
+	}
+
+	if (parked)
+		dir->parked = g_list_prepend (dir->parked, sub);
+	else
+		dir->subs = g_list_prepend (dir->subs, sub);
+	g_hash_table_insert (sub_dir_hash, sub, dir);
+
+	return TRUE;
+}
+
+static void
+gam_fanotify_detach (GamSubscription *sub)
+{
+	FanDir *dir;
+
+	dir = g_hash_table_lookup (sub_dir_hash, sub);
+	if (dir == NULL)
+		return;
+
+	g_hash_table_remove (sub_dir_hash, sub);
+	dir->subs = g_list_remove (dir->subs, sub);
+	dir->parked = g_list_remove (dir->parked, sub);
+
+	if (dir->subs == NULL && dir->parked == NULL)
+		gam_fanotify_dir_free (dir);
+}
+
+/* TRUE if path is dirname or one of its ancestors */
+static gboolean
+gam_fanotify_leads_to (const char *path, const char *dirname)
+{
+	size_t len = strlen (path);
+
+	if (strncmp (path, dirname, len))
+		return FALSE;
+
+	return dirname[len] == '\0' || dirname[len] == '/';
+}
+
+/* Moves the subscriptions parked on dir one step closer when the next
+ * component of their path appeared.
+ */
+static void
+gam_fanotify_unpark (FanDir *dir, const char *fullpath)
+{
+	GList *l, *found = NULL;
+
+	for (l = dir->parked; l; l = l->next) {
+		GamSubscription *sub = l->data;
+		char *dirname = gam_fanotify_sub_dirname (sub);
+
+		if (gam_fanotify_leads_to (fullpath, dirname))
+			found = g_list_prepend (found, sub);
+		g_free (dirname);
+	}
+
+	/* dir may be freed by the detach */
+	for (l = found; l; l = l->next) {
+		GamSubscription *sub = l->data;
+
+		gam_fanotify_detach (sub);
+		if (!gam_fanotify_attach (sub)) {
+			GAM_DEBUG (DEBUG_INFO, "fanotify: lost track of %s\n",
+				   gam_subscription_get_path (sub));
+			continue;
+		}
+
+		if (!gam_fanotify_is_parked (sub) &&
+		    (gam_subscription_is_dir (sub) ||
+		     g_file_test (gam_subscription_get_path (sub), G_FILE_TEST_EXISTS)))
+			gam_server_emit_initial_events (gam_subscription_get_path (sub), sub,
+							gam_subscription_is_dir (sub), TRUE);
+	}
+	g_list_free (found);
+}
+
+/* The directory was deleted or moved away, its handle is now stale */
+static void
+gam_fanotify_dir_gone (FanDir *dir)
+{
+	GList *subs, *l;
+
+	for (l = dir->subs; l; l = l->next) {
+		GamSubscription *sub = l->data;
+
+		if (gam_subscription_is_dir (sub))
+			gam_server_emit_one_event (gam_subscription_get_path (sub), 1,
+						   GAMIN_EVENT_DELETED, sub, 1);
+	}
+
+	/* Park everything on the closest ancestor still around */
+	subs = g_list_concat (g_list_copy (dir->subs), g_list_copy (dir->parked));
+	for (l = subs; l; l = l->next)
+		gam_fanotify_detach (l->data);
+	for (l = subs; l; l = l->next) {
+		GamSubscription *sub = l->data;
+
+		if (!gam_fanotify_attach (sub))
+			GAM_DEBUG (DEBUG_INFO, "fanotify: lost track of %s\n",
+				   gam_subscription_get_path (sub));
+	}
+	g_list_free (subs);
+}
+
+static void
+gam_fanotify_collect_key (gpointer key, gpointer value, gpointer user_data)
+{
+	GList **keys = user_data;
+
+	*keys = g_list_prepend (*keys, g_strdup (key));
+}
+
+/* The kernel dropped events and nothing tells which any more. Every
+ * subscription gets a Changed, or a Deleted if its file went away, the
+ * directories replaced or removed meanwhile are handled as if we had
+ * seen it, and the parked subscriptions look again for their path.
+ */
+static void
+gam_fanotify_overflow (void)
+{
+	GList *keys = NULL, *l, *subs;
+	char *key, *fsid_key;
+	gboolean same;
+	FanDir *dir;
+
+	GAM_DEBUG (DEBUG_INFO, "fanotify: event queue overflowed, rescanning %d directories\n",
+		   g_hash_table_size (key_dir_hash));
+	fan_overflows++;
+
+	/* Walk a copy of the keys, directories come and go below */
+	g_hash_table_foreach (key_dir_hash, gam_fanotify_collect_key, &keys);
+	for (l = keys; l; l = l->next) {
+		dir = g_hash_table_lookup (key_dir_hash, l->data);
+		if (dir == NULL)
+			continue;
+
+		same = FALSE;
+		if (gam_fanotify_resolve (dir->path, &key, &fsid_key)) {
+			same = !strcmp (key, dir->key);
+			g_free (key);
+			g_free (fsid_key);
+		}
+		if (!same) {
+			gam_fanotify_dir_gone (dir);
+			continue;
+		}
+
+		for (subs = dir->subs; subs; subs = subs->next) {
+			GamSubscription *sub = subs->data;
+			const char *path = gam_subscription_get_path (sub);
+
+			if (gam_subscription_is_dir (sub) ||
+			    g_file_test (path, G_FILE_TEST_EXISTS))
+				gam_server_emit_one_event (path, gam_subscription_is_dir (sub),
+							   GAMIN_EVENT_CHANGED, sub, 1);
+			else
+				gam_server_emit_one_event (path, 0, GAMIN_EVENT_DELETED, sub, 1);
+		}
+
+		if (dir->parked)
+			gam_fanotify_unpark (dir, dir->path);
+	}
+
+	for (l = keys; l; l = l->next)
+		g_free (l->data);
+	g_list_free (keys);
+}
+
+static void
+gam_fanotify_emit (FanDir *dir, const char *fullpath, int is_dir, GaminEventType event)
+{
+	gam_server_emit_event (fullpath, is_dir, event, dir->subs, 0);
+}
+
+static void
+gam_fanotify_process_event (struct fanotify_event_metadata *meta)
+{
+	struct fanotify_event_info_fid *fid;
+	struct file_handle *fh;
+	const char *name = NULL;
+	char *key, *fullpath;
+	FanDir *dir;
+	int is_dir;
+
+	if (meta->mask & FAN_Q_OVERFLOW) {
+		gam_fanotify_overflow ();
+		return;
+	}
+
+	if (meta->event_len < meta->metadata_len + sizeof (*fid))
+		return;
+
+	fid = (struct fanotify_event_info_fid *) ((char *) meta + meta->metadata_len);
+	fh = (struct file_handle *) fid->handle;
+
+	switch (fid->hdr.info_type) {
+	case FAN_EVENT_INFO_TYPE_DFID_NAME:
+		name = (const char *) fh->f_handle + fh->handle_bytes;
+		break;
+	case FAN_EVENT_INFO_TYPE_DFID:
+	case FAN_EVENT_INFO_TYPE_FID:
+		break;
+	default:
+		return;
+	}
+
+	key = gam_fanotify_key ((const int *) &fid->fsid, fh);
+	dir = g_hash_table_lookup (key_dir_hash, key);
+	g_free (key);
+
+	/* Not a directory anybody subscribed to */
+	if (dir == NULL)
+		return;
+
+	/* An event on the directory itself, inotify reports a Changed for
+	 * its attributes as for those of its entries.
+	 */
+	if (name == NULL || !strcmp (name, ".")) {
+		if (meta->mask & (FAN_DELETE_SELF|FAN_MOVE_SELF))
+			gam_fanotify_dir_gone (dir);
+		else if (meta->mask & (FAN_MODIFY|FAN_ATTRIB))
+			gam_server_emit_event (dir->path, 1, GAMIN_EVENT_CHANGED,
+					       dir->subs, 1);
+		return;
+	}
+
+	fullpath = g_strdup_printf ("%s/%s", dir->path, name);
+	is_dir = (meta->mask & FAN_ONDIR) ? 1 : 0;
+
+	/* Events on the same entry may have been merged, order them
+	 * by what is there now.
+	 */
+	if ((meta->mask & (FAN_DELETE|FAN_MOVED_FROM)) &&
+	    (meta->mask & (FAN_CREATE|FAN_MOVED_TO)) &&
+	    g_file_test (fullpath, G_FILE_TEST_EXISTS))
+		gam_fanotify_emit (dir, fullpath, is_dir, GAMIN_EVENT_DELETED);
+
+	if (meta->mask & (FAN_CREATE|FAN_MOVED_TO))
+		gam_fanotify_emit (dir, fullpath, is_dir, GAMIN_EVENT_CREATED);
+	if (meta->mask & (FAN_MODIFY|FAN_ATTRIB))
+		gam_fanotify_emit (dir, fullpath, is_dir, GAMIN_EVENT_CHANGED);
+	if ((meta->mask & (FAN_DELETE|FAN_MOVED_FROM)) &&
+	    (!(meta->mask & (FAN_CREATE|FAN_MOVED_TO)) ||
+	     !g_file_test (fullpath, G_FILE_TEST_EXISTS)))
+		gam_fanotify_emit (dir, fullpath, is_dir, GAMIN_EVENT_DELETED);
+
+	if ((meta->mask & (FAN_CREATE|FAN_MOVED_TO)) && dir->parked)
+		gam_fanotify_unpark (dir, fullpath);
+
+	g_free (fullpath);
+}
+
+static gboolean
+gam_fanotify_read_handler (gpointer user_data)
+{
+	char buf[GAM_FANOTIFY_BUFSIZE]
+		__attribute__ ((aligned (__alignof__ (struct fanotify_event_metadata))));
+	struct fanotify_event_metadata *meta;
+	ssize_t len, left;
+	gint events;
+
+	while ((len = read (fan_fd, buf, sizeof (buf))) > 0) {
+		gam_stats_set_origin (gam_stats_now ());
+		/* FAN_EVENT_NEXT consumes the length it is given */
+		events = 0;
+		left = len;
+		for (meta = (struct fanotify_event_metadata *) buf;
+		     FAN_EVENT_OK (meta, left);
+		     meta = FAN_EVENT_NEXT (meta, left))
+			events++;
+		GAM_PROBE2 (read_batch, events, len);
+		GAM_TRACE (READ, events, len, 0, 0, NULL);
+		for (meta = (struct fanotify_event_metadata *) buf;
+		     FAN_EVENT_OK (meta, len);
+		     meta = FAN_EVENT_NEXT (meta, len)) {
+			if (meta->vers != FANOTIFY_METADATA_VERSION) {
+				GAM_DEBUG (DEBUG_INFO, "fanotify: unknown metadata version %d\n",
+					   meta->vers);
+				gam_stats_set_origin (0);
+				return TRUE;
+			}
+			fan_events++;
+			gam_fanotify_process_event (meta);
+		}
+	}
+	gam_stats_set_origin (0);
+
+	return TRUE;
+}
+
+/**
+ * Initializes the fanotify backend. This fails unless we have the
+ * capability and the kernel can report directory handles and names.
+ *
+ * @returns TRUE if initialization succeeded, FALSE otherwise
+ */
+gboolean
+gam_fanotify_init (void)
+{
+	GIOChannel *ioc;
+	GSource *source;
+
+	fan_fd = fanotify_init (FAN_CLASS_NOTIF|FAN_REPORT_DFID_NAME|FAN_NONBLOCK|FAN_CLOEXEC,
+				O_RDONLY|O_LARGEFILE);
+	if (fan_fd < 0) {
+		GAM_DEBUG (DEBUG_INFO, "fanotify: not available: %s\n", strerror (errno));
+		return FALSE;
+	}
+
+	key_dir_hash = g_hash_table_new (g_str_hash, g_str_equal);
+	sub_dir_hash = g_hash_table_new (g_direct_hash, g_direct_equal);
+	fsid_mark_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	ioc = g_io_channel_unix_new (fan_fd);
+	source = g_io_create_watch (ioc, G_IO_IN | G_IO_HUP | G_IO_ERR);
+	g_source_set_callback (source, gam_fanotify_read_handler, NULL, NULL);
+	g_source_attach (source, NULL);
+	g_source_unref (source);
+	g_io_channel_unref (ioc);
+
+	/* For excluded paths and filesystems we can't mark */
+	gam_poll_basic_init ();
+	gam_server_install_kernel_hooks (GAMIN_K_FANOTIFY,
+					 gam_fanotify_add_subscription,
+					 gam_fanotify_remove_subscription,
+					 gam_fanotify_remove_all_for,
+					 NULL, NULL);
+	fan_running = TRUE;
+
+	GAM_DEBUG (DEBUG_INFO, "fanotify initialized\n");
+	return TRUE;
+}
+
+/**
+ * Adds a subscription to be monitored.
+ *
+ * @param sub a #GamSubscription to be monitored
+ * @returns TRUE if adding the subscription succeeded, FALSE otherwise
+ */
+gboolean
+gam_fanotify_add_subscription (GamSubscription *sub)
+{
+	GAM_DEBUG (DEBUG_INFO, "fanotify: Adding subscription for %s\n", gam_subscription_get_path (sub));
+
+	if (!gam_fanotify_attach (sub)) {
+		/* e.g. a filesystem without file handles */
+		GAM_DEBUG (DEBUG_INFO, "fanotify: polling %s\n", gam_subscription_get_path (sub));
+		return gam_poll_add_subscription (sub);
+	}
+
+	gam_listener_add_subscription (gam_subscription_get_listener (sub), sub);
+	gam_server_emit_initial_events (gam_subscription_get_path (sub), sub,
+					gam_subscription_is_dir (sub), FALSE);
+
+	return TRUE;
+}
+
+/**
+ * Removes a subscription which was being monitored.
+ *
+ * @param sub a #GamSubscription to remove
+ * @returns TRUE if removing the subscription succeeded, FALSE otherwise
+ */
+gboolean
+gam_fanotify_remove_subscription (GamSubscription *sub)
+{
+	GAM_DEBUG (DEBUG_INFO, "fanotify: Removing subscription for %s\n", gam_subscription_get_path (sub));
+
+	if (g_hash_table_lookup (sub_dir_hash, sub) == NULL)
+		return gam_poll_remove_subscription (sub);
+
+	/* Unlike the poll backend nothing refers to it any more */
+	gam_fanotify_detach (sub);
+	gam_subscription_cancel (sub);
+	gam_subscription_free (sub);
+	return TRUE;
+}
+
+static void
+gam_fanotify_collect (gpointer key, gpointer value, gpointer user_data)
+{
+	GList **subs = user_data;
+
+	*subs = g_list_prepend (*subs, key);
+}
+
+/**
+ * Stop monitoring all subscriptions for a given listener.
+ *
+ * @param listener a #GamListener
+ * @returns TRUE if removing the subscriptions succeeded, FALSE otherwise
+ */
+gboolean
+gam_fanotify_remove_all_for (GamListener *listener)
+{
+	GList *subs = NULL, *l;
+
+	GAM_DEBUG (DEBUG_INFO, "fanotify: Removing all subscriptions for %s\n", gam_listener_get_pidname (listener));
+
+	g_hash_table_foreach (sub_dir_hash, gam_fanotify_collect, &subs);
+	for (l = subs; l; l = l->next) {
+		if (gam_subscription_get_listener (l->data) == listener)
+			gam_fanotify_detach (l->data);
+	}
+	g_list_free (subs);
+
+	return gam_poll_remove_all_for (listener);
+}
+
+static void
+gam_fanotify_dir_debug (gpointer key, gpointer value, gpointer user_data)
+{
+	FanDir *dir = value;
+
+	GAM_DEBUG (DEBUG_INFO, "fanotify dir %s: %d subs %d parked\n", dir->path,
+		   g_list_length (dir->subs), g_list_length (dir->parked));
+}
+
+static void
+gam_fanotify_mark_debug (gpointer key, gpointer value, gpointer user_data)
+{
+	FanMark *mark = value;
+
+	GAM_DEBUG (DEBUG_INFO, "fanotify mark %s through %s: %d refs\n",
+		   (const char *) key, mark->path, mark->refs);
+}
+
+void
+gam_fanotify_debug (void)
+{
+	if (!fan_running)
+		return;
+
+	GAM_DEBUG (DEBUG_INFO, "Dumping fanotify subscriptions\n");
+	g_hash_table_foreach (fsid_mark_hash, gam_fanotify_mark_debug, NULL);
+	g_hash_table_foreach (key_dir_hash, gam_fanotify_dir_debug, NULL);
+}
+
+void
+gam_fanotify_stats (GString *out)
+{
+	/* one mark per filesystem in use */
+	gam_stats_add (out, "kernel_watches", g_hash_table_size (fsid_mark_hash));
+	gam_stats_add (out, "kernel_events", fan_events);
+	gam_stats_add (out, "fanotify_overflows", fan_overflows);
+}
+
+/* A copy of the directory keys, for a dump of the directories by
+ * gam_snapshot.c over several main loop iterations.
+ */
+GList *
+gam_fanotify_snapshot_keys (void)
+{
+	GList *keys = NULL;
+
+	g_hash_table_foreach (key_dir_hash, gam_fanotify_collect_key, &keys);
+	return keys;
+}
+
+/* Appends the directories of the first keys as JSON objects, at most
+ * *budget of them, and frees those keys. The directories gone since
+ * the keys were taken are skipped. Returns the keys left.
+ */
+GList *
+gam_fanotify_snapshot_dirs (GString *out, GList *keys, guint *budget, gboolean *first)
+{
+	FanDir *dir;
+
+	while (keys && (*budget > 0)) {
+		dir = g_hash_table_lookup (key_dir_hash, keys->data);
+		if (dir != NULL) {
+			gam_snapshot_item (out, first);
+			g_string_append (out, "{\"path\": ");
+			gam_snapshot_string (out, dir->path);
+			g_string_append_printf (out, ", \"subscriptions\": %u, \"parked\": %u}",
+						g_list_length (dir->subs),
+						g_list_length (dir->parked));
+			(*budget)--;
+		}
+		g_free (keys->data);
+		keys = g_list_delete_link (keys, keys);
+	}
+
+	return keys;
+}
+
+gboolean
+gam_fanotify_is_running (void)
+{
+	return fan_running;
+}
@@ -0,0 +1,24 @@
+#ifndef __GAM_FANOTIFY_H__
+#define __GAM_FANOTIFY_H__
+
+#include <glib.h>
+#include "gam_subscription.h"
+
+G_BEGIN_DECLS
+
+gboolean   gam_fanotify_init                  (void);
+gboolean   gam_fanotify_add_subscription      (GamSubscription *sub);
+gboolean   gam_fanotify_remove_subscription   (GamSubscription *sub);
+gboolean   gam_fanotify_remove_all_for        (GamListener *listener);
+void       gam_fanotify_debug                 (void);
+void       gam_fanotify_stats                 (GString *out);
+GList *    gam_fanotify_snapshot_keys         (void);
+GList *    gam_fanotify_snapshot_dirs         (GString *out,
+                                               GList *keys,
+                                               guint *budget,
+                                               gboolean *first);
+gboolean   gam_fanotify_is_running            (void);
+
+G_END_DECLS
+
+#endif /* __GAM_FANOTIFY_H__ */
@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 #include "gam_error.h"
 #include "gam_fs.h"
@@ -23,17 +24,138 @@ typedef struct _gam_fs {
 	char *fsname;
 } gam_fs;
 
+/*
+ * The mount points are kept in a trie of path components, so finding
+ * the mount owning a path costs one hash lookup per directory level
+ * whatever the number of mounts. The node of a mount point remembers
+ * the properties of its file system type, props_serial tells when
+ * gam_fs_set() or gam_fs_unset() made that stale.
+ */
+typedef struct _gam_fs_node {
+	GHashTable *children;	/* component -> gam_fs_node */
+	const gam_fs *fs;	/* mounted here, NULL if none */
+	const gam_fs_properties *props;
+	guint props_serial;
+} gam_fs_node;
+
 static gboolean initialized = FALSE;
 static GList *filesystems = NULL;
+static gam_fs_node *mount_root = NULL;
 static GList *fs_props = NULL;
+static guint props_serial = 1;
 static struct stat mtab_sbuf;
 
+/*
+ * On Linux the mount table is read from /proc/self/mountinfo once and
+ * then only when the kernel flags the file with POLLPRI after a mount
+ * or unmount, so classifying a path doesn't cost a syscall. Elsewhere
+ * /etc/mtab is rescanned when its mtime changes.
+ */
+#define MOUNTINFO "/proc/self/mountinfo"
+
+static int mountinfo_fd = -1;
+
+static gam_fs_node *
+gam_fs_node_new (void)
+{
+	return g_new0 (gam_fs_node, 1);
+}
+
+static void
+gam_fs_node_free (gpointer data)
+{
+	gam_fs_node *node = data;
+
+	if (node->children)
+		g_hash_table_destroy (node->children);
+	g_free (node);
+}
+
+static void
+gam_fs_node_insert (const gam_fs *fs)
+{
+	gam_fs_node *node, *child;
+	const char *p, *end;
+	char *name;
+
+	if (mount_root == NULL)
+		mount_root = gam_fs_node_new ();
+	node = mount_root;
+
+	for (p = fs->path; *p; p = end)
+	{
+		while (*p == '/')
+			p++;
+		if (*p == '\0')
+			break;
+		for (end = p; *end && *end != '/'; end++)
+			;
+
+		name = g_strndup (p, end - p);
+		if (node->children == NULL)
+			node->children = g_hash_table_new_full (g_str_hash, g_str_equal,
+							       g_free, gam_fs_node_free);
+		child = g_hash_table_lookup (node->children, name);
+		if (child == NULL) {
+			child = gam_fs_node_new ();
+			g_hash_table_insert (node->children, name, child);
+		} else
+			g_free (name);
+		node = child;
+	}
+
+	/* a later mount on the same point hides the earlier one */
+	node->fs = fs;
+	node->props_serial = 0;
+}
+
+/* Returns the node of the deepest mount point containing @path */
+static gam_fs_node *
+gam_fs_node_lookup (const char *path)
+{
+	gam_fs_node *node, *best;
+	const char *p, *end;
+	char name[256];
+
+	if (mount_root == NULL)
+		return NULL;
+	node = mount_root;
+	best = node->fs ? node : NULL;
+
+	for (p = path; *p; p = end)
+	{
+		while (*p == '/')
+			p++;
+		if (*p == '\0' || node->children == NULL)
+			break;
+		for (end = p; *end && *end != '/'; end++)
+			;
+		if (end - p >= (int) sizeof (name))
+			break;
+
+		memcpy (name, p, end - p);
+		name[end - p] = '\0';
+		node = g_hash_table_lookup (node->children, name);
+		if (node == NULL)
+			break;
+		if (node->fs)
+			best = node;
+	}
+
+	return best;
+}
+
 static void
 gam_fs_free_filesystems (void)
 {
 	GList *iterator = NULL;
 	gam_fs *fs = NULL;
 
+	if (mount_root != NULL) {
+		gam_fs_node_free (mount_root);
+		mount_root = NULL;
+	}
+
 	iterator = filesystems;
 
 	while (iterator) 
@@ -51,63 +173,171 @@ gam_fs_free_filesystems (void)
 }
 
 
-static const gam_fs *
-gam_fs_find_fs (const char *path)
+static const gam_fs_properties *
+gam_fs_find_fs_props (const char *path)
 {
+	gam_fs_node *node = NULL;
+	gam_fs_properties *props = NULL;
 	GList *iterator = NULL;
-	gam_fs *fs = NULL;
 
 	gam_fs_init ();
 
-	iterator = filesystems;
+	node = gam_fs_node_lookup (path);
+	if (!node)
+		return NULL;
 
-	while (iterator)
+	if (node->props_serial == props_serial)
+		return node->props;
+
+	node->props = NULL;
+	node->props_serial = props_serial;
+	iterator = fs_props;
+
+	while (iterator) 
 	{
-		fs = iterator->data;
+		props = iterator->data;
 
-		if (g_str_has_prefix (path, fs->path)) {
-			return fs;
+		if (!strcmp (props->fsname, node->fs->fsname)) {
+			node->props = props;
+			break;
 		}
 		iterator = g_list_next (iterator);
 	}
 
-	return NULL;
+	return node->props;
 }
 
-static const gam_fs_properties *
-gam_fs_find_fs_props (const char *path)
+/*
+ * Replace the old file systems list with the new one, given in reverse
+ * mount order.
+ */
+static void
+gam_fs_set_filesystems (GList *new_filesystems)
 {
-	const gam_fs *fs = NULL;
-	gam_fs_properties *props = NULL;
-	GList *iterator = NULL;
+	GList *iterator;
 
-	fs = gam_fs_find_fs (path);
-	if (!fs)
-		return NULL;
+	gam_fs_free_filesystems ();
+	filesystems = g_list_reverse (new_filesystems);
+	for (iterator = filesystems; iterator; iterator = g_list_next (iterator))
+		gam_fs_node_insert (iterator->data);
+}
 
-	iterator = fs_props;
+/* Undo the octal escaping of blanks and backslashes in mount points */
+static gchar *
+gam_fs_unescape (const char *str)
+{
+	gchar *ret, *out;
 
-	while (iterator) 
+	ret = out = g_malloc (strlen (str) + 1);
+	while (*str)
 	{
-		props = iterator->data;
+		if (str[0] == '\\' &&
+		    str[1] >= '0' && str[1] <= '3' &&
+		    str[2] >= '0' && str[2] <= '7' &&
+		    str[3] >= '0' && str[3] <= '7')
+		{
+			*out++ = ((str[1] - '0') << 6) | ((str[2] - '0') << 3) | (str[3] - '0');
+			str += 4;
+		} else
+			*out++ = *str++;
+	}
+	*out = '\0';
+	return ret;
+}
+
+/*
+ * Lines of mountinfo look like
+ * 36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+ * the mount point is the 5th field, the type follows the " - " separator.
+ */
+static void
+gam_fs_scan_mountinfo (void)
+{
+	GString *contents;
+	gchar buf[4096], **lines, **words;
+	GList *new_filesystems = NULL;
+	gam_fs *fs = NULL;
+	ssize_t len;
+	int i, sep;
 
-		if (!strcmp (props->fsname, fs->fsname)) {
-			return props;
+	if (lseek (mountinfo_fd, 0, SEEK_SET) < 0)
+		return;
+
+	contents = g_string_new (NULL);
+	while ((len = read (mountinfo_fd, buf, sizeof (buf))) != 0)
+	{
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			GAM_DEBUG(DEBUG_INFO, "Could not read %s\n", MOUNTINFO);
+			g_string_free (contents, TRUE);
+			return;
 		}
-		iterator = g_list_next (iterator);
+		g_string_append_len (contents, buf, len);
+	}
+
+	lines = g_strsplit (contents->str, "\n", 0);
+	g_string_free (contents, TRUE);
+	if (lines == NULL)
+		return;
+
+	for (i = 0; lines[i] != NULL; i++)
+	{
+		if (lines[i][0] == '\0')
+			continue;
+
+		words = g_strsplit (lines[i], " ", 0);
+		if (words == NULL)
+			continue;
+
+		for (sep = 0; words[sep] != NULL; sep++)
+			if (!strcmp (words[sep], "-"))
+				break;
+
+		if (sep < 5 || words[sep] == NULL || words[sep + 1] == NULL ||
+		    words[4][0] == '\0' || words[sep + 1][0] == '\0')
+		{
+			g_strfreev (words);
+			continue;
+		}
+
+		fs = g_new0 (gam_fs, 1);
+		fs->path = gam_fs_unescape (words[4]);
+		fs->fsname = g_strdup (words[sep + 1]);
+
+		g_strfreev (words);
+
+		new_filesystems = g_list_prepend (new_filesystems, fs);
 	}
+	g_strfreev (lines);
 
-	return NULL;
+	gam_fs_set_filesystems (new_filesystems);
 }
 
+static gboolean
+gam_fs_mountinfo_changed (GIOChannel *source, GIOCondition condition,
+			  gpointer data)
+{
+	GAM_DEBUG(DEBUG_INFO, "Updating list of mounted filesystems\n");
+	gam_fs_scan_mountinfo ();
+	return TRUE;
+}
 
-static gint
-gam_fs_filesystem_sort_cb (gconstpointer a, gconstpointer b)
+static gboolean
+gam_fs_watch_mountinfo (void)
 {
-	const gam_fs *fsa = a;
-	const gam_fs *fsb = b;
+	GIOChannel *ioc;
+
+	mountinfo_fd = open (MOUNTINFO, O_RDONLY);
+	if (mountinfo_fd < 0)
+		return FALSE;
+
+	ioc = g_io_channel_unix_new (mountinfo_fd);
+	g_io_add_watch (ioc, G_IO_PRI, gam_fs_mountinfo_changed, NULL);
+	g_io_channel_unref (ioc);
 
-	return strlen(fsb->path) - strlen (fsa->path);
+	gam_fs_scan_mountinfo ();
+	return TRUE;
 }
 
 static void
@@ -161,9 +391,7 @@ gam_fs_scan_mtab (void)
 	}
 	g_free (contents);
 
-	/* Replace the old file systems list with the new one */
-	gam_fs_free_filesystems ();
-	filesystems = g_list_sort (new_filesystems, gam_fs_filesystem_sort_cb);
+	gam_fs_set_filesystems (new_filesystems);
 }
 
 void
@@ -172,6 +400,14 @@ gam_fs_init (void)
 	if (initialized == FALSE)
 	{
 		initialized = TRUE;
+		if (!gam_fs_watch_mountinfo ())
+		{
+			if (stat("/etc/mtab", &mtab_sbuf) != 0)
+			{
+				GAM_DEBUG(DEBUG_INFO, "Could not stat /etc/mtab\n");
+			}
+			gam_fs_scan_mtab ();
+		}
 		gam_fs_set ("ext3", GFS_MT_DEFAULT, 0);
 		gam_fs_set ("ext2", GFS_MT_DEFAULT, 0);
 		gam_fs_set ("reiser4", GFS_MT_DEFAULT, 0);
@@ -179,12 +415,7 @@ gam_fs_init (void)
 		gam_fs_set ("novfs", GFS_MT_POLL, 30);
 		gam_fs_set ("nfs", GFS_MT_POLL, 5);
 		gam_fs_set ("nfs4", GFS_MT_POLL, 5);
-		if (stat("/etc/mtab", &mtab_sbuf) != 0)
-		{
-			GAM_DEBUG(DEBUG_INFO, "Could not stat /etc/mtab\n");
-		}
-		gam_fs_scan_mtab ();
-	} else {
+	} else if (mountinfo_fd < 0) {
 		struct stat sbuf;
 
 		if (stat("/etc/mtab", &sbuf) != 0)
@@ -254,6 +485,7 @@ gam_fs_set (const char *fsname, gam_fs_mon_type type, int poll_timeout)
 	}
 
 	prop = g_new0(gam_fs_properties, 1);
+	props_serial++;
 
 	prop->fsname = g_strdup (fsname);
 	prop->mon_type = type;
@@ -281,6 +513,7 @@ gam_fs_unset (const char *fsname)
 
 		if (!strcmp (prop->fsname, fsname)) {
 			fs_props = g_list_remove (fs_props, prop);
+			props_serial++;
 			g_free (prop->fsname);
 			g_free (prop);
 			return;
@@ -7,6 +7,7 @@ typedef enum {
 	GFS_MT_NONE,
 #if !defined(ENABLE_DNOTIFY) && \
     !defined(ENABLE_INOTIFY) && \
+    !defined(ENABLE_FANOTIFY) && \
     !defined(ENABLE_KQUEUE) && \
     !defined(ENABLE_HURD_MACH_NOTIFY)
 	GFS_MT_DEFAULT = GFS_MT_POLL,
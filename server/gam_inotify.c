@@ -18,9 +18,11 @@
 
 #include "server_config.h"
 #include <string.h>
+#include <time.h>
 #include <sys/inotify.h>
 #include "inotify-sub.h"
 #include "inotify-helper.h"
+#include "inotify-path.h"
 #include "inotify-diag.h"
 #ifdef GAMIN_DEBUG_API
 #include "gam_debugging.h"
@@ -30,6 +32,40 @@
 #include "gam_server.h"
 #include "gam_subscription.h"
 #include "gam_inotify.h"
+#include "gam_protocol.h"
+#include "gam_conf.h"
+#include "gam_stats.h"
+
+/* What subscriptions with GAM_OPT_SETTLED need, IN_CLOSE_WRITE on top
+ * of the usual set.
+ */
+#define GAM_INOTIFY_SETTLED_MASK (IP_INOTIFY_MASK|IN_CLOSE_WRITE)
+/* A file still open for writing gets a Changed that often */
+#define GAM_INOTIFY_SETTLE_TIMEOUT 5
+#define GAM_INOTIFY_SETTLE_CHECK 1000
+
+/* A file modified under a GAM_OPT_SETTLED subscription which wasn't
+ * closed yet.
+ */
+typedef struct {
+	GamSubscription *sub;
+	char *path;
+	time_t since;
+	GList *link;		/* in unsettled_queue */
+} gam_inotify_unsettled_t;
+
+/* The pending entries, keyed on (sub, path) for the lookup done on
+ * every write, and queued oldest first for the timeout check.
+ */
+static GHashTable *unsettled_hash = NULL;
+static GQueue *unsettled_queue = NULL;
+static guint unsettled_source = 0;
+
+/* The directory and file subscriptions an event is emitted to, each
+ * batch under one serial so that a group filters it once.
+ */
+static GPtrArray *emit_dir_subs = NULL;
+static GPtrArray *emit_file_subs = NULL;
 
 /* Transforms a inotify event to a gamin event. */
 static GaminEventType
@@ -67,67 +103,181 @@ ih_mask_to_EventType (guint32 mask)
 	}
 }
 
+static guint
+gam_inotify_unsettled_hash (gconstpointer key)
+{
+	const gam_inotify_unsettled_t *u = key;
+
+	return g_str_hash (u->path) ^ g_direct_hash (u->sub);
+}
+
+static gboolean
+gam_inotify_unsettled_equal (gconstpointer a, gconstpointer b)
+{
+	const gam_inotify_unsettled_t *ua = a;
+	const gam_inotify_unsettled_t *ub = b;
+
+	return ua->sub == ub->sub && !strcmp (ua->path, ub->path);
+}
+
+static gam_inotify_unsettled_t *
+gam_inotify_unsettled_find (GamSubscription *sub, const char *path)
+{
+	gam_inotify_unsettled_t key;
+
+	if (unsettled_hash == NULL)
+		return NULL;
+
+	key.sub = sub;
+	key.path = (char *) path;
+
+	return g_hash_table_lookup (unsettled_hash, &key);
+}
+
 static void
-gam_inotify_send_initial_events (const char *pathname, GamSubscription *sub, gboolean is_dir, gboolean was_missing)
+gam_inotify_unsettled_free (gam_inotify_unsettled_t *u)
 {
-	GaminEventType gevent;
+	g_queue_delete_link (unsettled_queue, u->link);
+	g_hash_table_remove (unsettled_hash, u);
+	g_free (u->path);
+	g_free (u);
+}
 
-	if (was_missing) {
-	  gevent = GAMIN_EVENT_CREATED;
-	} else {
-	  if (g_file_test (pathname, G_FILE_TEST_EXISTS))
-	    gevent = GAMIN_EVENT_EXISTS;
-	  else
-	    gevent = GAMIN_EVENT_DELETED;
-	}
+static void
+gam_inotify_unsettled_emit (gam_inotify_unsettled_t *u)
+{
+	gam_server_emit_one_event (u->path, gam_subscription_is_dir (u->sub),
+				   GAMIN_EVENT_CHANGED, u->sub, 1);
+	gam_inotify_unsettled_free (u);
+}
 
-	gam_server_emit_one_event (pathname, is_dir ? 1 : 0, gevent, sub, 1);
+/* Timeout fallback for files which stay open for writing */
+static gboolean
+gam_inotify_unsettled_check (gpointer data)
+{
+	gam_inotify_unsettled_t *u;
+	time_t now = time (NULL);
 
-	if (is_dir) 
+	/* Oldest first, stop at the first one still within its time */
+	while ((u = g_queue_peek_head (unsettled_queue)) != NULL)
 	{
-		GDir *dir;
-		GError *err = NULL;
-		dir = g_dir_open (pathname, 0, &err);
-		if (dir)
-		{
-			const char *filename;
+		if (now - u->since < GAM_INOTIFY_SETTLE_TIMEOUT)
+			break;
+		GAM_DEBUG (DEBUG_INFO, "inotify: %s still open, reporting change\n", u->path);
+		gam_inotify_unsettled_emit (u);
+	}
 
-			while ((filename = g_dir_read_name (dir)))
-			{
-				gchar *fullname = g_strdup_printf ("%s/%s", pathname, filename);
-				gboolean file_is_dir = FALSE;
-				struct stat fsb;
-				memset(&fsb, 0, sizeof (struct stat));
-				lstat(fullname, &fsb);
-				file_is_dir = (fsb.st_mode & S_IFDIR) != 0 ? TRUE : FALSE;
-				gam_server_emit_one_event (fullname, file_is_dir ? 1 : 0, gevent, sub, 1);
-				g_free (fullname);
-			}
+	if (g_queue_is_empty (unsettled_queue))
+	{
+		unsettled_source = 0;
+		return FALSE;
+	}
 
-			g_dir_close (dir);
-		} else {
-			GAM_DEBUG (DEBUG_INFO, "unable to open directory %s: %s\n", pathname, err->message);
-			g_error_free (err);
-		}
+	return TRUE;
+}
 
-	}
+static void
+gam_inotify_unsettled_purge (gboolean (*pred)(GamSubscription *sub, void *callerdata), void *callerdata)
+{
+	GList *l, *next;
+
+	if (unsettled_queue == NULL)
+		return;
 
-	if (!was_missing) 
+	for (l = unsettled_queue->head; l; l = next)
 	{
-		gam_server_emit_one_event (pathname, is_dir ? 1 : 0, GAMIN_EVENT_ENDEXISTS, sub, 1);
+		gam_inotify_unsettled_t *u = l->data;
+
+		next = l->next;
+		if (pred (u->sub, callerdata))
+			gam_inotify_unsettled_free (u);
 	}
+}
+
+/* Returns TRUE if the event was swallowed for a settled subscription */
+static gboolean
+gam_inotify_settle (const char *fullpath, guint32 mask, GamSubscription *sub)
+{
+	gam_inotify_unsettled_t *u;
+
+	if (!gam_subscription_has_option (sub, GAM_OPT_SETTLED))
+		return FALSE;
+
+	mask &= ~IN_ISDIR;
+	u = gam_inotify_unsettled_find (sub, fullpath);
+
+	switch (mask)
+	{
+	case IN_MODIFY:
+		if (u == NULL)
+		{
+			if (unsettled_hash == NULL)
+			{
+				unsettled_hash = g_hash_table_new (gam_inotify_unsettled_hash,
+								   gam_inotify_unsettled_equal);
+				unsettled_queue = g_queue_new ();
+			}
 
+			u = g_new0 (gam_inotify_unsettled_t, 1);
+			u->sub = sub;
+			u->path = g_strdup (fullpath);
+			u->since = time (NULL);
+			g_queue_push_tail (unsettled_queue, u);
+			u->link = unsettled_queue->tail;
+			g_hash_table_insert (unsettled_hash, u, u);
+
+			if (unsettled_source == 0)
+				unsettled_source = g_timeout_add (GAM_INOTIFY_SETTLE_CHECK,
+								  gam_inotify_unsettled_check, NULL);
+		}
+		return TRUE;
+	case IN_CLOSE_WRITE:
+		/* Nothing to report if it wasn't written to */
+		if (u != NULL)
+			gam_inotify_unsettled_emit (u);
+		return TRUE;
+	case IN_MOVE_SELF:
+	case IN_MOVED_FROM:
+	case IN_DELETE:
+	case IN_DELETE_SELF:
+		/* The Deleted makes the pending change moot */
+		if (u != NULL)
+			gam_inotify_unsettled_free (u);
+		return FALSE;
+	default:
+		return FALSE;
+	}
 }
 
 static void
-gam_inotify_event_callback (const char *fullpath, guint32 mask, void *subdata)
+gam_inotify_event_callback (const char *fullpath, guint32 mask, ih_sub_t **subs, guint nsubs)
 {
-	GamSubscription *sub = (GamSubscription *)subdata;
 	GaminEventType gevent;
+	guint i;
+
+	for (i = 0; i < nsubs; i++)
+	{
+		GamSubscription *sub = (GamSubscription *)subs[i]->usersubdata;
+
+		if (gam_inotify_settle (fullpath, mask, sub))
+			continue;
+
+		if (gam_subscription_is_dir (sub))
+			g_ptr_array_add (emit_dir_subs, sub);
+		else
+			g_ptr_array_add (emit_file_subs, sub);
+	}
 
 	gevent = ih_mask_to_EventType (mask);
 
-	gam_server_emit_one_event (fullpath, gam_subscription_is_dir (sub), gevent, sub, 1);
+	gam_server_emit_event_subs (fullpath, 1, gevent,
+				    (GamSubscription **) emit_dir_subs->pdata,
+				    emit_dir_subs->len, 1);
+	gam_server_emit_event_subs (fullpath, 0, gevent,
+				    (GamSubscription **) emit_file_subs->pdata,
+				    emit_file_subs->len, 1);
+	g_ptr_array_set_size (emit_dir_subs, 0);
+	g_ptr_array_set_size (emit_file_subs, 0);
 }
 
 static void
@@ -135,7 +285,7 @@ gam_inotify_found_callback (const char *fullpath, void *subdata)
 {
 	GamSubscription *sub = (GamSubscription *)subdata;
 
-	gam_inotify_send_initial_events (gam_subscription_get_path (sub), sub, gam_subscription_is_dir (sub), TRUE);
+	gam_server_emit_initial_events (gam_subscription_get_path (sub), sub, gam_subscription_is_dir (sub), TRUE);
 }
 
 
@@ -143,6 +293,9 @@ gboolean
 gam_inotify_init (void)
 {
 	gam_poll_basic_init ();
+	emit_dir_subs = g_ptr_array_new ();
+	emit_file_subs = g_ptr_array_new ();
+	ik_set_shards (gam_conf_get_inotify_shards ());
 	gam_server_install_kernel_hooks (GAMIN_K_INOTIFY2, 
 					 gam_inotify_add_subscription,
 					 gam_inotify_remove_subscription,
@@ -161,6 +314,8 @@ gam_inotify_add_subscription (GamSubscription *sub)
 	gam_listener_add_subscription(gam_subscription_get_listener(sub), sub);
 	
 	isub = ih_sub_new (gam_subscription_get_path (sub), gam_subscription_is_dir (sub), 0, sub);
+	if (gam_subscription_has_option (sub, GAM_OPT_SETTLED))
+		isub->mask = GAM_INOTIFY_SETTLED_MASK;
 
 	if (!ih_sub_add (isub))
 	{
@@ -168,7 +323,7 @@ gam_inotify_add_subscription (GamSubscription *sub)
 		return FALSE;
 	}
 
-	gam_inotify_send_initial_events (gam_subscription_get_path (sub), sub, gam_subscription_is_dir (sub), FALSE);
+	gam_server_emit_initial_events (gam_subscription_get_path (sub), sub, gam_subscription_is_dir (sub), FALSE);
 
 	return TRUE;
 }
@@ -179,9 +334,22 @@ gam_inotify_remove_sub_pred (ih_sub_t *sub, void *callerdata)
 	return sub->usersubdata == callerdata;
 }
 
+static gboolean
+gam_inotify_unsettled_sub_pred (GamSubscription *sub, void *callerdata)
+{
+	return sub == callerdata;
+}
+
+static gboolean
+gam_inotify_unsettled_listener_pred (GamSubscription *sub, void *callerdata)
+{
+	return gam_subscription_get_listener (sub) == callerdata;
+}
+
 gboolean
 gam_inotify_remove_subscription (GamSubscription *sub)
 {
+	gam_inotify_unsettled_purge (gam_inotify_unsettled_sub_pred, sub);
 	ih_sub_foreach_free (sub, gam_inotify_remove_sub_pred);
 
 	return TRUE;
@@ -198,6 +366,7 @@ gam_inotify_remove_listener_pred (ih_sub_t *sub, void *callerdata)
 gboolean
 gam_inotify_remove_all_for (GamListener *listener)
 {
+	gam_inotify_unsettled_purge (gam_inotify_unsettled_listener_pred, listener);
 	ih_sub_foreach_free (listener, gam_inotify_remove_listener_pred);
 
 	return TRUE;
@@ -206,9 +375,54 @@ gam_inotify_remove_all_for (GamListener *listener)
 void
 gam_inotify_debug (void)
 {
+	int i;
+
+	for (i = 0; i < ik_shard_count (); i++)
+	{
+		guint32 watches, events, reads;
+
+		ik_shard_stats (i, &watches, &events, &reads);
+		GAM_DEBUG (DEBUG_INFO, "inotify shard %d: %u watches %u events %u reads\n",
+			   i, watches, events, reads);
+	}
+
 	id_dump (NULL);
 }
 
+void
+gam_inotify_stats (GString *out)
+{
+	gulong watches = 0, events = 0, reads = 0;
+	int i;
+
+	for (i = 0; i < ik_shard_count (); i++)
+	{
+		guint32 w, e, r;
+
+		ik_shard_stats (i, &w, &e, &r);
+		watches += w;
+		events += e;
+		reads += r;
+	}
+	gam_stats_add (out, "kernel_watches", watches);
+	gam_stats_add (out, "kernel_events", events);
+	gam_stats_add (out, "kernel_reads", reads);
+}
+
+/* Resumable dump of the watched directories for gam_snapshot.c */
+gint32
+gam_inotify_snapshot_dirs (GString *out, gint32 wd, guint *budget, gboolean *first)
+{
+	return ih_snapshot_dirs (out, wd, budget, first);
+}
+
+/* Same for the missing list, resumed by position */
+gint
+gam_inotify_snapshot_missing (GString *out, gint index, guint *budget, gboolean *first)
+{
+	return ih_snapshot_missing (out, index, budget, first);
+}
+
 gboolean
 gam_inotify_is_running (void)
 {
@@ -11,6 +11,15 @@ gboolean   gam_inotify_add_subscription      (GamSubscription *sub);
 gboolean   gam_inotify_remove_subscription   (GamSubscription *sub);
 gboolean   gam_inotify_remove_all_for        (GamListener *listener);
 void       gam_inotify_debug                 (void); 
+void       gam_inotify_stats                 (GString *out);
+gint32     gam_inotify_snapshot_dirs         (GString *out,
+                                              gint32 wd,
+                                              guint *budget,
+                                              gboolean *first);
+gint       gam_inotify_snapshot_missing      (GString *out,
+                                              gint index,
+                                              guint *budget,
+                                              gboolean *first);
 gboolean   gam_inotify_is_running            (void);
 
 G_END_DECLS
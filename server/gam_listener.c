@@ -18,24 +18,44 @@
 
 #include "server_config.h"
 
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <glib.h>
 #include "gam_listener.h"
 #include "gam_subscription.h"
 #include "gam_server.h"
 #include "gam_error.h"
 #include "gam_pidname.h"
+#include "gam_stats.h"
 #ifdef ENABLE_INOTIFY
 #include "gam_inotify.h"
 #endif
 
 //#define GAM_LISTENER_VERBOSE
+
+static guint listener_serial = 0;
+
+/* the events sent over the last minute are counted per second */
+#define GAM_LISTENER_RATE_SLOTS 60
+
 /* private struct representing a single listener */
 struct _GamListener {
     void *service;
     int pid;
     char *pidname;
     GList *subs;
+    guint serial;		/* changes with subs, see gam_listener_get_serial() */
+
+    /* resources used on behalf of the client, see gam_listener_stats() */
+    gulong kernel_watches;
+    gulong poll_nodes;
+    gulong events_queued;
+    gulong events_dropped;	/* coalesced or failed to write */
+    gulong events_sent;
+    gulong bytes_written;
+    time_t rate_time;		/* the second counted in rate[rate_time % 60] */
+    guint rate[GAM_LISTENER_RATE_SLOTS];
 };
 
 /**
@@ -68,6 +88,7 @@ gam_listener_new(void *service, int pid)
     listener->service = service;
     listener->pid = pid;
     listener->pidname = gam_get_pidname (pid);
+    listener->serial = ++listener_serial;
     listener->subs = NULL;
 
 #ifdef GAM_LISTENER_VERBOSE
@@ -90,15 +111,17 @@ gam_listener_free_subscription(GamListener *listener,
 			       GamSubscription *sub)
 {
     char *path;
+    gboolean excluded;
     
     g_assert(listener);
     g_assert(sub);
     g_assert(g_list_find(listener->subs, sub));
     path = g_strdup(gam_subscription_get_path(sub));
+    excluded = gam_subscription_is_excluded(sub);
     
     gam_remove_subscription(sub);
 #ifdef ENABLE_INOTIFY
-    if (gam_inotify_is_running() && (!gam_exclude_check(path))) {
+    if (gam_inotify_is_running() && (!excluded)) {
 	gam_fs_mon_type type;
 
 	type = gam_fs_get_mon_type (path);
@@ -127,6 +150,7 @@ gam_listener_free(GamListener *listener)
         GamSubscription * sub = cur->data;
 	gam_listener_free_subscription(listener, sub);
 	listener->subs = g_list_delete_link(listener->subs, cur);
+	listener->serial = ++listener_serial;
     }
 	g_free(listener->pidname);
     g_free(listener);
@@ -262,6 +286,7 @@ gam_listener_add_subscription(GamListener *listener,
     g_assert(!g_list_find(listener->subs, sub));
 
     listener->subs = g_list_prepend(listener->subs, sub);
+    listener->serial = ++listener_serial;
     GAM_DEBUG(DEBUG_INFO, "Adding sub %s to listener %s\n", gam_subscription_get_path (sub), listener->pidname);
 }
 
@@ -282,6 +307,7 @@ gam_listener_remove_subscription(GamListener *listener,
     g_assert(g_list_find(listener->subs, sub));
 
     listener->subs = g_list_remove(listener->subs, sub);
+    listener->serial = ++listener_serial;
     GAM_DEBUG(DEBUG_INFO, "Removing sub %s from listener %s\n", gam_subscription_get_path (sub), listener->pidname);
     /* There should only be one.  */
     g_assert(!g_list_find(listener->subs, sub));
@@ -304,6 +330,178 @@ gam_listener_get_subscriptions(GamListener *listener)
     return g_list_copy(listener->subs);
 }
 
+/**
+ * gam_listener_account:
+ *
+ * @listener: the #GamListener
+ * @resource: what watches one of its subscriptions
+ * @delta: 1 when the subscription is added, -1 when removed
+ *
+ * Accounts for the kernel watches and poll nodes used for a listener.
+ */
+void
+gam_listener_account(GamListener *listener, GamResource resource, int delta)
+{
+    if (listener == NULL)
+        return;
+
+    if (resource == GAM_RESOURCE_KERNEL)
+        listener->kernel_watches += delta;
+    else if (resource == GAM_RESOURCE_POLL)
+        listener->poll_nodes += delta;
+}
+
+/**
+ * gam_listener_event_queued:
+ *
+ * @listener: the #GamListener
+ * @coalesced: was the event dropped as a duplicate of the last queued one
+ *
+ * Accounts for an event put in the queue of the listener's connection.
+ */
+void
+gam_listener_event_queued(GamListener *listener, gboolean coalesced)
+{
+    if (listener == NULL)
+        return;
+
+    listener->events_queued++;
+    if (coalesced)
+        listener->events_dropped++;
+}
+
+/*
+ * Moves the per second counts to the current time, forgetting those
+ * older than a minute.
+ */
+static void
+gam_listener_rate_update(GamListener *listener, time_t now)
+{
+    time_t t;
+
+    if (now - listener->rate_time >= GAM_LISTENER_RATE_SLOTS) {
+        memset(listener->rate, 0, sizeof(listener->rate));
+    } else {
+        for (t = listener->rate_time + 1; t <= now; t++)
+            listener->rate[t % GAM_LISTENER_RATE_SLOTS] = 0;
+    }
+    if (now > listener->rate_time)
+        listener->rate_time = now;
+}
+
+/**
+ * gam_listener_event_sent:
+ *
+ * @listener: the #GamListener
+ * @len: the size of the packet written
+ *
+ * Accounts for an event written to the listener's connection.
+ */
+void
+gam_listener_event_sent(GamListener *listener, int len)
+{
+    time_t now;
+
+    if (listener == NULL)
+        return;
+
+    listener->events_sent++;
+    listener->bytes_written += len;
+
+    now = time(NULL);
+    if (now != listener->rate_time)
+        gam_listener_rate_update(listener, now);
+    listener->rate[now % GAM_LISTENER_RATE_SLOTS]++;
+}
+
+/**
+ * gam_listener_event_dropped:
+ *
+ * @listener: the #GamListener
+ *
+ * Accounts for an event which couldn't be written to the connection.
+ */
+void
+gam_listener_event_dropped(GamListener *listener)
+{
+    if (listener != NULL)
+        listener->events_dropped++;
+}
+
+/**
+ * gam_listener_stats:
+ *
+ * @listener: the #GamListener
+ * @out: the statistics being collected
+ * @prefix: the name prefix for the values of this listener
+ *
+ * Reports the resources used on behalf of a listener: its subscriptions,
+ * the kernel watches and poll nodes backing them, its event traffic and
+ * the number of events sent over the last minute.
+ */
+void
+gam_listener_stats(GamListener *listener, GString *out, const char *prefix)
+{
+    char name[100];
+    gulong minute = 0;
+    int i;
+
+    g_assert(listener);
+
+    gam_listener_rate_update(listener, time(NULL));
+    for (i = 0; i < GAM_LISTENER_RATE_SLOTS; i++)
+        minute += listener->rate[i];
+
+#define GAM_LISTENER_STAT(field, value)				\
+    snprintf(name, sizeof(name), "%s.%s", prefix, field);		\
+    gam_stats_add(out, name, value)
+
+    GAM_LISTENER_STAT("subscriptions", g_list_length(listener->subs));
+    GAM_LISTENER_STAT("kernel_watches", listener->kernel_watches);
+    GAM_LISTENER_STAT("poll_nodes", listener->poll_nodes);
+    GAM_LISTENER_STAT("events_queued", listener->events_queued);
+    GAM_LISTENER_STAT("events_dropped", listener->events_dropped);
+    GAM_LISTENER_STAT("events_sent", listener->events_sent);
+    GAM_LISTENER_STAT("bytes_written", listener->bytes_written);
+    GAM_LISTENER_STAT("events_last_minute", minute);
+
+#undef GAM_LISTENER_STAT
+}
+
+/**
+ * gam_listener_get_serial:
+ *
+ * @listener: the #GamListener
+ *
+ * Gets a number changing whenever a subscription is added or removed,
+ * and different for each listener.
+ *
+ * Returns the serial of the listener's subscriptions.
+ */
+guint
+gam_listener_get_serial(GamListener *listener)
+{
+    g_assert(listener);
+    return listener->serial;
+}
+
+/**
+ * gam_listener_peek_subscriptions:
+ *
+ * @listener: the #GamListener
+ *
+ * Gets the subscriptions of a listener without copying them, the list
+ * can only be used as long as gam_listener_get_serial() doesn't change.
+ *
+ * Returns the list of the listener's subscriptions.
+ */
+GList *
+gam_listener_peek_subscriptions(GamListener *listener)
+{
+    g_assert(listener);
+    return listener->subs;
+}
+
 /**
  * gam_listener_debug:
  *
@@ -10,6 +10,13 @@ typedef struct _GamListener GamListener;
 
 typedef struct _GamSubscription GamSubscription;
 
+/* What watches a subscription, accounted to the listener */
+typedef enum {
+    GAM_RESOURCE_NONE = 0,
+    GAM_RESOURCE_KERNEL,	/* a kernel watch */
+    GAM_RESOURCE_POLL		/* a node of the polling backend */
+} GamResource;
+
 
 GamListener   *gam_listener_new                  (void *service, int pid);
 
@@ -32,10 +39,24 @@ GamSubscription *gam_listener_get_subscription_by_reqno   (GamListener *listener
 							   int reqno);
 
 GList        *gam_listener_get_subscriptions    (GamListener *listener);
+GList        *gam_listener_peek_subscriptions   (GamListener *listener);
+guint         gam_listener_get_serial           (GamListener *listener);
 
 gboolean      gam_listener_is_subscribed        (GamListener *listener,
 						 const char *path); 
 
+void		gam_listener_account		(GamListener *listener,
+						 GamResource resource,
+						 int delta);
+void		gam_listener_event_queued	(GamListener *listener,
+						 gboolean coalesced);
+void		gam_listener_event_sent		(GamListener *listener,
+						 int len);
+void		gam_listener_event_dropped	(GamListener *listener);
+void		gam_listener_stats		(GamListener *listener,
+						 GString *out,
+						 const char *prefix);
+
 void		gam_listener_debug		(GamListener * listener);
 G_END_DECLS
 
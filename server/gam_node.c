@@ -23,6 +23,8 @@
 #include "gam_event.h"
 #include "gam_node.h"
 #include "gam_error.h"
+#include "gam_excludes.h"
+#include "gam_server.h"
 
 /**
  * Create a new node
@@ -39,6 +41,8 @@ gam_node_new(const char *path, GamSubscription * sub, gboolean is_dir)
     node = g_new0(GamNode, 1);
 
     node->path = g_strdup(path);
+    node->name = strrchr(node->path, '/');
+    node->name = node->name ? node->name + 1 : node->path;
     if (sub)
         node->subs = g_list_prepend(NULL, sub);
     else
@@ -64,7 +68,14 @@ gam_node_free(GamNode * node)
 {
     g_assert(node != NULL);
     g_assert(node->subs == NULL);
-
+    g_assert(node->children == NULL);
+    g_assert((node->all_link == NULL) && (node->missing_link == NULL) &&
+             (node->busy_link == NULL));
+
+    if (node->child_hash)
+        g_hash_table_destroy(node->child_hash);
+    gam_node_fanout_unref(node->fanout);
+    gam_node_fanout_unref(node->child_fanout);
     g_free(node->path);
     g_free(node);
 }
@@ -78,14 +89,9 @@ gam_node_free(GamNode * node)
 GamNode *
 gam_node_parent(GamNode * node)
 {
-    GamNode *ret = NULL;
-
     g_assert(node);
 
-    if (node->node && node->node->parent)
-        ret = (GamNode *) node->node->parent->data;
-
-    return ret;
+    return node->parent;
 }
 
 /**
@@ -101,6 +107,79 @@ gam_node_is_dir(GamNode * node)
     return(node->is_dir);
 }
 
+/**
+ * Returns whether a node is excluded from kernel monitoring, the
+ * answer is cached on the node
+ *
+ * @param node the node
+ * @returns TRUE if the node should not be monitored by the kernel
+ */
+gboolean
+gam_node_is_excluded(GamNode * node)
+{
+    gboolean excluded;
+
+    g_assert(node);
+    excluded = node->excluded;
+    gam_exclude_check_cached(node->path, &node->exclude_serial, &excluded);
+    node->excluded = excluded;
+    return(excluded);
+}
+
+#ifdef ST_MTIM_NSEC
+#define GAM_STAT_NS(sbuf, field)					\
+    ((gint64) (sbuf)->st_##field##tim.tv_sec * G_GINT64_CONSTANT(1000000000) + \
+     (sbuf)->st_##field##tim.tv_nsec)
+#else
+#define GAM_STAT_NS(sbuf, field)					\
+    ((gint64) (sbuf)->st_##field##time * G_GINT64_CONSTANT(1000000000))
+#endif
+
+/**
+ * Records the fingerprint of a stat() of the node
+ *
+ * @param node the node
+ * @param sbuf the stat() informations
+ */
+void
+gam_node_set_stat(GamNode * node, const struct stat *sbuf)
+{
+    g_assert(node);
+    node->st.mtime_ns = GAM_STAT_NS(sbuf, m);
+    node->st.ctime_ns = GAM_STAT_NS(sbuf, c);
+    node->st.size = sbuf->st_size;
+}
+
+/**
+ * Tells whether a stat() of the node shows a change since the one
+ * recorded with gam_node_set_stat()
+ *
+ * @param node the node
+ * @param sbuf the new stat() informations
+ * @returns TRUE if the mtime, ctime or size changed
+ */
+gboolean
+gam_node_stat_changed(GamNode * node, const struct stat *sbuf)
+{
+    g_assert(node);
+    return ((node->st.mtime_ns != GAM_STAT_NS(sbuf, m)) ||
+            (node->st.ctime_ns != GAM_STAT_NS(sbuf, c)) ||
+            (node->st.size != (gint64) sbuf->st_size));
+}
+
+/**
+ * Returns the mtime recorded by the last gam_node_set_stat()
+ *
+ * @param node the node
+ * @returns the mtime in seconds
+ */
+time_t
+gam_node_get_mtime(GamNode * node)
+{
+    g_assert(node);
+    return ((time_t) (node->st.mtime_ns / G_GINT64_CONSTANT(1000000000)));
+}
+
 /**
  * Sets whether a node is a directory
  *
@@ -178,6 +257,7 @@ gam_node_add_subscription(GamNode * node, GamSubscription * sub)
     g_assert(!g_list_find(node->subs, sub));
 
     node->subs = g_list_prepend(node->subs, sub);
+    gam_node_subs_changed(node);
 
     return TRUE;
 }
@@ -196,36 +276,11 @@ gam_node_remove_subscription(GamNode * node, GamSubscription * sub)
     g_assert(g_list_find (node->subs, sub));
 
     node->subs = g_list_remove_all(node->subs, sub);
+    gam_node_subs_changed(node);
 
     return TRUE;
 }
 
-/**
- * Sets the GNode associated with a node.  Should only be used by MdTree
- *
- * @param node the node
- * @param gnode the GNode
- */
-void
-gam_node_set_node(GamNode * node, GNode * gnode)
-{
-    g_assert(node);
-    node->node = gnode;
-}
-
-/**
- * Gets the GNode associated with a node.  Should only be used by MdTree
- *
- * @param node the node
- * @returns the GNode
- */
-GNode *
-gam_node_get_node(GamNode * node)
-{
-    g_assert(node);
-    return node->node;
-}
-
 /**
  * Set a flag on a node
  *
@@ -346,35 +401,136 @@ gam_node_has_pflags(GamNode * node, int flags)
     return node->pflags & flags;
 }
 
+/*
+ * The subscriptions an event on a node goes to, its own and those of
+ * its parent directory, are kept as a flat array built on first use.
+ * Nodes without subscriptions of their own share the array of their
+ * parent's subscriptions. Arrays are dropped when the subscriptions of
+ * their node change, parent_serial tells when a change on the parent
+ * made one stale. The reference count keeps an array alive while an
+ * emission walks it.
+ */
+struct _GamFanout {
+	gint refcount;
+	guint parent_serial;
+	guint nsubs;
+	GamSubscription *subs[1];
+};
+
+static GamFanout *
+gam_node_fanout_new(guint nsubs)
+{
+	GamFanout *fanout;
+
+	fanout = g_malloc(sizeof(GamFanout) +
+			  (nsubs ? nsubs - 1 : 0) * sizeof(GamSubscription *));
+	fanout->refcount = 1;
+	fanout->nsubs = 0;
+	return fanout;
+}
+
+static GamFanout *
+gam_node_fanout_ref(GamFanout *fanout)
+{
+	fanout->refcount++;
+	return fanout;
+}
+
 void
-gam_node_emit_event (GamNode *node, GaminEventType event)
+gam_node_fanout_unref(GamFanout *fanout)
+{
+	if ((fanout != NULL) && (--fanout->refcount == 0))
+		g_free(fanout);
+}
+
+void
+gam_node_subs_changed(GamNode *node)
 {
+	node->subs_serial++;
+	gam_node_fanout_unref(node->fanout);
+	node->fanout = NULL;
+	gam_node_fanout_unref(node->child_fanout);
+	node->child_fanout = NULL;
+}
+
+/* The subscriptions of a directory, as its children see them */
+static GamFanout *
+gam_node_get_child_fanout(GamNode *node)
+{
+	GamFanout *fanout;
 	GList *l;
-	GamNode *parent;
-	GList *subs;
-	int is_dir_node = gam_node_is_dir(node);
+	guint i;
+
+	if (node->subs == NULL)
+		return NULL;
+	if (node->child_fanout == NULL) {
+		i = g_list_length(node->subs);
+		fanout = gam_node_fanout_new(i);
+		fanout->nsubs = i;
+		/* latest subscription first */
+		for (l = node->subs; l; l = l->next)
+			fanout->subs[--i] = l->data;
+		node->child_fanout = fanout;
+	}
+	return node->child_fanout;
+}
 
-#ifdef VERBOSE_POLL
-	GAM_DEBUG(DEBUG_INFO, "Poll: emit events %d for %s\n", event, gam_node_get_path(node));
-#endif
-	subs = gam_node_get_subscriptions(node);
+static GamFanout *
+gam_node_get_fanout(GamNode *node)
+{
+	GamNode *parent = node->parent;
+	GamFanout *fanout, *pfanout = NULL;
+	GList *l;
+	guint i, nparent;
+
+	if (parent != NULL)
+		pfanout = gam_node_get_child_fanout(parent);
+	if (node->subs == NULL)
+		return pfanout;
+
+	if ((node->fanout != NULL) &&
+	    ((parent == NULL) || (node->fanout->parent_serial == parent->subs_serial)))
+		return node->fanout;
 
-	if (subs)
-		subs = g_list_copy(subs);
+	gam_node_fanout_unref(node->fanout);
+	nparent = pfanout ? pfanout->nsubs : 0;
+	fanout = gam_node_fanout_new(g_list_length(node->subs) + nparent);
+	fanout->parent_serial = parent ? parent->subs_serial : 0;
 
-	parent = gam_node_parent(node);
-	if (parent) {
-		GList *parent_subs = gam_node_get_subscriptions(parent);
+	/* the parent subscriptions not on the node, then its own */
+	for (i = 0; i < nparent; i++) {
+		GamSubscription *sub = pfanout->subs[i];
 
-		for (l = parent_subs; l; l = l->next) {
-			if (!g_list_find(subs, l->data))
-				subs = g_list_prepend(subs, l->data);
-		}
+		if (!g_list_find(node->subs, sub))
+			fanout->subs[fanout->nsubs++] = sub;
 	}
+	for (l = node->subs; l; l = l->next)
+		fanout->subs[fanout->nsubs++] = l->data;
+
+	node->fanout = fanout;
+	return fanout;
+}
+
+void
+gam_node_emit_event (GamNode *node, GaminEventType event)
+{
+	GamFanout *fanout;
+	int is_dir_node = gam_node_is_dir(node);
+
+#ifdef VERBOSE_POLL
+	GAM_DEBUG(DEBUG_INFO, "Poll: emit events %d for %s\n", event, gam_node_get_path(node));
+#endif
+	if (event == 0)
+		return;
 
-	gam_server_emit_event(gam_node_get_path(node), is_dir_node, event, subs, 0);
+	fanout = gam_node_get_fanout(node);
+	if (fanout == NULL)
+		return;
 
-	g_list_free(subs);
+	gam_node_fanout_ref(fanout);
+	gam_server_emit_event_subs(gam_node_get_path(node), is_dir_node, event,
+				   fanout->subs, fanout->nsubs, 0);
+	gam_node_fanout_unref(fanout);
 }
 
 /** @} */
@@ -23,25 +23,59 @@ G_BEGIN_DECLS
 #define MON_ALL_PFLAGS (MON_MISSING|MON_NOKERNEL|MON_BUSY|MON_WRONG_TYPE)
 
 typedef struct _GamNode GamNode;
+typedef struct _GamFanout GamFanout;
 
 typedef gboolean (*GamSubFilterFunc) (GamSubscription *sub);
 
+/*
+ * What the poll backends need from the last stat() of a node to tell
+ * whether it changed, a sixth of the size of a struct stat.
+ */
+typedef struct {
+	gint64 mtime_ns;
+	gint64 ctime_ns;
+	gint64 size;
+} GamNodeStat;
+
+/*
+ * A poll tree can hold millions of these, the fields are ordered and
+ * sized to keep the structure small.
+ */
 struct _GamNode {
         /* the node informations proper */
 	char *path;		/* The file path */
+	const char *name;	/* its last component, within path */
 	GList *subs;		/* the list of subscriptions */
-	GNode *node;		/* pointer in the tree */
-	gboolean is_dir;	/* is that a directory or expected to be one */
-	int flags;		/* generic flags */
+	GamFanout *fanout;	/* who gets the events of the node */
+	GamFanout *child_fanout; /* subs as an array, for the children */
+
+	/* the links in the tree, maintained by gam_tree.c */
+	GamNode *parent;
+	GamNode *prev;		/* siblings in insertion order */
+	GamNode *next;
+	GamNode *children;
+	GamNode *last_child;
+	GHashTable *child_hash;	/* name -> child, once there are many */
+	guint n_children;
+	guint subs_serial;	/* bumped when subs changes */
+
+	/* its links in the poll backend lists, NULL when not listed */
+	GList *all_link;
+	GList *missing_link;
+	GList *busy_link;
+
 	int poll_time;		/* How often this node should be polled */
 	gam_fs_mon_type mon_type; /* the type of notification that should be done */
 
         /* what used to be stored in a separate data structure */
-	int checks;
-	int pflags;		/* A combination of MON_xxx flags */
 	time_t lasttime;	/* Epoch of last time checking was done */
-	int flow_on_ticks;	/* Number of ticks while flow control is on */
-	struct stat sbuf;	/* The stat() informations in last check */
+	GamNodeStat st;		/* The stat() fingerprint in last check */
+	int checks;
+	guint exclude_serial;	/* cached gam_exclude_check() of path */
+	unsigned short flags;	/* generic flags */
+	unsigned char pflags;	/* A combination of MON_xxx flags */
+	unsigned char is_dir : 1;	/* is that a directory or expected to be one */
+	unsigned char excluded : 1;
 };
 
 
@@ -55,6 +89,14 @@ GamNode               *gam_node_parent              (GamNode         *node);
 
 gboolean              gam_node_is_dir              (GamNode         *node);
 
+gboolean              gam_node_is_excluded         (GamNode         *node);
+
+void                  gam_node_set_stat            (GamNode         *node,
+						   const struct stat *sbuf);
+gboolean              gam_node_stat_changed        (GamNode         *node,
+						   const struct stat *sbuf);
+time_t                gam_node_get_mtime           (GamNode         *node);
+
 void                  gam_node_set_is_dir          (GamNode         *node,
 						   gboolean        is_dir);
 	
@@ -70,10 +112,6 @@ gboolean              gam_node_remove_subscription (GamNode         *node,
 
 gboolean              gam_node_has_dir_subscriptions(GamNode * node);
 
-void                  gam_node_set_node            (GamNode         *node,
-						   GNode          *gnode);
-GNode                *gam_node_get_node            (GamNode         *node);
-
 void                  gam_node_set_data            (GamNode         *node,
 						   gpointer        data,
 						   GDestroyNotify  destroy);
@@ -99,6 +137,8 @@ gboolean              gam_node_has_pflags           (GamNode         *node,
 						     int             flags);
 
 
+void	gam_node_subs_changed (GamNode *node);
+void	gam_node_fanout_unref (GamFanout *fanout);
 void	gam_node_emit_event (GamNode *node, GaminEventType event);
 
 
@@ -37,6 +37,8 @@
 #include "gam_protocol.h"
 #include "gam_event.h"
 #include "gam_excludes.h"
+#include "gam_probes.h"
+#include "gam_trace.h"
 
 #define VERBOSE_POLL
 
@@ -256,23 +258,6 @@ gam_poll_basic_remove_all_for(GamListener * listener)
 		return FALSE;
 }
 
-static gboolean
-gam_poll_generic_node_changed (GamNode *node, struct stat sbuf)
-{
-	g_assert(node);
-#ifdef ST_MTIM_NSEC
-	return ((node->sbuf.st_mtim.tv_sec != sbuf.st_mtim.tv_sec) ||
-		(node->sbuf.st_mtim.tv_nsec != sbuf.st_mtim.tv_nsec) ||
-		(node->sbuf.st_size != sbuf.st_size) ||
-		(node->sbuf.st_ctim.tv_sec != sbuf.st_ctim.tv_sec) ||
-		(node->sbuf.st_ctim.tv_nsec != sbuf.st_ctim.tv_nsec));
-#else
-	return ((node->sbuf.st_mtime != sbuf.st_mtime) ||
-		(node->sbuf.st_size != sbuf.st_size) ||
-		(node->sbuf.st_ctime != sbuf.st_ctime));
-#endif
-}
-
 static GaminEventType
 gam_poll_basic_poll_file(GamNode * node)
 {
@@ -302,14 +287,18 @@ gam_poll_basic_poll_file(GamNode * node)
 #ifdef VERBOSE_POLL
 		GAM_DEBUG(DEBUG_INFO, "Poll: file is new\n");
 #endif
+		GAM_PROBE1 (poll_stat, node->path);
 		stat_ret = stat(node->path, &sbuf);
+		GAM_PROBE2 (poll_stat_done, node->path, stat_ret);
+		GAM_TRACE (POLL_STAT, stat_ret, 0, 0, 0, node->path);
+		gam_poll_generic_count_stat ();
 
 		if (stat_ret != 0)
 			gam_node_set_pflag (node, MON_MISSING);
 		else
 			gam_node_set_is_dir(node, (S_ISDIR(sbuf.st_mode) != 0));
 
-		memcpy(&(node->sbuf), &(sbuf), sizeof(struct stat));
+		gam_node_set_stat(node, &sbuf);
 
 		node->lasttime = gam_poll_generic_get_time ();
 
@@ -322,7 +311,11 @@ gam_poll_basic_poll_file(GamNode * node)
 	event = 0;
 	node->lasttime = gam_poll_generic_get_time ();
 
+	GAM_PROBE1 (poll_stat, node->path);
 	stat_ret = stat(node->path, &sbuf);
+	GAM_PROBE2 (poll_stat_done, node->path, stat_ret);
+	GAM_TRACE (POLL_STAT, stat_ret, 0, 0, 0, node->path);
+	gam_poll_generic_count_stat ();
 	if (stat_ret != 0) {
 		if ((gam_errno() == ENOENT) && (!gam_node_has_pflag(node, MON_MISSING))) {
 			/* deleted */
@@ -337,16 +330,12 @@ gam_poll_basic_poll_file(GamNode * node)
 		gam_node_unset_pflag (node, MON_MISSING);
 		event = GAMIN_EVENT_CREATED;
 		gam_poll_generic_remove_missing (node);
-	} else if (gam_poll_generic_node_changed (node, sbuf)) {
+	} else if (gam_node_stat_changed (node, &sbuf)) {
 		event = GAMIN_EVENT_CHANGED;
 	} else {
 #ifdef VERBOSE_POLL
 		GAM_DEBUG(DEBUG_INFO, "Poll: poll_file %s unchanged\n", path);
-#ifdef ST_MTIM_NSEC
-		GAM_DEBUG(DEBUG_INFO, "%d %d : %d %d\n", node->sbuf.st_mtim.tv_sec, node->sbuf.st_mtim.tv_nsec, sbuf.st_mtim.tv_sec, sbuf.st_mtim.tv_nsec);
-#else
-		GAM_DEBUG(DEBUG_INFO, "%d : %d\n", node->sbuf.st_mtime, sbuf.st_mtim.tv_nsec);
-#endif /* ST_MTIM_NSEC */
+		GAM_DEBUG(DEBUG_INFO, "%d : %d\n", gam_node_get_mtime(node), sbuf.st_mtime);
 #endif /* VERBOSE_POLL */
 	}
 
@@ -357,8 +346,7 @@ gam_poll_basic_poll_file(GamNode * node)
 	if (stat_ret == 0)
 		gam_node_set_is_dir(node, (S_ISDIR(sbuf.st_mode) != 0));
 
-	memcpy(&(node->sbuf), &(sbuf), sizeof(struct stat));
-	node->sbuf.st_mtime = sbuf.st_mtime; // VALGRIND!
+	gam_node_set_stat(node, &sbuf);
 
 	return event;
 }
@@ -369,7 +357,7 @@ gam_poll_basic_scan_callback(gpointer data)
 	int idx;
 	gboolean did_something = FALSE;
 
-	gam_poll_generic_update_time ();
+	gam_poll_generic_tick ();
 
 	for (idx = 0;; idx++) 
 	{
@@ -76,7 +76,7 @@ gam_poll_dnotify_delist_node(GamNode * node)
 
 	path = gam_node_get_path(node);
 
-	if (gam_exclude_check(path) || gam_fs_get_mon_type (path) != GFS_MT_KERNEL)
+	if (gam_node_is_excluded(node) || gam_fs_get_mon_type (path) != GFS_MT_KERNEL)
 		return;
 
 	GAM_DEBUG(DEBUG_INFO, "poll-dnotify: Disabling kernel monitoring for %s\n", path);
@@ -104,7 +104,7 @@ gam_poll_dnotify_relist_node(GamNode * node)
 	path = gam_node_get_path(node);
 	GAM_DEBUG(DEBUG_INFO, "poll-dnotify: Enabling kernel monitoring for %s\n", path);
 
-	if (gam_exclude_check(path) || gam_fs_get_mon_type(path) != GFS_MT_KERNEL)
+	if (gam_node_is_excluded(node) || gam_fs_get_mon_type(path) != GFS_MT_KERNEL)
 		return;
 
 	subs = gam_node_get_subscriptions(node);
@@ -129,7 +129,7 @@ gam_poll_dnotify_flowon_node(GamNode * node)
 
 	path = gam_node_get_path(node);
 
-	if (gam_exclude_check(path) || gam_fs_get_mon_type(path) != GFS_MT_KERNEL)
+	if (gam_node_is_excluded(node) || gam_fs_get_mon_type(path) != GFS_MT_KERNEL)
 		return;
 
 	GAM_DEBUG(DEBUG_INFO, "poll-dnotify: Enabling flow control for %s\n", path);
@@ -151,7 +151,7 @@ gam_poll_dnotify_flowoff_node(GamNode * node)
 
 	path = gam_node_get_path(node);
 
-	if (gam_exclude_check(path) || gam_fs_get_mon_type(path) != GFS_MT_KERNEL)
+	if (gam_node_is_excluded(node) || gam_fs_get_mon_type(path) != GFS_MT_KERNEL)
 		return;
 
 	GAM_DEBUG(DEBUG_INFO, "poll-dnotify: Disabling flow control for %s\n", path);
@@ -180,15 +180,16 @@ gam_poll_dnotify_poll_file(GamNode * node)
     if (node->lasttime == 0) {
         GAM_DEBUG(DEBUG_INFO, "Poll: file is new\n");
         stat_ret = stat(node->path, &sbuf);
+        gam_poll_generic_count_stat ();
         if (stat_ret != 0)
             gam_node_set_pflag (node, MON_MISSING);
         else
             gam_node_set_is_dir(node, (S_ISDIR(sbuf.st_mode) != 0));
 
-        if (gam_exclude_check(path) || gam_fs_get_mon_type (path) != GFS_MT_KERNEL)
+        if (gam_node_is_excluded(node) || gam_fs_get_mon_type (path) != GFS_MT_KERNEL)
             gam_node_set_pflag (node, MON_NOKERNEL);
 
-        memcpy(&(node->sbuf), &(sbuf), sizeof(struct stat));
+        gam_node_set_stat(node, &sbuf);
         node->lasttime = gam_poll_generic_get_time ();
 
         if (stat_ret == 0)
@@ -204,6 +205,7 @@ gam_poll_dnotify_poll_file(GamNode * node)
     event = 0;
 
     stat_ret = stat(node->path, &sbuf);
+    gam_poll_generic_count_stat ();
     if (stat_ret != 0) {
         if ((gam_errno() == ENOENT) && (!gam_node_has_pflag(node, MON_MISSING))) {
             /* deleted */
@@ -220,28 +222,12 @@ gam_poll_dnotify_poll_file(GamNode * node)
         /* created */
         gam_node_unset_pflag (node, MON_MISSING);
         event = GAMIN_EVENT_CREATED;
-#ifdef ST_MTIM_NSEC
-    } else if ((node->sbuf.st_mtim.tv_sec != sbuf.st_mtim.tv_sec) ||
-           (node->sbuf.st_mtim.tv_nsec != sbuf.st_mtim.tv_nsec) ||
-           (node->sbuf.st_size != sbuf.st_size) ||
-           (node->sbuf.st_ctim.tv_sec != sbuf.st_ctim.tv_sec) ||
-           (node->sbuf.st_ctim.tv_nsec != sbuf.st_ctim.tv_nsec))
-    {
+    } else if (gam_node_stat_changed(node, &sbuf)) {
         event = GAMIN_EVENT_CHANGED;
     } else {
 #ifdef VERBOSE_POLL
         GAM_DEBUG(DEBUG_INFO, "Poll: poll_file %s unchanged\n", path);
-        GAM_DEBUG(DEBUG_INFO, "%d %d : %d %d\n", node->sbuf.st_mtim.tv_sec, node->sbuf.st_mtim.tv_nsec, sbuf.st_mtim.tv_sec, sbuf.st_mtim.tv_nsec);
-#endif
-#else
-    } else if ((node->sbuf.st_mtime != sbuf.st_mtime) ||
-           (node->sbuf.st_size != sbuf.st_size) ||
-           (node->sbuf.st_ctime != sbuf.st_ctime))
-    {
-        event = GAMIN_EVENT_CHANGED;
-#ifdef VERBOSE_POLL
-        GAM_DEBUG(DEBUG_INFO, "%d : %d\n", node->sbuf.st_mtime, sbuf.st_mtime);
-#endif
+        GAM_DEBUG(DEBUG_INFO, "%d : %d\n", gam_node_get_mtime(node), sbuf.st_mtime);
 #endif
     }
 
@@ -252,8 +238,7 @@ gam_poll_dnotify_poll_file(GamNode * node)
     if (stat_ret == 0)
         gam_node_set_is_dir(node, (S_ISDIR(sbuf.st_mode) != 0));
 
-    memcpy(&(node->sbuf), &(sbuf), sizeof(struct stat));
-    node->sbuf.st_mtime = sbuf.st_mtime; // VALGRIND!
+    gam_node_set_stat(node, &sbuf);
 
     /*
     * if kernel monitoring prohibited, stop here
@@ -267,7 +252,7 @@ gam_poll_dnotify_poll_file(GamNode * node)
     */
     if (gam_poll_generic_get_time() == node->lasttime) {
         if (!gam_node_has_pflag (node, MON_BUSY)) {
-            if (node->sbuf.st_mtime == gam_poll_generic_get_time())
+            if (gam_node_get_mtime(node) == gam_poll_generic_get_time())
                 node->checks++;
         }
     } else {
@@ -282,7 +267,7 @@ gam_poll_dnotify_poll_file(GamNode * node)
 
     if ((node->checks >= 4) && (!gam_node_has_pflag (node, MON_BUSY))) {
         if ((gam_node_get_subscriptions(node) != NULL) &&
-            (!gam_exclude_check(node->path) && gam_fs_get_mon_type (node->path) == GFS_MT_KERNEL))
+            (!gam_node_is_excluded(node) && gam_fs_get_mon_type (node->path) == GFS_MT_KERNEL))
         {
             GAM_DEBUG(DEBUG_INFO, "switching %s back to polling\n", path);
             gam_node_set_pflag (node, MON_BUSY);
@@ -309,7 +294,7 @@ gam_poll_dnotify_poll_file(GamNode * node)
     if ((event == 0) && gam_node_has_pflag (node, MON_BUSY) && (node->checks > 5))
     {
         if ((gam_node_get_subscriptions(node) != NULL) &&
-            (!gam_exclude_check(node->path) && gam_fs_get_mon_type (node->path) == GFS_MT_KERNEL))
+            (!gam_node_is_excluded(node) && gam_fs_get_mon_type (node->path) == GFS_MT_KERNEL))
         {
             GAM_DEBUG(DEBUG_INFO, "switching %s back to kernel monitoring\n", path);
             gam_node_unset_pflag (node, MON_BUSY);
@@ -343,7 +328,7 @@ node_add_subscription(GamNode * node, GamSubscription * sub)
     GAM_DEBUG(DEBUG_INFO, "node_add_subscription(%s)\n", node->path);
     gam_node_add_subscription(node, sub);
 
-    if (gam_exclude_check(node->path) || gam_fs_get_mon_type (node->path) == GFS_MT_POLL) {
+    if (gam_node_is_excluded(node) || gam_fs_get_mon_type (node->path) == GFS_MT_POLL) {
         GAM_DEBUG(DEBUG_INFO, "  gam_exclude_check: true\n");
         if (node->lasttime == 0)
             gam_poll_dnotify_poll_file(node);
@@ -383,7 +368,7 @@ node_remove_subscription(GamNode * node, GamSubscription * sub)
     gam_node_remove_subscription(node, sub);
 
     path = node->path;
-    if (gam_exclude_check(path) || gam_fs_get_mon_type (path) == GFS_MT_POLL) {
+    if (gam_node_is_excluded(node) || gam_fs_get_mon_type (path) == GFS_MT_POLL) {
         GAM_DEBUG(DEBUG_INFO, "  gam_exclude_check: true\n");
         return (0);
     }
@@ -642,7 +627,7 @@ gam_poll_dnotify_scan_callback(gpointer data)
 	GAM_DEBUG(DEBUG_INFO, "gam_poll_scan_callback(): %d missing, %d busy\n", g_list_length(gam_poll_generic_get_missing_list()), g_list_length(gam_poll_generic_get_busy_list()));
 #endif
 
-	gam_poll_generic_update_time ();
+	gam_poll_generic_tick ();
 
 
 	/*
@@ -672,7 +657,7 @@ gam_poll_dnotify_scan_callback(gpointer data)
 		* mode then switch back to dnotify for monitoring.
 		*/
 		if (!gam_node_has_pflags (node, MON_ALL_PFLAGS) && 
-		    !gam_exclude_check(node->path) && 
+		    !gam_node_is_excluded(node) && 
 		    gam_fs_get_mon_type (node->path) == GFS_MT_KERNEL)
 		{
 			gam_poll_generic_remove_missing(node);
@@ -707,7 +692,7 @@ gam_poll_dnotify_scan_callback(gpointer data)
 		* mode then switch back to dnotify for monitoring.
 		*/
 		if (!gam_node_has_pflags (node, MON_ALL_PFLAGS) && 
-		    !gam_exclude_check(node->path) && 
+		    !gam_node_is_excluded(node) && 
 		    gam_fs_get_mon_type (node->path) == GFS_MT_KERNEL)
 		{
 			gam_poll_generic_remove_busy(node);
@@ -35,6 +35,8 @@
 #include "gam_protocol.h"
 #include "gam_event.h"
 #include "gam_excludes.h"
+#include "gam_dircache.h"
+#include "gam_stats.h"
 
 //#define VERBOSE_POLL
 //#define VERBOSE_POLL2
@@ -48,6 +50,23 @@ static GList *		all_resources = NULL;
 static GList *		dead_resources = NULL;
 static time_t		current_time = 0;
 
+/*
+ * Each node keeps its own link in the lists above, so that joining or
+ * leaving one is O(1). The moves are counted to show the churn.
+ */
+static gulong		all_added = 0;
+static gulong		all_removed = 0;
+static gulong		missing_added = 0;
+static gulong		missing_removed = 0;
+static gulong		busy_added = 0;
+static gulong		busy_removed = 0;
+
+/* polling rounds and the stat() calls they made */
+static gulong		ticks = 0;
+static gulong		tick_stats = 0;
+static gulong		last_tick_stats = 0;
+static gulong		total_stats = 0;
+
 gboolean
 gam_poll_generic_init()
 {
@@ -88,6 +107,28 @@ gam_poll_generic_debug(void)
     } else {
         GAM_DEBUG(DEBUG_INFO, "No poll all resources\n");
     }
+
+    GAM_DEBUG(DEBUG_INFO, "Poll transitions: all +%lu -%lu, missing +%lu -%lu, "
+              "busy +%lu -%lu\n", all_added, all_removed, missing_added,
+              missing_removed, busy_added, busy_removed);
+}
+
+/**
+ * gam_poll_generic_stats:
+ * @out: the statistics being collected
+ *
+ * Reports the size of the poll tree and the polling activity.
+ */
+void
+gam_poll_generic_stats(GString *out)
+{
+    gam_stats_add(out, "poll_nodes", tree ? gam_tree_get_size(tree) : 0);
+    gam_stats_add(out, "poll_all", all_added - all_removed);
+    gam_stats_add(out, "poll_missing", missing_added - missing_removed);
+    gam_stats_add(out, "poll_busy", busy_added - busy_removed);
+    gam_stats_add(out, "poll_ticks", ticks);
+    gam_stats_add(out, "poll_stats", total_stats);
+    gam_stats_add(out, "poll_stats_last_tick", last_tick_stats);
 }
 
 /**
@@ -99,8 +140,10 @@ gam_poll_generic_debug(void)
 void
 gam_poll_generic_add_missing(GamNode * node)
 {
-	if (g_list_find(missing_resources, node) == NULL) {
+	if (node->missing_link == NULL) {
 		missing_resources = g_list_prepend(missing_resources, node);
+		node->missing_link = missing_resources;
+		missing_added++;
 		GAM_DEBUG(DEBUG_INFO, "Poll: adding missing node %s\n", gam_node_get_path(node));
 	}
 }
@@ -116,10 +159,12 @@ gam_poll_generic_add_missing(GamNode * node)
 void
 gam_poll_generic_remove_missing(GamNode * node)
 {
-	if (g_list_find (missing_resources, node))
+	if (node->missing_link != NULL)
 	{
 		GAM_DEBUG(DEBUG_INFO, "Poll: removing missing node %s\n", gam_node_get_path(node));
-		missing_resources = g_list_remove_all(missing_resources, node);
+		missing_resources = g_list_delete_link(missing_resources, node->missing_link);
+		node->missing_link = NULL;
+		missing_removed++;
 	}
 }
 
@@ -132,8 +177,10 @@ gam_poll_generic_remove_missing(GamNode * node)
 void
 gam_poll_generic_add_busy(GamNode * node)
 {
-	if (g_list_find(busy_resources, node) == NULL) {
+	if (node->busy_link == NULL) {
 		busy_resources = g_list_prepend(busy_resources, node);
+		node->busy_link = busy_resources;
+		busy_added++;
 		GAM_DEBUG(DEBUG_INFO, "Poll: adding busy node %s\n", gam_node_get_path(node));
 	}
 }
@@ -147,19 +194,23 @@ gam_poll_generic_add_busy(GamNode * node)
 void
 gam_poll_generic_remove_busy(GamNode * node)
 {
-	if (!g_list_find (busy_resources, node))
+	if (node->busy_link == NULL)
 		return;
 
 	GAM_DEBUG(DEBUG_INFO, "Poll: removing busy node %s\n", gam_node_get_path(node));
-	busy_resources = g_list_remove_all(busy_resources, node);
+	busy_resources = g_list_delete_link(busy_resources, node->busy_link);
+	node->busy_link = NULL;
+	busy_removed++;
 }
 
 void
 gam_poll_generic_add (GamNode * node)
 {
-	if (g_list_find (all_resources, node) == NULL)
+	if (node->all_link == NULL)
 	{
 		all_resources = g_list_prepend(all_resources, node);
+		node->all_link = all_resources;
+		all_added++;
 		GAM_DEBUG(DEBUG_INFO, "Poll: Adding node %s\n", gam_node_get_path (node));
 	}
 }
@@ -167,9 +218,11 @@ gam_poll_generic_add (GamNode * node)
 void
 gam_poll_generic_remove (GamNode * node)
 {
-	g_assert (g_list_find (all_resources, node));
+	g_assert (node->all_link != NULL);
 	GAM_DEBUG(DEBUG_INFO, "Poll: removing node %s\n", gam_node_get_path(node));
-	all_resources = g_list_remove_all(all_resources, node);
+	all_resources = g_list_delete_link(all_resources, node->all_link);
+	node->all_link = NULL;
+	all_removed++;
 }
 
 time_t
@@ -184,6 +237,33 @@ gam_poll_generic_update_time()
 	current_time = time (NULL);
 }
 
+/**
+ * gam_poll_generic_tick:
+ *
+ * Starts a polling round: updates the current time and keeps the
+ * number of files checked by the previous round for the statistics.
+ */
+void
+gam_poll_generic_tick()
+{
+	ticks++;
+	last_tick_stats = tick_stats;
+	tick_stats = 0;
+	gam_poll_generic_update_time ();
+}
+
+/**
+ * gam_poll_generic_count_stat:
+ *
+ * Accounts for one stat() of a polled file.
+ */
+void
+gam_poll_generic_count_stat()
+{
+	tick_stats++;
+	total_stats++;
+}
+
 time_t
 gam_poll_generic_get_delta_time(time_t pt)
 {
@@ -399,19 +479,65 @@ gam_poll_generic_scan_directory(const char *path)
 	gam_poll_generic_scan_directory_internal(node);
 }
 
+/*
+ * Registers one entry of a directory seen on its first scan and sends
+ * its Exists event.
+ */
+static GamNode *
+gam_poll_generic_first_scan_entry (GamNode * dir_node, const char *dpath,
+				   const char *name, GList * subs, int with_exists)
+{
+	char *path;
+	GamNode *node;
+	struct stat sbuf;
+
+	path = g_build_filename(dpath, name, NULL);
+
+	node = gam_tree_get_at_path(tree, path);
+
+	if (!node)
+	{
+		GAM_DEBUG(DEBUG_INFO, "Unregistered node %s\n", path);
+		if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
+			node = gam_node_new(path, NULL, FALSE);
+		} else {
+			node = gam_node_new(path, NULL, TRUE);
+		}
+		memset(&sbuf, 0, sizeof(struct stat));
+		stat(node->path, &sbuf);
+		gam_node_set_stat(node, &sbuf);
+		gam_node_set_is_dir(node, (S_ISDIR(sbuf.st_mode) != 0));
+
+		if (gam_node_is_excluded(node) || gam_fs_get_mon_type(path) != GFS_MT_KERNEL)
+			gam_node_set_pflag (node, MON_NOKERNEL);
+
+		node->lasttime = gam_poll_generic_get_time ();
+		gam_tree_add(tree, dir_node, node);
+	}
+
+	if (with_exists)
+		gam_server_emit_event(name, 1, GAMIN_EVENT_EXISTS, subs, 1);
+
+	g_free(path);
+	return node;
+}
+
 /**
  * First dir scanning on a new subscription, generates the Exists EndExists
- * events.
+ * events. The listing comes from the directory cache if it has it.
  */
 void
 gam_poll_generic_first_scan_dir (GamSubscription * sub, GamNode * dir_node, const char *dpath)
 {
 	GDir *dir;
-	char *path;
 	GList *subs;
 	int with_exists = 1;
 	const char *name;
 	GamNode *node;
+	GamDirFill *fill;
+	GArray *entries;
+	guint i;
+	struct stat sbuf;
 
 	GAM_DEBUG(DEBUG_INFO, "Looking for existing files in: %s\n", dpath);
 
@@ -428,7 +554,9 @@ gam_poll_generic_first_scan_dir (GamSubscription * sub, GamNode * dir_node, cons
 
 		gam_server_emit_event(dpath, 1, GAMIN_EVENT_DELETED, subs, 1);
 
-		stat(dir_node->path, &(dir_node->sbuf));
+		memset(&sbuf, 0, sizeof(struct stat));
+		stat(dir_node->path, &sbuf);
+		gam_node_set_stat(dir_node, &sbuf);
 		dir_node->lasttime = gam_poll_generic_get_time ();
 
 		if (g_file_test(dpath, G_FILE_TEST_EXISTS)) {
@@ -448,43 +576,33 @@ gam_poll_generic_first_scan_dir (GamSubscription * sub, GamNode * dir_node, cons
 		gam_server_emit_event(dpath, 1, GAMIN_EVENT_EXISTS, subs, 1);
 
 
+	if (gam_dircache_get(dpath, &entries)) {
+		for (i = 0; i < entries->len; i++) {
+			name = g_array_index(entries, GamDirEntry, i).name;
+			gam_poll_generic_first_scan_entry(dir_node, dpath, name,
+							  subs, with_exists);
+		}
+		gam_dircache_entries_free(entries);
+		goto done;
+	}
+
+	fill = gam_dircache_fill_begin(dpath);
 	dir = g_dir_open(dpath, 0, NULL);
 
 	if (dir == NULL) {
+		gam_dircache_fill_end(fill, FALSE);
 		goto done;
 	}
 
 	while ((name = g_dir_read_name(dir)) != NULL)
 	{
-		path = g_build_filename(dpath, name, NULL);
-
-		node = gam_tree_get_at_path(tree, path);
-
-		if (!node)
-		{
-			GAM_DEBUG(DEBUG_INFO, "Unregistered node %s\n", path);
-			if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
-				node = gam_node_new(path, NULL, FALSE);
-			} else {
-				node = gam_node_new(path, NULL, TRUE);
-			}
-			stat(node->path, &(node->sbuf));
-			gam_node_set_is_dir(node, (S_ISDIR(node->sbuf.st_mode) != 0));
-
-			if (gam_exclude_check(path) || gam_fs_get_mon_type(path) != GFS_MT_KERNEL)
-				gam_node_set_pflag (node, MON_NOKERNEL);
-
-			node->lasttime = gam_poll_generic_get_time ();
-			gam_tree_add(tree, dir_node, node);
-		}
-
-		if (with_exists)
-			gam_server_emit_event(name, 1, GAMIN_EVENT_EXISTS, subs, 1);
-
-		g_free(path);
+		node = gam_poll_generic_first_scan_entry(dir_node, dpath, name,
+							 subs, with_exists);
+		gam_dircache_fill_add(fill, name, gam_node_is_dir(node));
 	}
 
 	g_dir_close(dir);
+	gam_dircache_fill_end(fill, TRUE);
 
 done:
 	if (with_exists)
@@ -528,17 +646,11 @@ gam_poll_generic_get_dead_list (void)
 void
 gam_poll_generic_unregister_node (GamNode * node)
 {
-	if (missing_resources != NULL) {
-		gam_poll_generic_remove_missing(node);
-	}
-
-	if (busy_resources != NULL) {
-		gam_poll_generic_remove_busy(node);
-	}
+	gam_poll_generic_remove_missing(node);
+	gam_poll_generic_remove_busy(node);
 
-	if (all_resources != NULL) {
-		all_resources = g_list_remove(all_resources, node);
-	}
+	if (node->all_link != NULL)
+		gam_poll_generic_remove(node);
 }
 
 void
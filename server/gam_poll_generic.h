@@ -9,6 +9,7 @@ G_BEGIN_DECLS
 
 gboolean	gam_poll_generic_init			(void);
 void		gam_poll_generic_debug			(void);
+void		gam_poll_generic_stats			(GString *out);
 
 void		gam_poll_generic_add_missing	(GamNode * node);
 void		gam_poll_generic_remove_missing	(GamNode * node);
@@ -19,6 +20,8 @@ void		gam_poll_generic_remove		(GamNode * node);
 
 time_t		gam_poll_generic_get_time		(void);
 void		gam_poll_generic_update_time	(void);
+void		gam_poll_generic_tick		(void);
+void		gam_poll_generic_count_stat	(void);
 time_t		gam_poll_generic_get_delta_time	(time_t pt);
 
 void		gam_poll_generic_trigger_handler(const char *path, pollHandlerMode mode, GamNode *node);
@@ -0,0 +1,30 @@
+#ifndef __GAM_PROBES_H__
+#define __GAM_PROBES_H__
+
+/*
+ * Static tracepoints for SystemTap and bpftrace, see doc/probes.txt.
+ *
+ * Built with --enable-probes each GAM_PROBE() is a single nop and an ELF
+ * note telling the tracer where to find its arguments, the arguments
+ * being only evaluated into registers. Otherwise they expand to nothing.
+ * Keep the arguments to values already at hand, never compute one just
+ * for a probe.
+ */
+
+#ifdef ENABLE_PROBES
+#include <sys/sdt.h>
+
+#define GAM_PROBE0(name)		DTRACE_PROBE(gamin, name)
+#define GAM_PROBE1(name, a)		DTRACE_PROBE1(gamin, name, a)
+#define GAM_PROBE2(name, a, b)		DTRACE_PROBE2(gamin, name, a, b)
+#define GAM_PROBE3(name, a, b, c)	DTRACE_PROBE3(gamin, name, a, b, c)
+#define GAM_PROBE4(name, a, b, c, d)	DTRACE_PROBE4(gamin, name, a, b, c, d)
+#else
+#define GAM_PROBE0(name)		do { } while (0)
+#define GAM_PROBE1(name, a)		do { } while (0)
+#define GAM_PROBE2(name, a, b)		do { } while (0)
+#define GAM_PROBE3(name, a, b, c)	do { } while (0)
+#define GAM_PROBE4(name, a, b, c, d)	do { } while (0)
+#endif
+
+#endif /* __GAM_PROBES_H__ */
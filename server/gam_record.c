@@ -0,0 +1,577 @@
+/* Gamin
+ * Copyright (C) 2004 Daniel Veillard, Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Recording and replay of the inotify event stream.
+ *
+ * Everything is recorded from the main loop: the sharded inotify
+ * readers hand their events over to it before they are recorded, so
+ * the file needs no locking and buffered stdio is enough.
+ *
+ * The replay recreates each client with a real connection over a
+ * socketpair, whose other end is read and thrown away by a thread of
+ * its own, and sends it the recorded requests as if they came from the
+ * socket. The inotify backend is started without a kernel instance:
+ * ik_watch() hands back the watch descriptors found in the file and the
+ * events are queued as if they had just been read, the queue being
+ * processed where the server processed it. The event queues of the
+ * connections are written out right after, as the server processes the
+ * inotify events at most once a second and flushes them ten times a
+ * second. Runs of records are replayed from an idle source so that the
+ * main loop still gets to run.
+ */
+
+#include "server_config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/param.h>
+#include <glib.h>
+#include "gam_error.h"
+#include "gam_protocol.h"
+#include "gam_connection.h"
+#include "gam_stats.h"
+#include "gam_record.h"
+#ifdef ENABLE_INOTIFY
+#include "inotify-kernel.h"
+#endif
+
+/* How many records are replayed before going back to the main loop */
+#define GAM_REPLAY_BATCH	1024
+
+static FILE *record_file = NULL;
+static gint64 record_start = 0;
+
+static void
+gam_record_write(GamRecordType type, gint32 a, gint32 b, gint32 c,
+		 const char *str, int len)
+{
+	GamRecord rec;
+
+	if ((str == NULL) || (len < 0))
+		len = 0;
+	if (len > MAXPATHLEN)
+		len = MAXPATHLEN;
+
+	rec.type = type;
+	rec.len = len;
+	rec.args[0] = a;
+	rec.args[1] = b;
+	rec.args[2] = c;
+	fwrite(&rec, sizeof(rec), 1, record_file);
+	if (len > 0)
+		fwrite(str, len, 1, record_file);
+}
+
+/**
+ * gam_record_start:
+ * @path: the file to record to
+ *
+ * Starts recording the inotify events and the requests of the clients
+ * to @path, which is truncated.
+ *
+ * Returns TRUE in case of success, FALSE otherwise
+ */
+gboolean
+gam_record_start(const char *path)
+{
+	GamRecordHeader header;
+	struct timeval tv;
+
+	g_assert(path != NULL);
+	g_assert(record_file == NULL);
+
+	record_file = fopen(path, "w");
+	if (record_file == NULL) {
+		gam_error(DEBUG_INFO, "Failed to create the record %s: %s\n",
+			  path, strerror(errno));
+		return FALSE;
+	}
+
+	gettimeofday(&tv, NULL);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GAM_RECORD_MAGIC, sizeof(header.magic));
+	header.version = GAM_RECORD_VERSION;
+	header.record_size = sizeof(GamRecord);
+	header.wall = (gint64) tv.tv_sec * 1000000 + tv.tv_usec;
+	if (fwrite(&header, sizeof(header), 1, record_file) != 1) {
+		gam_error(DEBUG_INFO, "Failed to write the record %s: %s\n",
+			  path, strerror(errno));
+		fclose(record_file);
+		record_file = NULL;
+		return FALSE;
+	}
+	record_start = gam_stats_now();
+	GAM_DEBUG(DEBUG_INFO, "Recording to %s\n", path);
+	return TRUE;
+}
+
+/**
+ * gam_record_stop:
+ *
+ * Stops recording and flushes the file, does nothing if not recording.
+ */
+void
+gam_record_stop(void)
+{
+	if (record_file == NULL)
+		return;
+	fclose(record_file);
+	record_file = NULL;
+}
+
+void
+gam_record_open(int fd, int pid)
+{
+	if (record_file != NULL)
+		gam_record_write(GAM_RECORD_OPEN, fd, pid, 0, NULL, 0);
+}
+
+/**
+ * gam_record_request:
+ * @fd: the connection it came from
+ * @type: its type and options, as in the packet
+ * @seq: its request number
+ * @path: its path
+ * @len: the length of @path
+ *
+ * Records a request from a client, only the subscriptions and their
+ * cancellations are kept.
+ */
+void
+gam_record_request(int fd, int type, int seq, const char *path, int len)
+{
+	if (record_file == NULL)
+		return;
+	switch (type & 0xF) {
+		case GAM_REQ_FILE:
+		case GAM_REQ_DIR:
+		case GAM_REQ_CANCEL:
+			gam_record_write(GAM_RECORD_REQUEST, fd, type, seq,
+					 path, len);
+			break;
+		default:
+			break;
+	}
+}
+
+void
+gam_record_close(int fd)
+{
+	if (record_file != NULL)
+		gam_record_write(GAM_RECORD_CLOSE, fd, 0, 0, NULL, 0);
+}
+
+void
+gam_record_watch(const char *path, guint32 mask, gint32 wd, int err)
+{
+	if (record_file != NULL)
+		gam_record_write(GAM_RECORD_WATCH, wd, mask, (wd < 0) ? err : 0,
+				 path, strlen(path));
+}
+
+void
+gam_record_ignore(gint32 wd, const char *path)
+{
+	if (record_file != NULL)
+		gam_record_write(GAM_RECORD_IGNORE, wd, 0, 0,
+				 path, path ? strlen(path) : 0);
+}
+
+void
+gam_record_event(gint32 wd, guint32 mask, guint32 cookie, const char *name)
+{
+	if (record_file != NULL)
+		gam_record_write(GAM_RECORD_EVENT, wd, mask, cookie,
+				 name, name ? strlen(name) : 0);
+}
+
+/**
+ * gam_record_process:
+ *
+ * Records that the queue of inotify events is being processed, the
+ * replay processes it at the same points.
+ */
+void
+gam_record_process(void)
+{
+	if (record_file != NULL)
+		gam_record_write(GAM_RECORD_PROCESS,
+				 (gint32) ((gam_stats_now() - record_start) / 1000),
+				 0, 0, NULL, 0);
+}
+
+#ifdef ENABLE_INOTIFY
+
+typedef struct {
+	GamConnDataPtr conn;
+	int fd;			/* the server end */
+	int peer;		/* the client end, drained by @thread */
+	GThread *thread;
+} GamReplayClient;
+
+typedef struct {
+	gint32 wd;
+	int err;
+} GamReplayWatch;
+
+static gchar *replay_data = NULL;
+static gsize replay_size = 0;
+static gsize replay_pos = 0;
+static const char *replay_path = NULL;
+static GMainLoop *replay_loop = NULL;
+static GHashTable *replay_clients = NULL;	/* recorded fd -> client */
+static GHashTable *replay_watches = NULL;	/* path -> GamReplayWatch */
+static gint64 replay_start = 0;
+static gint32 replay_span = 0;
+static guint replay_records = 0;
+static guint replay_connections = 0;
+static guint replay_requests = 0;
+static guint replay_events = 0;
+static volatile gint replay_bytes = 0;
+
+/*
+ * Reads the record at @pos into @rec and its string into @str, which
+ * has room for MAXPATHLEN bytes and the terminator.
+ */
+static gboolean
+gam_replay_read(gsize *pos, GamRecord *rec, char *str)
+{
+	if (*pos + sizeof(GamRecord) > replay_size)
+		return FALSE;
+	memcpy(rec, replay_data + *pos, sizeof(GamRecord));
+	if ((rec->len > MAXPATHLEN) ||
+	    (*pos + sizeof(GamRecord) + rec->len > replay_size))
+		return FALSE;
+	memcpy(str, replay_data + *pos + sizeof(GamRecord), rec->len);
+	str[rec->len] = 0;
+	*pos += sizeof(GamRecord) + rec->len;
+	return TRUE;
+}
+
+static gpointer
+gam_replay_drain(gpointer data)
+{
+	int fd = GPOINTER_TO_INT(data);
+	char buf[4096];
+	ssize_t len;
+
+	for (;;) {
+		len = read(fd, buf, sizeof(buf));
+		if ((len < 0) && (errno == EINTR))
+			continue;
+		if (len <= 0)
+			break;
+		g_atomic_int_add(&replay_bytes, len);
+	}
+	return NULL;
+}
+
+static void
+gam_replay_client_free(gpointer data)
+{
+	GamReplayClient *client = data;
+
+	/* flushes its queue, leaves its descriptor open */
+	gam_connection_close(client->conn);
+	close(client->fd);
+	if (client->thread != NULL)
+		g_thread_join(client->thread);
+	close(client->peer);
+	g_free(client);
+}
+
+static void
+gam_replay_open(int fd, int pid)
+{
+	GamReplayClient *client;
+	GIOChannel *source;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		gam_error(DEBUG_INFO, "Failed to create a socketpair: %s\n",
+			  strerror(errno));
+		return;
+	}
+
+	client = g_new0(GamReplayClient, 1);
+	client->fd = fds[0];
+	client->peer = fds[1];
+	source = g_io_channel_unix_new(fds[0]);
+	client->conn = gam_connection_new(replay_loop, source);
+	gam_connection_set_pid(client->conn, pid);
+#if GLIB_CHECK_VERSION(2,32,0)
+	client->thread = g_thread_new("replay", gam_replay_drain,
+				      GINT_TO_POINTER(fds[1]));
+#else
+	client->thread = g_thread_create(gam_replay_drain,
+					 GINT_TO_POINTER(fds[1]), TRUE, NULL);
+#endif
+	g_hash_table_replace(replay_clients, GINT_TO_POINTER(fd), client);
+	replay_connections++;
+}
+
+static void
+gam_replay_request(int fd, int type, int seq, const char *path, int len)
+{
+	GamReplayClient *client;
+	GAMPacket req;
+	char *data;
+	int size;
+
+	client = g_hash_table_lookup(replay_clients, GINT_TO_POINTER(fd));
+	if (client == NULL)
+		return;
+
+	req.len = GAM_PACKET_HEADER_LEN + len;
+	req.version = GAM_PROTO_VERSION;
+	req.seq = seq;
+	req.type = type;
+	req.pathlen = len;
+	memcpy(req.path, path, len);
+
+	gam_connection_get_data(client->conn, &data, &size);
+	g_assert(size >= req.len);
+	memcpy(data, &req, req.len);
+	if (gam_connection_data(client->conn, req.len) < 0) {
+		GAM_DEBUG(DEBUG_INFO, "Replayed request %d of %d failed\n",
+			  seq, fd);
+		g_hash_table_remove(replay_clients, GINT_TO_POINTER(fd));
+	}
+	replay_requests++;
+}
+
+static void
+gam_replay_add_watch(const char *path, gint32 wd, int err)
+{
+	GamReplayWatch *watch = g_new(GamReplayWatch, 1);
+
+	watch->wd = wd;
+	watch->err = err;
+	g_hash_table_replace(replay_watches, g_strdup(path), watch);
+}
+
+/*
+ * The watches added for a request are recorded after it, take them in
+ * before replaying it.
+ */
+static void
+gam_replay_read_watches(void)
+{
+	char str[MAXPATHLEN + 1];
+	GamRecord rec;
+	gsize pos = replay_pos;
+
+	while (gam_replay_read(&pos, &rec, str)) {
+		if (rec.type == GAM_RECORD_WATCH)
+			gam_replay_add_watch(str, rec.args[0], rec.args[2]);
+		else if (rec.type != GAM_RECORD_IGNORE)
+			break;
+		replay_pos = pos;
+		replay_records++;
+	}
+}
+
+/**
+ * gam_replay_watch:
+ * @path: the path to watch
+ * @err: where to store the errno of a failure
+ *
+ * Stands for inotify_add_watch() when replaying, a path the server
+ * never watched doesn't exist.
+ *
+ * Returns the watch descriptor recorded for @path or -1
+ */
+gint32
+gam_replay_watch(const char *path, int *err)
+{
+	GamReplayWatch *watch;
+
+	watch = g_hash_table_lookup(replay_watches, path);
+	if (watch == NULL) {
+		if (err)
+			*err = ENOENT;
+		return -1;
+	}
+	if ((watch->wd < 0) && (err))
+		*err = watch->err;
+	return watch->wd;
+}
+
+static void
+gam_replay_finish(void)
+{
+	struct rusage usage;
+	guint32 matches, misses;
+	double elapsed;
+
+	ik_replay_process();
+	gam_connections_flush();
+	g_hash_table_destroy(replay_clients);
+	elapsed = (gam_stats_now() - replay_start) / 1000000.0;
+	getrusage(RUSAGE_SELF, &usage);
+	ik_move_stats(&matches, &misses);
+
+	if (replay_pos != replay_size)
+		printf("%s: truncated after %u records\n", replay_path,
+		       replay_records);
+	printf("replayed %u records: %u connections, %u requests, "
+	       "%u events\n", replay_records, replay_connections,
+	       replay_requests, replay_events);
+	printf("recorded over %.3f s, replayed in %.3f s, %.0f events/s\n",
+	       replay_span / 1000.0, elapsed,
+	       elapsed > 0 ? replay_events / elapsed : 0.0);
+	printf("cpu %.3f s user, %.3f s system\n",
+	       usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0,
+	       usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0);
+	printf("%d bytes sent to the clients, %u moves matched, "
+	       "%u unmatched\n", g_atomic_int_get(&replay_bytes),
+	       matches, misses);
+
+	g_main_loop_quit(replay_loop);
+}
+
+static gboolean
+gam_replay_step(gpointer data)
+{
+	char str[MAXPATHLEN + 1];
+	GamRecord rec;
+	int i;
+
+	if (replay_start == 0)
+		replay_start = gam_stats_now();
+
+	for (i = 0; i < GAM_REPLAY_BATCH; i++) {
+		if (!gam_replay_read(&replay_pos, &rec, str)) {
+			gam_replay_finish();
+			return FALSE;
+		}
+		replay_records++;
+
+		switch (rec.type) {
+			case GAM_RECORD_OPEN:
+				gam_replay_open(rec.args[0], rec.args[1]);
+				break;
+			case GAM_RECORD_REQUEST:
+				gam_replay_read_watches();
+				gam_replay_request(rec.args[0], rec.args[1],
+						   rec.args[2], str, rec.len);
+				break;
+			case GAM_RECORD_CLOSE:
+				g_hash_table_remove(replay_clients,
+						    GINT_TO_POINTER(rec.args[0]));
+				break;
+			case GAM_RECORD_WATCH:
+				gam_replay_add_watch(str, rec.args[0],
+						     rec.args[2]);
+				break;
+			case GAM_RECORD_EVENT:
+				ik_replay_event(rec.args[0], rec.args[1],
+						rec.args[2], str);
+				replay_events++;
+				break;
+			case GAM_RECORD_PROCESS:
+				ik_replay_process();
+				gam_connections_flush();
+				replay_span = rec.args[0];
+				return TRUE;
+			default:
+				break;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * gam_replay_start:
+ * @path: a file written by gam_record_start()
+ * @loop: the main loop, quit once the replay is done
+ *
+ * Loads a record to replay from the main loop. Must be called before
+ * the inotify backend is started, which then never uses the kernel.
+ *
+ * Returns TRUE in case of success, FALSE otherwise
+ */
+gboolean
+gam_replay_start(const char *path, GMainLoop *loop)
+{
+	GamRecordHeader header;
+	GError *error = NULL;
+
+	g_assert(path != NULL);
+	g_assert(loop != NULL);
+
+	if (!g_file_get_contents(path, &replay_data, &replay_size, &error)) {
+		gam_error(DEBUG_INFO, "Failed to read the record %s: %s\n",
+			  path, error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	if (replay_size >= sizeof(header))
+		memcpy(&header, replay_data, sizeof(header));
+	if ((replay_size < sizeof(header)) ||
+	    (memcmp(header.magic, GAM_RECORD_MAGIC, sizeof(header.magic))) ||
+	    (header.version != GAM_RECORD_VERSION) ||
+	    (header.record_size != sizeof(GamRecord))) {
+		gam_error(DEBUG_INFO, "%s is not a record of this server\n",
+			  path);
+		g_free(replay_data);
+		replay_data = NULL;
+		return FALSE;
+	}
+
+#if !GLIB_CHECK_VERSION(2,32,0)
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+
+	replay_path = path;
+	replay_pos = sizeof(header);
+	replay_loop = loop;
+	replay_clients = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					       NULL, gam_replay_client_free);
+	replay_watches = g_hash_table_new_full(g_str_hash, g_str_equal,
+					       g_free, g_free);
+	ik_set_replay();
+	g_idle_add(gam_replay_step, NULL);
+	return TRUE;
+}
+
+#else /* !ENABLE_INOTIFY */
+
+gboolean
+gam_replay_start(const char *path, GMainLoop *loop)
+{
+	gam_error(DEBUG_INFO, "Replaying needs the inotify backend\n");
+	return FALSE;
+}
+
+gint32
+gam_replay_watch(const char *path, int *err)
+{
+	if (err)
+		*err = ENOENT;
+	return -1;
+}
+
+#endif /* ENABLE_INOTIFY */
@@ -0,0 +1,79 @@
+#ifndef __GAM_RECORD_H__
+#define __GAM_RECORD_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Recording of the inotify event stream and of the client requests,
+ * and replaying it with no kernel involved, see doc/replay.txt.
+ *
+ * gam_server --record writes every watch added or removed, every raw
+ * inotify event read and every subscription request to a file.
+ * gam_server --replay feeds it back through the same code, from the
+ * requests of the clients to the events written to them, as fast as
+ * it can, which gives reproducible profiles of the dispatch pipeline.
+ */
+
+#define GAM_RECORD_MAGIC	"GAMRECRD"
+#define GAM_RECORD_VERSION	1
+
+/* The arguments of each record */
+typedef enum {
+	GAM_RECORD_NONE = 0,
+	GAM_RECORD_OPEN,	/* fd, pid: a client authenticated */
+	GAM_RECORD_REQUEST,	/* fd, type, seq; path */
+	GAM_RECORD_CLOSE,	/* fd */
+	GAM_RECORD_WATCH,	/* wd or -1, mask, errno; path */
+	GAM_RECORD_IGNORE,	/* wd; path */
+	GAM_RECORD_EVENT,	/* wd, mask, cookie; name */
+	GAM_RECORD_PROCESS,	/* milliseconds since the start */
+	GAM_RECORD_LAST
+} GamRecordType;
+
+/* Followed by the @len bytes of its string, not terminated */
+typedef struct {
+	guint16 type;		/* a GamRecordType */
+	guint16 len;
+	gint32 args[3];
+} GamRecord;
+
+/* At the start of the file, in the byte order of the server */
+typedef struct {
+	char magic[8];
+	guint32 version;
+	guint32 record_size;
+	gint64 wall;		/* the time of day at the start, in microseconds */
+} GamRecordHeader;
+
+gboolean	gam_record_start	(const char *path);
+void		gam_record_stop		(void);
+void		gam_record_open		(int fd,
+					 int pid);
+void		gam_record_request	(int fd,
+					 int type,
+					 int seq,
+					 const char *path,
+					 int len);
+void		gam_record_close	(int fd);
+void		gam_record_watch	(const char *path,
+					 guint32 mask,
+					 gint32 wd,
+					 int err);
+void		gam_record_ignore	(gint32 wd,
+					 const char *path);
+void		gam_record_event	(gint32 wd,
+					 guint32 mask,
+					 guint32 cookie,
+					 const char *name);
+void		gam_record_process	(void);
+
+gboolean	gam_replay_start	(const char *path,
+					 GMainLoop *loop);
+gint32		gam_replay_watch	(const char *path,
+					 int *err);
+
+G_END_DECLS
+
+#endif /* __GAM_RECORD_H__ */
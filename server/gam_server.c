@@ -25,6 +25,8 @@
 #include <stdlib.h>
 #include <glib.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
 #include "gam_error.h"
 #include "gam_protocol.h"
 #include "gam_event.h"
@@ -36,6 +38,9 @@
 #ifdef ENABLE_INOTIFY
 #include "gam_inotify.h"
 #endif
+#ifdef ENABLE_FANOTIFY
+#include "gam_fanotify.h"
+#endif
 #ifdef ENABLE_DNOTIFY
 #include "gam_dnotify.h"
 #endif
@@ -48,9 +53,17 @@
 #include "gam_excludes.h"
 #include "gam_fs.h"
 #include "gam_conf.h" 
+#include "gam_dircache.h"
+#include "gam_stats.h"
+#include "gam_probes.h"
+#include "gam_snapshot.h"
+#include "gam_trace.h"
+#include "gam_record.h"
 
 static int poll_only = 0;
 static const char *session;
+static const char *record_file = NULL;
+static const char *replay_file = NULL;
 
 static GamKernelHandler __gam_kernel_handler = GAMIN_K_NONE;
 static gboolean (*__gam_kernel_add_subscription) (GamSubscription *sub) = NULL;
@@ -79,6 +92,20 @@ gam_inotify_is_running(void)
 }
 #endif
 
+#ifndef ENABLE_FANOTIFY
+/**
+ * gam_fanotify_is_running
+ *
+ * Unless built with fanotify support, always
+ * return false.
+ */
+gboolean
+gam_fanotify_is_running(void)
+{
+	return FALSE;
+}
+#endif
+
 
 /**
  * gam_exit:
@@ -100,7 +127,10 @@ gam_exit(int signo) {
  */
 void
 gam_shutdown(void) {
-    gam_conn_shutdown(session);
+    gam_record_stop();
+    /* a replay has no socket, don't remove the one of a real server */
+    if (replay_file == NULL)
+	gam_conn_shutdown(session);
 }
 
 /**
@@ -113,6 +143,10 @@ gam_show_debug(void) {
 	gam_exclude_debug ();
     gam_fs_debug ();
     gam_connections_debug();
+    gam_dircache_debug();
+#ifdef ENABLE_FANOTIFY
+    gam_fanotify_debug ();
+#endif
 #ifdef ENABLE_INOTIFY
     gam_inotify_debug ();
 #endif
@@ -127,6 +161,7 @@ gam_show_debug(void) {
  *
  * Initialize the subscription checking backend, on Linux we will use
  * the DNotify kernel support, otherwise the polling module.
+ * fanotify is preferred when we have the capability to use it.
  *
  * Return TRUE in case of success and FALSE otherwise
  */
@@ -136,7 +171,25 @@ gam_init_subscriptions(void)
 	gam_conf_read ();
 	gam_exclude_init();
 
+	if (replay_file != NULL) {
+#ifdef ENABLE_INOTIFY
+		/* the record only holds inotify events */
+		if (gam_inotify_init()) {
+			GAM_DEBUG(DEBUG_INFO, "Replaying %s\n", replay_file);
+			return(TRUE);
+		}
+#endif
+		return(FALSE);
+	}
+
 	if (!poll_only) {
+#ifdef ENABLE_FANOTIFY
+		if (!getenv("GAM_TEST_DNOTIFY") && !getenv("GAM_TEST_INOTIFY") &&
+		    gam_fanotify_init()) {
+			GAM_DEBUG(DEBUG_INFO, "Using fanotify as backend\n");
+			return(TRUE);
+		}
+#endif
 #ifdef ENABLE_INOTIFY
 		if (!getenv("GAM_TEST_DNOTIFY") && gam_inotify_init()) {
 			GAM_DEBUG(DEBUG_INFO, "Using inotify as backend\n");
@@ -174,6 +227,28 @@ gam_init_subscriptions(void)
 	return(FALSE);
 }
 
+/*
+ * Hands @sub to the kernel backend or to polling, and accounts for the
+ * watch in the resources of its listener.
+ */
+static gboolean
+gam_server_attach(GamSubscription *sub, GamResource resource)
+{
+	gboolean ret;
+
+	if (resource == GAM_RESOURCE_KERNEL)
+		ret = gam_kernel_add_subscription (sub);
+	else
+		ret = gam_poll_add_subscription (sub);
+
+	if (ret) {
+		gam_subscription_set_resource (sub, resource);
+		gam_listener_account (gam_subscription_get_listener (sub),
+				      resource, 1);
+	}
+	return ret;
+}
+
 /**
  * gam_add_subscription:
  *
@@ -192,27 +267,27 @@ gam_add_subscription(GamSubscription * sub)
 
 	path = gam_subscription_get_path (sub);
 
-	if (gam_exclude_check (path)) 
+	if (gam_subscription_is_excluded (sub)) 
 	{
 		GAM_DEBUG(DEBUG_INFO, "g_a_s: %s excluded\n", path);
-#if ENABLE_INOTIFY
-		if (gam_inotify_is_running())
-			return gam_poll_add_subscription (sub);
+#if ENABLE_INOTIFY || ENABLE_FANOTIFY
+		if (gam_inotify_is_running() || gam_fanotify_is_running())
+			return gam_server_attach (sub, GAM_RESOURCE_POLL);
 		else
 #endif
-			return gam_kernel_add_subscription (sub);
+			return gam_server_attach (sub, GAM_RESOURCE_KERNEL);
 	} else {
 		gam_fs_mon_type type;
 		type = gam_fs_get_mon_type (path);
 		if (type == GFS_MT_KERNEL) 
 		{
 			GAM_DEBUG(DEBUG_INFO, "g_a_s: %s using kernel monitoring\n", path);
-			return gam_kernel_add_subscription(sub);
+			return gam_server_attach (sub, GAM_RESOURCE_KERNEL);
 		}
 		else if (type == GFS_MT_POLL)
 		{
 			GAM_DEBUG(DEBUG_INFO, "g_a_s: %s using poll monitoring\n", path);
-			return gam_poll_add_subscription (sub);
+			return gam_server_attach (sub, GAM_RESOURCE_POLL);
 		}
 	}
 
@@ -234,12 +309,18 @@ gam_remove_subscription(GamSubscription * sub)
 	if (sub == NULL)
 		return(FALSE);
 
+	gam_server_cancel_initial_events (sub);
 	path = gam_subscription_get_path (sub);
 
-	if (gam_exclude_check (path)) 
+	/* the backend may free the subscription */
+	gam_listener_account (gam_subscription_get_listener (sub),
+			      gam_subscription_get_resource (sub), -1);
+	gam_subscription_set_resource (sub, GAM_RESOURCE_NONE);
+
+	if (gam_subscription_is_excluded (sub)) 
 	{
-#if ENABLE_INOTIFY
-		if (gam_inotify_is_running())
+#if ENABLE_INOTIFY || ENABLE_FANOTIFY
+		if (gam_inotify_is_running() || gam_fanotify_is_running())
 			return gam_poll_remove_subscription (sub);
 		else
 #endif
@@ -289,6 +370,116 @@ gam_server_use_timeout (void)
   return !no_timeout;
 }
 
+/*
+ * The event of one emission, serialized once and sent to or queued
+ * for every recipient seeing the same name.
+ */
+typedef struct {
+    int offset;			/* of the name in the path, -1 if not filled */
+    GamEventPacket *packet;	/* NULL if it can't be sent */
+} GamEmission;
+
+static guint emit_serial = 0;
+
+static gboolean gam_server_initial_scan_defer(GamSubscription *sub,
+                                              const char *path,
+                                              int node_is_dir,
+                                              GaminEventType event,
+                                              int force);
+
+/*
+ * Sends @event to the client of @sub, @offset being where the name
+ * reported to that subscription starts in @path.
+ */
+static void
+gam_server_deliver(const char *path, int pathlen, int offset,
+                   GaminEventType event, GamSubscription *sub,
+                   GamEmission *emission)
+{
+    GamListener *listener;
+    GamConnDataPtr conn;
+    gint64 origin, start, end;
+    int reqno;
+
+    listener = gam_subscription_get_listener(sub);
+    if (listener == NULL)
+	return;
+    conn = (GamConnDataPtr) gam_listener_get_service(listener);
+    if (conn == NULL)
+	return;
+
+    reqno = gam_subscription_get_reqno(sub);
+
+    GAM_PROBE4(deliver, conn, reqno, event, path + offset);
+    GAM_TRACE(DELIVER, gam_connection_get_fd(conn), reqno, event, 0,
+              path + offset);
+    origin = gam_stats_get_origin();
+    start = gam_stats_now();
+    gam_stats_latency(GAM_LATENCY_DISPATCH, origin, start);
+
+    if (emission->offset != offset) {
+	gam_event_packet_unref(emission->packet);
+	emission->offset = offset;
+	emission->packet = gam_event_packet_new(event, path + offset,
+	                                        pathlen - offset);
+    }
+    if (emission->packet == NULL)
+	return;
+
+#if defined(ENABLE_INOTIFY) || defined(ENABLE_FANOTIFY)
+	if (gam_inotify_is_running() || gam_fanotify_is_running())
+	{
+		/* the queue coalesces duplicates per connection */
+		gam_queue_event(conn, reqno, emission->packet);
+		return;
+	}
+#endif
+
+    if (gam_send_event_packet(conn, &emission->packet->req, reqno) < 0) {
+	GAM_DEBUG(DEBUG_INFO, "Failed to send event to PID %d\n",
+		  gam_connection_get_pid(conn));
+	return;
+    }
+    end = gam_stats_now();
+    gam_stats_latency(GAM_LATENCY_WRITE, start, end);
+    gam_stats_latency(GAM_LATENCY_TOTAL, origin, end);
+    gam_connection_latency(conn, origin, end);
+}
+
+/*
+ * Emits @event to one member of a batch, the filtering decision being
+ * taken once per subscription group for the emission @serial.
+ */
+static void
+gam_server_emit_member(const char *path, int pathlen, int node_is_dir,
+                       GaminEventType event, GamSubscription *sub,
+                       int force, guint serial, GamEmission *emission)
+{
+    int offset;
+
+    if ((gam_subscription_is_cancelled(sub)) ||
+        (!gam_subscription_has_event(sub, event)))
+	return;
+    if (gam_server_initial_scan_defer(sub, path, node_is_dir, event, force))
+	return;
+
+    offset = gam_subscription_group_filter(gam_subscription_get_group(sub),
+                                           serial, path, pathlen,
+                                           node_is_dir, event, force);
+    if (offset < 0)
+	return;
+
+    gam_server_deliver(path, pathlen, offset, event, sub, emission);
+}
+
+static guint
+gam_server_next_serial(void)
+{
+    if (++emit_serial == 0)
+	emit_serial = 1;
+    return (emit_serial);
+}
+
 /**
  * gam_server_emit_one_event:
  * @path: the file/directory path
@@ -304,54 +495,19 @@ gam_server_emit_one_event(const char *path, int node_is_dir,
                           GaminEventType event, GamSubscription *sub,
 			  int force)
 {
-    int pathlen, len;
-    const char *subpath;
-    GamListener *listener;
-    GamConnDataPtr conn;
-    int reqno;
-
-
-    pathlen = strlen(path);
+    GamEmission emission;
 
-    if (!gam_subscription_wants_event(sub, path, node_is_dir, event, force))
+    if ((path == NULL) || (sub == NULL) || (event == 0))
 	return;
 
-    listener = gam_subscription_get_listener(sub);
-    if (listener == NULL)
-	return;
-    conn = (GamConnDataPtr) gam_listener_get_service(listener);
-    if (conn == NULL)
-	return;
+    GAM_PROBE2(emit, path, event);
+    gam_dircache_event(path, node_is_dir, event);
 
-    /*
-     * When sending directory related entries, for items in the
-     * directory the FAM protocol removes the common direcory part.
-     */
-    subpath = path;
-    len = pathlen;
-    if (gam_subscription_is_dir(sub)) {
-	int dlen = gam_subscription_pathlen(sub);
-
-	if ((pathlen > dlen + 1) && (path[dlen] == '/')) {
-	    subpath += dlen + 1;
-	    len -= dlen + 1;
-	}
-    }
-
-    reqno = gam_subscription_get_reqno(sub);
-
-#ifdef ENABLE_INOTIFY
-	if (gam_inotify_is_running())
-	{
-		gam_queue_event(conn, reqno, event, subpath, len);
-	} else
-#endif
-	{
-		if (gam_send_event(conn, reqno, event, subpath, len) < 0) {
-		    GAM_DEBUG(DEBUG_INFO, "Failed to send event to PID %d\n",
-			  gam_connection_get_pid(conn));
-		}
-	}
+    emission.offset = -1;
+    emission.packet = NULL;
+    gam_server_emit_member(path, strlen(path), node_is_dir, event, sub,
+                           force, 0, &emission);
+    gam_event_packet_unref(emission.packet);
 }
 
 /**
@@ -369,17 +525,381 @@ void
 gam_server_emit_event(const char *path, int is_dir_node, GaminEventType event,
                       GList * subs, int force)
 {
+    GamEmission emission;
     GList *l;
     int pathlen;
+    guint serial;
+
+    if ((path == NULL) || (subs == NULL) || (event == 0))
+        return;
+    pathlen = strlen(path);
+
+    GAM_PROBE2(emit, path, event);
+    gam_dircache_event(path, is_dir_node, event);
+
+    serial = gam_server_next_serial();
+    emission.offset = -1;
+    emission.packet = NULL;
+    for (l = subs; l; l = l->next)
+	gam_server_emit_member(path, pathlen, is_dir_node, event, l->data,
+	                       force, serial, &emission);
+    gam_event_packet_unref(emission.packet);
+}
+
+/**
+ * gam_server_emit_event_subs:
+ * @path: the file/directory path
+ * @is_dir_node: is the target a directory
+ * @event: the event type
+ * @subs: an array of subscriptions for this event
+ * @nsubs: the number of subscriptions in @subs
+ * @force: force the emission of the events
+ *
+ * Same as gam_server_emit_event() for callers keeping the interested
+ * subscriptions in an array.
+ */
+void
+gam_server_emit_event_subs(const char *path, int is_dir_node,
+                           GaminEventType event, GamSubscription **subs,
+                           guint nsubs, int force)
+{
+    GamEmission emission;
+    int pathlen;
+    guint serial, i;
 
-    if ((path == NULL) || (subs == NULL))
+    if ((path == NULL) || (nsubs == 0) || (event == 0))
         return;
     pathlen = strlen(path);
 
-    for (l = subs; l; l = l->next) {
-        GamSubscription *sub = l->data;
-	gam_server_emit_one_event (path, is_dir_node, event, sub, force);
+    GAM_PROBE2(emit, path, event);
+    gam_dircache_event(path, is_dir_node, event);
+
+    serial = gam_server_next_serial();
+    emission.offset = -1;
+    emission.packet = NULL;
+    for (i = 0; i < nsubs; i++)
+	gam_server_emit_member(path, pathlen, is_dir_node, event, subs[i],
+	                       force, serial, &emission);
+    gam_event_packet_unref(emission.packet);
+}
+
+/*
+ * The Exists listing of a directory is sent in chunks from an idle
+ * callback so that a huge directory doesn't stall the other clients.
+ * It comes from the directory cache when an earlier subscriber already
+ * had it read, otherwise the read fills the cache. The live events of
+ * the subscription are held back until the listing is over, so they
+ * still reach the client after the EndExist, as when it was sent at
+ * once. A repeat of the last event held for a path is dropped, and if
+ * too many are held anyway they are all dropped for a Changed on the
+ * directory after the EndExist, as for a kernel queue overflow.
+ */
+#define GAM_INITIAL_SCAN_CHUNK 256
+#define GAM_INITIAL_SCAN_DEFERRED_MAX 4096
+
+typedef struct {
+    char *path;
+    int is_dir;
+    GaminEventType event;
+    int force;
+} GamDeferredEvent;
+
+typedef struct {
+    GamSubscription *sub;
+    GaminEventType event;
+    gboolean was_missing;
+    char *dirpath;
+    DIR *dir;
+    GamDirFill *fill;
+    GArray *entries;		/* cached listing, replaces dir */
+    guint index;
+    GString *path;		/* dirpath/ followed by the current entry */
+    gsize dirlen;
+    guint source;
+    gboolean emitting;		/* sending the listing itself */
+    GList *deferred;		/* live events held back, newest first */
+    GHashTable *deferred_last;	/* path -> the last event held for it */
+    guint n_deferred;
+    gboolean deferred_lost;	/* too many, a Changed replaces them */
+} GamInitialScan;
+
+static GList *initial_scans = NULL;
+static GHashTable *initial_scan_hash = NULL;	/* sub -> its scan */
+
+static void
+gam_server_initial_scan_drop_deferred(GamInitialScan *scan)
+{
+    GamDeferredEvent *deferred;
+    GList *l;
+
+    if (scan->deferred_last != NULL) {
+        g_hash_table_destroy(scan->deferred_last);
+        scan->deferred_last = NULL;
+    }
+    for (l = scan->deferred; l; l = l->next) {
+        deferred = l->data;
+        g_free(deferred->path);
+        g_free(deferred);
+    }
+    g_list_free(scan->deferred);
+    scan->deferred = NULL;
+    scan->n_deferred = 0;
+}
+
+static void
+gam_server_initial_scan_free(GamInitialScan *scan)
+{
+    initial_scans = g_list_remove(initial_scans, scan);
+    if (g_hash_table_lookup(initial_scan_hash, scan->sub) == scan)
+        g_hash_table_remove(initial_scan_hash, scan->sub);
+    gam_server_initial_scan_drop_deferred(scan);
+    if (scan->dir != NULL)
+        closedir(scan->dir);
+    gam_dircache_fill_end(scan->fill, FALSE);
+    gam_dircache_entries_free(scan->entries);
+    g_string_free(scan->path, TRUE);
+    g_free(scan->dirpath);
+    g_free(scan);
+}
+
+/* Use the type readdir got from the filesystem, lstat only if it has none */
+static int
+gam_server_dirent_is_dir(const char *path, struct dirent *entry)
+{
+    struct stat fsb;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+    if (entry->d_type != DT_UNKNOWN)
+        return entry->d_type == DT_DIR ? 1 : 0;
+#endif
+
+    memset(&fsb, 0, sizeof(struct stat));
+    lstat(path, &fsb);
+    return S_ISDIR(fsb.st_mode) ? 1 : 0;
+}
+
+/*
+ * Holds back an event for a subscription whose listing is still being
+ * sent. Returns TRUE if it did.
+ */
+static gboolean
+gam_server_initial_scan_defer(GamSubscription *sub, const char *path,
+                              int node_is_dir, GaminEventType event,
+                              int force)
+{
+    GamInitialScan *scan;
+    GamDeferredEvent *deferred;
+
+    if (initial_scan_hash == NULL)
+        return FALSE;
+    scan = g_hash_table_lookup(initial_scan_hash, sub);
+    if ((scan == NULL) || (scan->emitting))
+        return FALSE;
+    if (scan->deferred_lost)
+        return TRUE;
+
+    /* e.g. a file being written to over and over */
+    if (scan->deferred_last == NULL)
+        scan->deferred_last = g_hash_table_new(g_str_hash, g_str_equal);
+    deferred = g_hash_table_lookup(scan->deferred_last, path);
+    if ((deferred != NULL) && (deferred->event == event) &&
+        (deferred->is_dir == node_is_dir)) {
+        deferred->force |= force;
+        return TRUE;
     }
+
+    if (scan->n_deferred >= GAM_INITIAL_SCAN_DEFERRED_MAX) {
+        GAM_DEBUG(DEBUG_INFO, "too many events held back for %s\n",
+                  scan->dirpath);
+        gam_server_initial_scan_drop_deferred(scan);
+        scan->deferred_lost = TRUE;
+        return TRUE;
+    }
+
+    deferred = g_new(GamDeferredEvent, 1);
+    deferred->path = g_strdup(path);
+    deferred->is_dir = node_is_dir;
+    deferred->event = event;
+    deferred->force = force;
+    scan->deferred = g_list_prepend(scan->deferred, deferred);
+    g_hash_table_insert(scan->deferred_last, deferred->path, deferred);
+    scan->n_deferred++;
+    return TRUE;
+}
+
+/* Sends the EndExist, then the events held back meanwhile */
+static void
+gam_server_initial_scan_end(GamInitialScan *scan)
+{
+    GamDeferredEvent *deferred;
+    GamEmission emission;
+    GList *l;
+
+    g_hash_table_remove(initial_scan_hash, scan->sub);
+    if (!scan->was_missing)
+        gam_server_emit_one_event(scan->dirpath, 1, GAMIN_EVENT_ENDEXISTS,
+                                  scan->sub, 1);
+    if (scan->deferred_lost)
+        gam_server_emit_one_event(scan->dirpath, 1, GAMIN_EVENT_CHANGED,
+                                  scan->sub, 1);
+
+    scan->deferred = g_list_reverse(scan->deferred);
+    for (l = scan->deferred; l; l = l->next) {
+        deferred = l->data;
+        emission.offset = -1;
+        emission.packet = NULL;
+        gam_server_emit_member(deferred->path, strlen(deferred->path),
+                               deferred->is_dir, deferred->event, scan->sub,
+                               deferred->force, 0, &emission);
+        gam_event_packet_unref(emission.packet);
+    }
+    gam_server_initial_scan_free(scan);
+}
+
+static gboolean
+gam_server_initial_scan_chunk(gpointer data)
+{
+    GamInitialScan *scan = data;
+    struct dirent *entry;
+    GamDirEntry *cached;
+    int i, is_dir;
+
+    scan->emitting = TRUE;
+    for (i = 0; i < GAM_INITIAL_SCAN_CHUNK; i++) {
+        g_string_truncate(scan->path, scan->dirlen);
+
+        if (scan->entries != NULL) {
+            if (scan->index >= scan->entries->len)
+                break;
+            cached = &g_array_index(scan->entries, GamDirEntry, scan->index++);
+            g_string_append(scan->path, cached->name);
+            is_dir = cached->is_dir;
+        } else {
+            entry = readdir(scan->dir);
+            if (entry == NULL)
+                break;
+            if ((!strcmp(entry->d_name, ".")) ||
+                (!strcmp(entry->d_name, "..")))
+                continue;
+
+            g_string_append(scan->path, entry->d_name);
+            is_dir = gam_server_dirent_is_dir(scan->path->str, entry);
+            gam_dircache_fill_add(scan->fill, entry->d_name, is_dir);
+        }
+
+        gam_server_emit_one_event(scan->path->str, is_dir,
+                                  scan->event, scan->sub, 1);
+    }
+
+    scan->emitting = FALSE;
+
+    if (i < GAM_INITIAL_SCAN_CHUNK) {
+        gam_dircache_fill_end(scan->fill, TRUE);
+        scan->fill = NULL;
+        gam_server_initial_scan_end(scan);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * gam_server_cancel_initial_events:
+ * @sub: the subscription
+ *
+ * Drop the pending Exists listing of a subscription going away.
+ */
+void
+gam_server_cancel_initial_events(GamSubscription *sub)
+{
+    GList *l, *next;
+
+    for (l = initial_scans; l; l = next) {
+        GamInitialScan *scan = l->data;
+
+        next = l->next;
+        if (scan->sub == sub) {
+            g_source_remove(scan->source);
+            gam_server_initial_scan_free(scan);
+        }
+    }
+}
+
+/**
+ * gam_server_emit_initial_events:
+ * @path: the file/directory path
+ * @sub: the subscription
+ * @is_dir: is the subscription on a directory
+ * @was_missing: the path just appeared
+ *
+ * Sends the Exists listing a kernel backend owes a new subscription,
+ * or the Created ones when the path showed up after the subscription
+ * was made. The directory content follows from the main loop.
+ */
+void
+gam_server_emit_initial_events(const char *path, GamSubscription *sub,
+                               gboolean is_dir, gboolean was_missing)
+{
+    GaminEventType gevent;
+    GamInitialScan *scan;
+    GamDirFill *fill = NULL;
+    GArray *entries = NULL;
+    DIR *dir;
+
+    /* The path went away and came back before its last listing was
+     * over, this one supersedes it.
+     */
+    if ((initial_scan_hash != NULL) &&
+        ((scan = g_hash_table_lookup(initial_scan_hash, sub)) != NULL)) {
+        g_source_remove(scan->source);
+        gam_server_initial_scan_end(scan);
+    }
+
+    if (was_missing) {
+        gevent = GAMIN_EVENT_CREATED;
+    } else {
+        if (g_file_test(path, G_FILE_TEST_EXISTS))
+            gevent = GAMIN_EVENT_EXISTS;
+        else
+            gevent = GAMIN_EVENT_DELETED;
+    }
+
+    gam_server_emit_one_event(path, is_dir ? 1 : 0, gevent, sub, 1);
+
+    dir = NULL;
+    if ((is_dir) && (!gam_dircache_get(path, &entries))) {
+        fill = gam_dircache_fill_begin(path);
+        dir = opendir(path);
+        if (dir == NULL) {
+            GAM_DEBUG(DEBUG_INFO, "unable to open directory %s: %s\n",
+                      path, strerror(errno));
+            gam_dircache_fill_end(fill, FALSE);
+        }
+    }
+
+    if ((dir == NULL) && (entries == NULL)) {
+        if (!was_missing)
+            gam_server_emit_one_event(path, is_dir ? 1 : 0,
+                                      GAMIN_EVENT_ENDEXISTS, sub, 1);
+        return;
+    }
+
+    scan = g_new0(GamInitialScan, 1);
+    scan->sub = sub;
+    scan->event = gevent;
+    scan->was_missing = was_missing;
+    scan->dirpath = g_strdup(path);
+    scan->dir = dir;
+    scan->fill = fill;
+    scan->entries = entries;
+    scan->path = g_string_new(path);
+    g_string_append_c(scan->path, '/');
+    scan->dirlen = scan->path->len;
+    scan->source = g_idle_add(gam_server_initial_scan_chunk, scan);
+    initial_scans = g_list_prepend(initial_scans, scan);
+    if (initial_scan_hash == NULL)
+        initial_scan_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_hash_table_insert(initial_scan_hash, sub, scan);
 }
 
 int
@@ -518,11 +1038,13 @@ gam_poll_file (GamNode *node)
 	return 0;
 }
 
-#ifdef GAM_DEBUG_ENABLED
-
 static GIOChannel *pipe_read_ioc = NULL;
 static GIOChannel *pipe_write_ioc = NULL;
 
+/*
+ * SIGUSR2 got through the pipe to the main loop: dump the trace, write
+ * a snapshot of the state and toggle debugging if compiled in.
+ */
 static gboolean
 gam_error_signal_pipe_handler(gpointer user_data)
 {
@@ -531,7 +1053,12 @@ gam_error_signal_pipe_handler(gpointer user_data)
   if (pipe_read_ioc)
     g_io_channel_read_chars(pipe_read_ioc, buf, sizeof(buf), NULL, NULL);
 
+  gam_trace_dump();
+  gam_snapshot_start();
+#ifdef GAM_DEBUG_ENABLED
   gam_error_check();
+#endif
+  return TRUE;
 }  
 
 static void
@@ -554,18 +1081,15 @@ gam_setup_error_handler (void)
     g_source_unref(source);
   }
 }
-#endif
 
 void
 gam_got_signal()
 {
-#ifdef GAM_DEBUG_ENABLED
   /* Wake up main loop */
   if (pipe_write_ioc) {
     g_io_channel_write_chars(pipe_write_ioc, "a", 1, NULL, NULL);
     g_io_channel_flush(pipe_write_ioc, NULL);
   }
-#endif
 }
 
 
@@ -597,9 +1121,7 @@ gam_server_init(GMainLoop * loop, const char *session)
      */
     if (no_timeout == 0)
       gam_schedule_server_timeout ();
-#ifdef GAM_DEBUG_ENABLED
     gam_setup_error_handler ();
-#endif
     
     return TRUE;
 }
@@ -616,30 +1138,50 @@ main(int argc, const char *argv[])
 		no_timeout = 1;
             else if (!strcmp(argv[i], "--pollonly"))
 	        poll_only = 1;
+	    else if ((!strcmp(argv[i], "--record")) && (i + 1 < argc))
+		record_file = argv[++i];
+	    else if ((!strcmp(argv[i], "--replay")) && (i + 1 < argc))
+		replay_file = argv[++i];
 	    else
 		session = argv[i];
 	}
     }
 
     gam_error_init();
+    gam_trace_init();
     signal(SIGHUP, gam_exit);
     signal(SIGINT, gam_exit);
     signal(SIGQUIT, gam_exit);
     signal(SIGTERM, gam_exit);
     signal(SIGPIPE, SIG_IGN);
 
-    if (!gam_init_subscriptions()) {
-	GAM_DEBUG(DEBUG_INFO, "Could not initialize the subscription system.\n");
-        exit(0);
-    }
-
     loop = g_main_loop_new(NULL, FALSE);
     if (loop == NULL) {
         g_error("Failed to create the main loop.\n");
         exit(1);
     }
 
-    if (!gam_server_init(loop, session)) {
+    if ((record_file != NULL) && (replay_file != NULL)) {
+        gam_error(DEBUG_INFO, "Can't record while replaying\n");
+        exit(1);
+    }
+    if ((record_file != NULL) && (!gam_record_start(record_file)))
+        exit(1);
+    if (replay_file != NULL) {
+        /* the replay quits the loop once done */
+        no_timeout = 1;
+        if (!gam_replay_start(replay_file, loop))
+            exit(1);
+    }
+
+    if (!gam_init_subscriptions()) {
+	GAM_DEBUG(DEBUG_INFO, "Could not initialize the subscription system.\n");
+        exit(replay_file != NULL);
+    }
+
+    if (replay_file != NULL) {
+        gam_setup_error_handler ();
+    } else if (!gam_server_init(loop, session)) {
         GAM_DEBUG(DEBUG_INFO, "Couldn't initialize the server.\n");
         exit(0);
     }
@@ -16,7 +16,8 @@ typedef enum {
 	GAMIN_K_INOTIFY = 2,
 	GAMIN_K_KQUEUE = 3,
 	GAMIN_K_MACH = 4,
-	GAMIN_K_INOTIFY2 = 5
+	GAMIN_K_INOTIFY2 = 5,
+	GAMIN_K_FANOTIFY = 6
 } GamKernelHandler;
 
 typedef enum {
@@ -47,6 +48,17 @@ void            gam_server_emit_event           (const char *path,
 						 GaminEventType event,
 						 GList *subs,
 						 int force);
+void		gam_server_emit_event_subs	(const char *path,
+						 int is_dir_node,
+						 GaminEventType event,
+						 GamSubscription **subs,
+						 guint nsubs,
+						 int force);
+void		gam_server_emit_initial_events	(const char *path,
+						 GamSubscription *sub,
+						 gboolean is_dir,
+						 gboolean was_missing);
+void		gam_server_cancel_initial_events	(GamSubscription *sub);
 void		gam_shutdown			(void);
 void		gam_show_debug			(void);
 void		gam_got_signal			(void);
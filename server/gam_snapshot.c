@@ -0,0 +1,398 @@
+/* Gamin
+ * Copyright (C) 2004 Daniel Veillard, Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A JSON snapshot of the server state, written on SIGUSR2 or on a
+ * GAM_REQ_SNAPSHOT to gamin-state-<pid>.json in the socket directory.
+ *
+ * A server with hundreds of thousands of subscriptions can't stop to
+ * dump them all, so the file is written from an idle source a bounded
+ * number of entries at a time and events keep being served in between.
+ * The snapshot is thus not atomic: a listener whose subscriptions
+ * changed while it was being walked is cut short and marked as not
+ * complete. The file is only renamed into place once finished.
+ */
+
+#include "server_config.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <glib.h>
+#include "gam_error.h"
+#include "gam_channel.h"
+#include "gam_connection.h"
+#include "gam_listener.h"
+#include "gam_subscription.h"
+#include "gam_stats.h"
+#include "gam_snapshot.h"
+#ifdef ENABLE_INOTIFY
+#include "gam_inotify.h"
+#endif
+#ifdef ENABLE_FANOTIFY
+#include "gam_fanotify.h"
+#endif
+
+typedef enum {
+	GAM_SNAPSHOT_HEAD = 0,
+	GAM_SNAPSHOT_LISTENERS,
+	GAM_SNAPSHOT_DIRS,
+	GAM_SNAPSHOT_MISSING,
+	GAM_SNAPSHOT_DONE
+} GamSnapshotPhase;
+
+typedef struct {
+	char *path;
+	char *tmp;
+	int fd;
+	GString *out;
+	GamSnapshotPhase phase;
+	gboolean first;		/* no item in the current array yet */
+
+	/* the listener being walked, and where */
+	int conn_fd;
+	GamListener *listener;
+	guint serial;
+	GList *cursor;
+	gboolean first_sub;
+
+	gint32 wd;		/* next inotify watch descriptor */
+	gint missing;		/* next entry of the inotify missing list */
+	GList *keys;		/* fanotify directories not dumped yet */
+	gboolean keys_taken;
+} GamSnapshot;
+
+static GamSnapshot *snapshot = NULL;
+
+/**
+ * gam_snapshot_string:
+ * @out: the JSON being built
+ * @str: a string, usually a path
+ *
+ * Appends @str as a JSON string. Paths aren't necessarily UTF-8, the
+ * bytes of one which isn't are escaped as if it was Latin-1.
+ */
+void
+gam_snapshot_string(GString *out, const char *str)
+{
+	const unsigned char *cur;
+	gboolean utf8;
+
+	if (str == NULL) {
+		g_string_append(out, "null");
+		return;
+	}
+
+	utf8 = g_utf8_validate(str, -1, NULL);
+	g_string_append_c(out, '"');
+	for (cur = (const unsigned char *) str; *cur != 0; cur++) {
+		if ((*cur == '"') || (*cur == '\\')) {
+			g_string_append_c(out, '\\');
+			g_string_append_c(out, *cur);
+		} else if ((*cur < 0x20) || ((*cur >= 0x80) && (!utf8))) {
+			g_string_append_printf(out, "\\u%04x", *cur);
+		} else {
+			g_string_append_c(out, *cur);
+		}
+	}
+	g_string_append_c(out, '"');
+}
+
+/**
+ * gam_snapshot_item:
+ * @out: the JSON being built
+ * @first: is this the first item of the array, reset
+ *
+ * Starts a new item of a JSON array, one per line.
+ */
+void
+gam_snapshot_item(GString *out, gboolean *first)
+{
+	if (!*first)
+		g_string_append_c(out, ',');
+	*first = FALSE;
+	g_string_append(out, "\n    ");
+}
+
+/*
+ * Turns the "name value" lines of the statistics into members of a
+ * JSON object.
+ */
+static void
+gam_snapshot_stats(GString *out)
+{
+	GString *stats;
+	char *line, *next, *space;
+	gboolean first = TRUE;
+
+	stats = gam_stats_collect();
+	g_string_append(out, "  \"stats\": {");
+	for (line = stats->str; (line != NULL) && (*line != 0); line = next) {
+		next = strchr(line, '\n');
+		if (next != NULL)
+			*next++ = 0;
+		space = strchr(line, ' ');
+		if (space == NULL)
+			continue;
+		*space = 0;
+		gam_snapshot_item(out, &first);
+		gam_snapshot_string(out, line);
+		g_string_append_printf(out, ": %s", space + 1);
+	}
+	g_string_append(out, "\n  },\n");
+	g_string_free(stats, TRUE);
+}
+
+/*
+ * Starts the next listener, returns FALSE once they were all done.
+ */
+static gboolean
+gam_snapshot_next_listener(GamSnapshot *snap)
+{
+	GamConnDataPtr conn;
+	GamListener *listener;
+
+	do {
+		conn = gam_connections_next(snap->conn_fd);
+		if (conn == NULL)
+			return FALSE;
+		snap->conn_fd = gam_connection_get_fd(conn);
+		listener = gam_connection_get_listener(conn);
+	} while (listener == NULL);
+
+	gam_snapshot_item(snap->out, &snap->first);
+	g_string_append_printf(snap->out, "{\"fd\": %d, \"pid\": %d, \"name\": ",
+			       snap->conn_fd, gam_listener_get_pid(listener));
+	gam_snapshot_string(snap->out, gam_listener_get_pidname(listener));
+	g_string_append(snap->out, ", \"subscriptions\": [");
+
+	snap->listener = listener;
+	snap->serial = gam_listener_get_serial(listener);
+	snap->cursor = gam_listener_peek_subscriptions(listener);
+	snap->first_sub = TRUE;
+	return TRUE;
+}
+
+/*
+ * Walks the subscriptions of the current listener, checking first that
+ * it is still there and didn't change since the last step.
+ */
+static void
+gam_snapshot_walk_listener(GamSnapshot *snap, guint *budget)
+{
+	GamConnDataPtr conn;
+
+	conn = gam_connections_next(snap->conn_fd - 1);
+	if ((conn == NULL) || (gam_connection_get_fd(conn) != snap->conn_fd) ||
+	    (gam_connection_get_listener(conn) != snap->listener) ||
+	    (gam_listener_get_serial(snap->listener) != snap->serial)) {
+		g_string_append(snap->out, "], \"complete\": false}");
+		snap->listener = NULL;
+		return;
+	}
+
+	while ((snap->cursor != NULL) && (*budget > 0)) {
+		gam_snapshot_item(snap->out, &snap->first_sub);
+		gam_subscription_snapshot(snap->cursor->data, snap->out);
+		snap->cursor = snap->cursor->next;
+		(*budget)--;
+	}
+	if (snap->cursor == NULL) {
+		g_string_append(snap->out, "], \"complete\": true}");
+		snap->listener = NULL;
+	}
+}
+
+static void
+gam_snapshot_free(GamSnapshot *snap)
+{
+	GList *l;
+
+	for (l = snap->keys; l != NULL; l = l->next)
+		g_free(l->data);
+	g_list_free(snap->keys);
+	if (snap->fd >= 0)
+		close(snap->fd);
+	g_string_free(snap->out, TRUE);
+	g_free(snap->tmp);
+	g_free(snap->path);
+	g_free(snap);
+}
+
+static gboolean
+gam_snapshot_flush(GamSnapshot *snap)
+{
+	gsize written = 0;
+	ssize_t ret;
+
+	while (written < snap->out->len) {
+		ret = write(snap->fd, snap->out->str + written,
+			    snap->out->len - written);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		written += ret;
+	}
+	g_string_truncate(snap->out, 0);
+	return TRUE;
+}
+
+static gboolean
+gam_snapshot_step(gpointer data)
+{
+	GamSnapshot *snap = data;
+	guint budget = GAM_SNAPSHOT_BUDGET;
+
+	while ((budget > 0) && (snap->phase != GAM_SNAPSHOT_DONE)) {
+		switch (snap->phase) {
+		case GAM_SNAPSHOT_HEAD:
+			g_string_append_printf(snap->out,
+					       "{\n  \"pid\": %d,\n  \"time\": %ld,\n",
+					       (int) getpid(), (long) time(NULL));
+			gam_snapshot_stats(snap->out);
+			g_string_append(snap->out, "  \"listeners\": [");
+			snap->first = TRUE;
+			snap->phase = GAM_SNAPSHOT_LISTENERS;
+			budget--;
+			break;
+		case GAM_SNAPSHOT_LISTENERS:
+			if (snap->listener != NULL) {
+				gam_snapshot_walk_listener(snap, &budget);
+			} else if (gam_snapshot_next_listener(snap)) {
+				budget--;
+			} else {
+				g_string_append(snap->out,
+						"\n  ],\n  \"watched_dirs\": [");
+				snap->first = TRUE;
+				snap->phase = GAM_SNAPSHOT_DIRS;
+			}
+			break;
+		case GAM_SNAPSHOT_DIRS:
+#ifdef ENABLE_INOTIFY
+			if (gam_inotify_is_running()) {
+				snap->wd = gam_inotify_snapshot_dirs(snap->out,
+						snap->wd, &budget, &snap->first);
+				if (snap->wd >= 0)
+					break;
+			}
+#endif
+#ifdef ENABLE_FANOTIFY
+			if (gam_fanotify_is_running()) {
+				if (!snap->keys_taken) {
+					snap->keys = gam_fanotify_snapshot_keys();
+					snap->keys_taken = TRUE;
+					budget--;
+				}
+				snap->keys = gam_fanotify_snapshot_dirs(snap->out,
+						snap->keys, &budget, &snap->first);
+				if (snap->keys != NULL)
+					break;
+			}
+#endif
+			g_string_append(snap->out, "\n  ],\n  \"missing\": [");
+			snap->first = TRUE;
+			snap->phase = GAM_SNAPSHOT_MISSING;
+			break;
+		case GAM_SNAPSHOT_MISSING:
+#ifdef ENABLE_INOTIFY
+			if (gam_inotify_is_running()) {
+				snap->missing = gam_inotify_snapshot_missing(snap->out,
+						snap->missing, &budget, &snap->first);
+				if (snap->missing >= 0)
+					break;
+			}
+#endif
+			g_string_append(snap->out, "\n  ]\n}\n");
+			snap->phase = GAM_SNAPSHOT_DONE;
+			budget--;
+			break;
+		case GAM_SNAPSHOT_DONE:
+			break;
+		}
+	}
+
+	if (!gam_snapshot_flush(snap)) {
+		gam_error(DEBUG_INFO, "Failed to write the snapshot %s\n",
+			  snap->tmp);
+		unlink(snap->tmp);
+	} else if (snap->phase != GAM_SNAPSHOT_DONE) {
+		return TRUE;
+	} else if (rename(snap->tmp, snap->path) < 0) {
+		gam_error(DEBUG_INFO, "Failed to rename the snapshot to %s\n",
+			  snap->path);
+		unlink(snap->tmp);
+	} else {
+		GAM_DEBUG(DEBUG_INFO, "Wrote the snapshot %s\n", snap->path);
+	}
+
+	gam_snapshot_free(snap);
+	snapshot = NULL;
+	return FALSE;
+}
+
+/**
+ * gam_snapshot_start:
+ *
+ * Starts writing a snapshot of the server state, unless one is already
+ * being written. Any previous snapshot is removed first, the file
+ * appears once complete.
+ *
+ * Returns the path of the snapshot, or NULL in case of error.
+ */
+const char *
+gam_snapshot_start(void)
+{
+	GamSnapshot *snap;
+	char *dir;
+
+	if (snapshot != NULL)
+		return snapshot->path;
+
+	dir = gam_get_state_dir();
+	if (dir == NULL)
+		return NULL;
+
+	snap = g_new0(GamSnapshot, 1);
+	snap->path = g_strdup_printf("%s/gamin-state-%d.json", dir,
+				     (int) getpid());
+	snap->tmp = g_strconcat(snap->path, ".tmp", NULL);
+	g_free(dir);
+
+	snap->out = g_string_new(NULL);
+	snap->conn_fd = -1;
+
+	unlink(snap->path);
+	snap->fd = open(snap->tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+			0600);
+	if (snap->fd < 0) {
+		gam_error(DEBUG_INFO, "Failed to create the snapshot %s\n",
+			  snap->tmp);
+		gam_snapshot_free(snap);
+		return NULL;
+	}
+	snap->phase = GAM_SNAPSHOT_HEAD;
+
+	GAM_DEBUG(DEBUG_INFO, "Writing a snapshot to %s\n", snap->path);
+	snapshot = snap;
+	g_idle_add_full(G_PRIORITY_LOW, gam_snapshot_step, snap, NULL);
+	return snap->path;
+}
@@ -0,0 +1,20 @@
+#ifndef __GAM_SNAPSHOT_H__
+#define __GAM_SNAPSHOT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* How many entries are serialized each time the main loop is idle */
+#define GAM_SNAPSHOT_BUDGET	1000
+
+const char *	gam_snapshot_start		(void);
+
+void		gam_snapshot_string		(GString *out,
+						 const char *str);
+void		gam_snapshot_item		(GString *out,
+						 gboolean *first);
+
+G_END_DECLS
+
+#endif /* __GAM_SNAPSHOT_H__ */
@@ -0,0 +1,262 @@
+/* Gamin
+ * Copyright (C) 2004 Daniel Veillard, Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Runtime statistics of the server, as sent back to a GAM_REQ_STATS.
+ * Each module keeps its own counters and reports them as "name value"
+ * lines, the same way they all dump their state from gam_show_debug().
+ *
+ * Events coming from the kernel are also timed through the server: the
+ * backend stamps them when read and sets that time as the origin of
+ * whatever it emits while handling them, the connection queues keep it
+ * with each event until it is written out.
+ */
+
+#include "server_config.h"
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "gam_connection.h"
+#include "gam_poll_generic.h"
+#include "gam_stats.h"
+#ifdef ENABLE_INOTIFY
+#include "gam_inotify.h"
+#endif
+#ifdef ENABLE_FANOTIFY
+#include "gam_fanotify.h"
+#endif
+
+#define GAM_HISTOGRAM_MAX_MSB	40
+
+static const char *stage_names[GAM_LATENCY_STAGES] = {
+	"kernel_queue",
+	"hold",
+	"dispatch",
+	"client_queue",
+	"write",
+	"total"
+};
+
+static GamHistogram latencies[GAM_LATENCY_STAGES];
+static gint64 current_origin = 0;
+
+/**
+ * gam_stats_add:
+ * @out: the statistics being collected
+ * @name: the name of the counter
+ * @value: its value
+ *
+ * Appends one counter to the statistics.
+ */
+void
+gam_stats_add(GString *out, const char *name, gulong value)
+{
+	g_string_append_printf(out, "%s %lu\n", name, value);
+}
+
+/**
+ * gam_stats_now:
+ *
+ * Returns the time in microseconds on a clock which doesn't jump,
+ * only to be compared with other values from this function.
+ */
+gint64
+gam_stats_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((gint64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return ((gint64) tv.tv_sec * 1000000 + tv.tv_usec);
+	}
+}
+
+/**
+ * gam_stats_set_origin:
+ * @origin: when the kernel event being handled was read, or 0
+ *
+ * Sets the origin of the events emitted from now on, the backends
+ * reset it to 0 once done with a kernel event.
+ */
+void
+gam_stats_set_origin(gint64 origin)
+{
+	current_origin = origin;
+}
+
+/**
+ * gam_stats_get_origin:
+ *
+ * Returns when the kernel event being handled was read, 0 if the
+ * events emitted now don't come from one.
+ */
+gint64
+gam_stats_get_origin(void)
+{
+	return current_origin;
+}
+
+/**
+ * gam_stats_latency:
+ * @stage: the stage the event went through
+ * @start: when it entered it, 0 if unknown
+ * @end: when it left it
+ *
+ * Accounts for the time an event spent in a stage.
+ */
+void
+gam_stats_latency(GamLatencyStage stage, gint64 start, gint64 end)
+{
+	if ((start == 0) || (stage >= GAM_LATENCY_STAGES))
+		return;
+	gam_histogram_add(&latencies[stage], end - start);
+}
+
+static guint
+gam_histogram_bucket(guint64 value)
+{
+	guint msb = 0;
+
+	if (value < 8)
+		return (guint) value;
+	while ((msb < 63) && ((value >> (msb + 1)) != 0))
+		msb++;
+	if (msb > GAM_HISTOGRAM_MAX_MSB)
+		return GAM_HISTOGRAM_BUCKETS - 1;
+	return (msb - 2) * 8 + ((value >> (msb - 3)) & 7);
+}
+
+/* the highest value falling in a bucket */
+static guint64
+gam_histogram_bucket_max(guint idx)
+{
+	guint msb, sub;
+
+	if (idx < 8)
+		return idx;
+	msb = idx / 8 + 2;
+	sub = idx % 8;
+	return ((guint64) (9 + sub) << (msb - 3)) - 1;
+}
+
+/**
+ * gam_histogram_add:
+ * @hist: the histogram
+ * @value: a latency in microseconds
+ *
+ * Records one value in a histogram.
+ */
+void
+gam_histogram_add(GamHistogram *hist, gint64 value)
+{
+	if (value < 0)
+		value = 0;
+	hist->buckets[gam_histogram_bucket(value)]++;
+	hist->count++;
+}
+
+/**
+ * gam_histogram_percentile:
+ * @hist: the histogram
+ * @fraction: the percentile wanted, 0.99 for p99
+ *
+ * Returns the upper bound of the bucket holding the percentile, 0 if
+ * nothing was recorded.
+ */
+gint64
+gam_histogram_percentile(const GamHistogram *hist, double fraction)
+{
+	gulong rank, seen = 0;
+	guint i;
+
+	if (hist->count == 0)
+		return 0;
+	rank = (gulong) (fraction * hist->count);
+	if ((double) rank < fraction * hist->count)
+		rank++;
+	if (rank == 0)
+		rank = 1;
+	for (i = 0; i < GAM_HISTOGRAM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			return gam_histogram_bucket_max(i);
+	}
+	return gam_histogram_bucket_max(GAM_HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+ * gam_stats_add_histogram:
+ * @out: the statistics being collected
+ * @prefix: the name of the histogram
+ * @hist: the histogram
+ *
+ * Appends the count, p50, p99 and p999 of a histogram to the
+ * statistics, in microseconds.
+ */
+void
+gam_stats_add_histogram(GString *out, const char *prefix,
+			const GamHistogram *hist)
+{
+	g_string_append_printf(out, "%s.count %lu\n", prefix, hist->count);
+	g_string_append_printf(out, "%s.p50 %" G_GINT64_FORMAT "\n", prefix,
+			       gam_histogram_percentile(hist, 0.5));
+	g_string_append_printf(out, "%s.p99 %" G_GINT64_FORMAT "\n", prefix,
+			       gam_histogram_percentile(hist, 0.99));
+	g_string_append_printf(out, "%s.p999 %" G_GINT64_FORMAT "\n", prefix,
+			       gam_histogram_percentile(hist, 0.999));
+}
+
+/**
+ * gam_stats_collect:
+ *
+ * Gathers the statistics of all the modules.
+ *
+ * Returns a newly allocated string of "name value" lines.
+ */
+GString *
+gam_stats_collect(void)
+{
+	GString *out;
+	char name[64];
+	int i;
+
+	out = g_string_new(NULL);
+	gam_connections_stats(out);
+#ifdef ENABLE_FANOTIFY
+	if (gam_fanotify_is_running())
+		gam_fanotify_stats(out);
+#endif
+#ifdef ENABLE_INOTIFY
+	if (gam_inotify_is_running())
+		gam_inotify_stats(out);
+#endif
+	gam_poll_generic_stats(out);
+
+	for (i = 0; i < GAM_LATENCY_STAGES; i++) {
+		snprintf(name, sizeof(name), "latency.%s", stage_names[i]);
+		gam_stats_add_histogram(out, name, &latencies[i]);
+	}
+	return out;
+}
@@ -0,0 +1,53 @@
+#ifndef __GAM_STATS_H__
+#define __GAM_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Latencies are kept in log-bucketed histograms: values under 8 have a
+ * bucket each, then every power of two is split in 8, which keeps the
+ * error on a percentile under 12.5% up to 2^40 microseconds.
+ */
+#define GAM_HISTOGRAM_BUCKETS	312
+
+typedef struct {
+	gulong count;
+	gulong buckets[GAM_HISTOGRAM_BUCKETS];
+} GamHistogram;
+
+/* The stages an event goes through, from the kernel to the client */
+typedef enum {
+	GAM_LATENCY_KERNEL_QUEUE = 0,	/* read until out of events_to_process */
+	GAM_LATENCY_HOLD,		/* in event_queue until dispatched */
+	GAM_LATENCY_DISPATCH,		/* read until queued for the client */
+	GAM_LATENCY_CLIENT_QUEUE,	/* in the connection queue */
+	GAM_LATENCY_WRITE,		/* writing to the socket */
+	GAM_LATENCY_TOTAL,		/* read until written to the socket */
+	GAM_LATENCY_STAGES
+} GamLatencyStage;
+
+void		gam_stats_add			(GString *out,
+						 const char *name,
+						 gulong value);
+GString *	gam_stats_collect		(void);
+
+gint64		gam_stats_now			(void);
+void		gam_stats_set_origin		(gint64 origin);
+gint64		gam_stats_get_origin		(void);
+void		gam_stats_latency		(GamLatencyStage stage,
+						 gint64 start,
+						 gint64 end);
+
+void		gam_histogram_add		(GamHistogram *hist,
+						 gint64 value);
+gint64		gam_histogram_percentile	(const GamHistogram *hist,
+						 double fraction);
+void		gam_stats_add_histogram		(GString *out,
+						 const char *prefix,
+						 const GamHistogram *hist);
+
+G_END_DECLS
+
+#endif /* __GAM_STATS_H__ */
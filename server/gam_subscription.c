@@ -27,23 +27,107 @@
 #include "gam_protocol.h"
 #include "gam_event.h"
 #include "gam_error.h"
+#include "gam_excludes.h"
+#include "gam_snapshot.h"
 
 //#define GAM_SUB_VERBOSE
 
-struct _GamSubscription {
+/*
+ * Subscriptions on the same path, of the same kind and with the same
+ * options make the same decision for any event: they share a group
+ * which holds the path and remembers the decision for the event being
+ * emitted, so that hundreds of clients watching one directory cost a
+ * single path comparison per event.
+ */
+struct _GamSubscriptionGroup {
     char *path;
+    int pathlen;
+    gboolean is_dir;
+    int options;
+    guint refcount;
+
+    guint serial;		/* emission the offset below was computed for */
+    int offset;			/* of the reported name in the path, or -1 */
+};
+
+struct _GamSubscription {
+    char *path;			/* owned by the group */
     int events;
     int reqno;
     int pathlen;
     int options;
+    GamSubscriptionGroup *group;
 
     gboolean is_dir;
     gboolean cancelled;
 
+    guint exclude_serial;	/* cached gam_exclude_check() of path */
+    gboolean excluded;
+
     GamListener *listener;
+    GamResource resource;	/* accounted to the listener */
 };
 
 
+static GHashTable *groups = NULL;
+
+static guint
+gam_subscription_group_hash(gconstpointer key)
+{
+    const GamSubscriptionGroup *group = key;
+
+    return (g_str_hash(group->path) ^ (group->options << 1) ^
+            (group->is_dir != 0));
+}
+
+static gboolean
+gam_subscription_group_equal(gconstpointer a, gconstpointer b)
+{
+    const GamSubscriptionGroup *ga = a;
+    const GamSubscriptionGroup *gb = b;
+
+    return ((ga->is_dir == gb->is_dir) && (ga->options == gb->options) &&
+            (ga->pathlen == gb->pathlen) && (!strcmp(ga->path, gb->path)));
+}
+
+static GamSubscriptionGroup *
+gam_subscription_group_ref(const char *path, gboolean is_dir, int options)
+{
+    GamSubscriptionGroup key, *group;
+
+    if (groups == NULL)
+        groups = g_hash_table_new(gam_subscription_group_hash,
+                                  gam_subscription_group_equal);
+
+    key.path = (char *) path;
+    key.pathlen = strlen(path);
+    key.is_dir = is_dir ? TRUE : FALSE;
+    key.options = options;
+
+    group = g_hash_table_lookup(groups, &key);
+    if (group == NULL) {
+        group = g_new0(GamSubscriptionGroup, 1);
+        group->path = g_strdup(path);
+        group->pathlen = key.pathlen;
+        group->is_dir = key.is_dir;
+        group->options = options;
+        group->offset = -1;
+        g_hash_table_insert(groups, group, group);
+    }
+    group->refcount++;
+    return group;
+}
+
+static void
+gam_subscription_group_unref(GamSubscriptionGroup *group)
+{
+    if (--group->refcount > 0)
+        return;
+    g_hash_table_remove(groups, group);
+    g_free(group->path);
+    g_free(group);
+}
+
 /**
  * @defgroup GamSubscription GamSubscription
  * @ingroup Daemon
@@ -72,10 +156,11 @@ gam_subscription_new(const char *path,
     GamSubscription *sub;
 
     sub = g_new0(GamSubscription, 1);
-    sub->path = g_strdup(path);
+    sub->group = gam_subscription_group_ref(path, is_dir, options);
+    sub->path = sub->group->path;
     sub->events = events;
     sub->reqno = reqno;
-    sub->pathlen = strlen(path);
+    sub->pathlen = sub->group->pathlen;
 
     /* everyone accepts this */
     gam_subscription_set_event(sub, GAMIN_EVENT_EXISTS | GAMIN_EVENT_ENDEXISTS);
@@ -103,7 +188,7 @@ gam_subscription_free(GamSubscription * sub)
     GAM_DEBUG(DEBUG_INFO, "Freeing subscription for %s\n", sub->path);
 #endif
 
-    g_free(sub->path);
+    gam_subscription_group_unref(sub->group);
     g_free(sub);
 }
 
@@ -121,6 +206,37 @@ gam_subscription_is_dir(GamSubscription * sub)
     return sub->is_dir;
 }
 
+/**
+ * Gets the group of a GamSubscription, shared with all the
+ * subscriptions on the same path with the same type and options
+ *
+ * @param sub the GamSubscription
+ * @returns the group
+ */
+GamSubscriptionGroup *
+gam_subscription_get_group(GamSubscription * sub)
+{
+    if (sub == NULL)
+        return(NULL);
+    return sub->group;
+}
+
+/**
+ * Tells if the path of a GamSubscription is excluded from kernel
+ * monitoring, the answer is cached on the subscription
+ *
+ * @param sub the GamSubscription
+ * @returns TRUE if the path should not be monitored by the kernel
+ */
+gboolean
+gam_subscription_is_excluded(GamSubscription * sub)
+{
+    if (sub == NULL)
+        return(FALSE);
+    return gam_exclude_check_cached(sub->path, &sub->exclude_serial,
+                                    &sub->excluded);
+}
+
 /**
  * Provide the path len for a GamSubscription
  *
@@ -194,6 +310,34 @@ gam_subscription_set_listener(GamSubscription * sub,
     sub->listener = listener;
 }
 
+/**
+ * Gets what watches this GamSubscription for its listener
+ *
+ * @param sub the GamSubscription
+ * @returns the resource accounted to the listener
+ */
+GamResource
+gam_subscription_get_resource(GamSubscription * sub)
+{
+    if (sub == NULL)
+        return (GAM_RESOURCE_NONE);
+    return sub->resource;
+}
+
+/**
+ * Records what watches this GamSubscription for its listener
+ *
+ * @param sub the GamSubscription
+ * @param resource the resource accounted to the listener
+ */
+void
+gam_subscription_set_resource(GamSubscription * sub, GamResource resource)
+{
+    if (sub == NULL)
+        return;
+    sub->resource = resource;
+}
+
 /**
  * Set the events this GamSubscription is interested in
  *
@@ -278,6 +422,69 @@ gam_subscription_is_cancelled(GamSubscription * sub)
     return sub->cancelled == TRUE;
 }
 
+/**
+ * gam_subscription_group_filter:
+ * @group: the GamSubscriptionGroup
+ * @serial: the emission the event belongs to, 0 if not to be cached
+ * @path: the path of the event
+ * @pathlen: the length of @path
+ * @is_dir_node: is the target a directory
+ * @event: the event
+ * @force: force the event as much as possible
+ *
+ * Decides for all the subscriptions of a group whether they report a
+ * given path/event combination, and how. The answer is remembered for
+ * the other members until @serial changes. It doesn't account for the
+ * cancellation and the event mask of the individual subscriptions.
+ *
+ * Returns the offset in @path of the name to report, -1 if the
+ * combination isn't accepted.
+ */
+int
+gam_subscription_group_filter(GamSubscriptionGroup *group, guint serial,
+                              const char *path, int pathlen,
+                              int is_dir_node, GaminEventType event,
+                              int force)
+{
+    int same_path;
+    int offset = -1;
+
+    if ((serial != 0) && (group->serial == serial))
+        return(group->offset);
+
+    if ((group->options & GAM_OPT_NOEXISTS) &&
+        ((event == GAMIN_EVENT_EXISTS) ||
+	 (event == GAMIN_EVENT_ENDEXISTS)))
+	goto done;
+
+    /* only directory listening cares for other files */
+    same_path = (pathlen == group->pathlen) &&
+                (!memcmp(path, group->path, pathlen));
+    if ((group->is_dir == 0) && (!same_path))
+        goto done;
+
+    if ((!force) && (group->is_dir) && (is_dir_node) && (same_path)) {
+        if ((event == GAMIN_EVENT_EXISTS) ||
+	    (event == GAMIN_EVENT_CHANGED) ||
+	    (event == GAMIN_EVENT_ENDEXISTS))
+	    goto done;
+    }
+
+    /*
+     * When sending directory related entries, for items in the
+     * directory the FAM protocol removes the common direcory part.
+     */
+    offset = 0;
+    if ((group->is_dir) && (pathlen > group->pathlen + 1) &&
+        (path[group->pathlen] == '/'))
+        offset = group->pathlen + 1;
+
+done:
+    group->serial = serial;
+    group->offset = offset;
+    return(offset);
+}
+
 /**
  * gam_subscription_wants_event:
  * @sub: the GamSubscription
@@ -295,37 +502,38 @@ gam_subscription_wants_event(GamSubscription * sub,
                              const char *name, int is_dir_node, 
 			     GaminEventType event, int force)
 {
-    int same_path = 0;
-
     if ((sub == NULL) || (name == NULL) || (event == 0))
         return(FALSE);
     if (sub->cancelled)
         return FALSE;
 
-    if ((sub->options & GAM_OPT_NOEXISTS) &&
-        ((event == GAMIN_EVENT_EXISTS) ||
-	 (event == GAMIN_EVENT_ENDEXISTS)))
-	return FALSE;
-
-    /* only directory listening cares for other files */
-    same_path = !strcmp(name, sub->path);
-    if ((sub->is_dir == 0) && (!same_path))
-        return(FALSE);
-
     if (!gam_subscription_has_event(sub, event)) {
         return FALSE;
     }
 
-    if (force)
-        return TRUE;
-    if ((sub->is_dir) && (is_dir_node) && (same_path)) {
-        if ((event == GAMIN_EVENT_EXISTS) ||
-	    (event == GAMIN_EVENT_CHANGED) ||
-	    (event == GAMIN_EVENT_ENDEXISTS))
-	    return FALSE;
-    }
+    return (gam_subscription_group_filter(sub->group, 0, name, strlen(name),
+                                          is_dir_node, event, force) >= 0);
+}
 
-    return TRUE;
+/**
+ * gam_subscription_snapshot:
+ * @sub: the subscription
+ * @out: the JSON being built
+ *
+ * Appends the state of the subscription as a JSON object.
+ */
+void
+gam_subscription_snapshot(GamSubscription *sub, GString *out)
+{
+    static const char *resources[] = { "none", "kernel", "poll" };
+
+    g_string_append_printf(out, "{\"reqno\": %d, \"path\": ", sub->reqno);
+    gam_snapshot_string(out, sub->path);
+    g_string_append_printf(out, ", \"dir\": %s, \"options\": %d, "
+                           "\"cancelled\": %s, \"resource\": \"%s\"}",
+                           sub->is_dir ? "true" : "false", sub->options,
+                           sub->cancelled ? "true" : "false",
+                           resources[sub->resource]);
 }
 
 /**
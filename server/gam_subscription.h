@@ -8,6 +8,8 @@
 
 G_BEGIN_DECLS
 
+typedef struct _GamSubscriptionGroup GamSubscriptionGroup;
+
 GamSubscription     *gam_subscription_new          (const char *path,
 						    int         events,
 						    int         reqno,
@@ -17,6 +19,8 @@ GamSubscription     *gam_subscription_new          (const char *path,
 void                 gam_subscription_free         (GamSubscription *sub);
 
 gboolean             gam_subscription_is_dir       (GamSubscription *sub);
+GamSubscriptionGroup *gam_subscription_get_group   (GamSubscription *sub);
+gboolean             gam_subscription_is_excluded  (GamSubscription *sub);
 int                  gam_subscription_pathlen      (GamSubscription *sub);
 
 int                  gam_subscription_get_reqno    (GamSubscription *sub);
@@ -28,6 +32,10 @@ GamListener         *gam_subscription_get_listener (GamSubscription *sub);
 void                 gam_subscription_set_listener (GamSubscription *sub,
 						    GamListener     *listener);
 
+GamResource          gam_subscription_get_resource (GamSubscription *sub);
+void                 gam_subscription_set_resource (GamSubscription *sub,
+						    GamResource      resource);
+
 void                 gam_subscription_set_event    (GamSubscription *sub,
 						    int              event);
 void                 gam_subscription_unset_event  (GamSubscription *sub,
@@ -45,7 +53,16 @@ gboolean             gam_subscription_wants_event  (GamSubscription *sub,
 						    int          is_dir_node,
 						    GaminEventType   event,
 						    int force);
+int                  gam_subscription_group_filter (GamSubscriptionGroup *group,
+						    guint            serial,
+						    const char      *path,
+						    int              pathlen,
+						    int          is_dir_node,
+						    GaminEventType   event,
+						    int force);
 void                 gam_subscription_debug        (GamSubscription *sub);
+void                 gam_subscription_snapshot     (GamSubscription *sub,
+						    GString         *out);
 
 void				gam_subscription_shutdown ();
 
@@ -0,0 +1,222 @@
+/* Gamin
+ * Copyright (C) 2004 Daniel Veillard, Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The binary trace ring. Recording a record is an atomic increment and
+ * a copy of at most 64 bytes, from any thread; the inotify readers may
+ * record concurrently with the main loop. Nothing serializes the dump
+ * against them, so a record being written at that very moment may be
+ * torn, which the decoder can live with.
+ *
+ * The dump only uses async-signal-safe calls as it is also done from
+ * the handler of the fatal signals, the path is computed beforehand.
+ */
+
+#include "server_config.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/param.h>
+#include <glib.h>
+#include "gam_error.h"
+#include "gam_channel.h"
+#include "gam_stats.h"
+#include "gam_trace.h"
+
+static GamTraceRecord trace_ring[GAM_TRACE_RECORDS];
+static volatile gint trace_next = 0;	/* the next record, never wrapped */
+static volatile gboolean trace_full = FALSE;
+static char trace_path[MAXPATHLEN] = "";
+
+static const int trace_signals[] = {
+	SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT
+};
+
+/**
+ * gam_trace:
+ * @id: what happened
+ * @a, @b, @c, @d: the integer arguments of the record, see GamTraceId
+ * @path: a path or file name, or NULL
+ *
+ * Appends a record to the trace ring, overwriting the oldest one when
+ * it is full. Use GAM_TRACE() rather than calling this directly.
+ */
+void
+gam_trace(GamTraceId id, gint32 a, gint32 b, gint32 c, gint32 d,
+	  const char *path)
+{
+	GamTraceRecord *rec;
+	guint index;
+	size_t len;
+
+#if GLIB_CHECK_VERSION(2,30,0)
+	index = (guint) g_atomic_int_add(&trace_next, 1);
+#else
+	index = (guint) g_atomic_int_exchange_and_add(&trace_next, 1);
+#endif
+	if (index == GAM_TRACE_RECORDS - 1)
+		trace_full = TRUE;
+
+	rec = &trace_ring[index & (GAM_TRACE_RECORDS - 1)];
+	rec->time = gam_stats_now();
+	rec->id = id;
+	rec->args[0] = a;
+	rec->args[1] = b;
+	rec->args[2] = c;
+	rec->args[3] = d;
+	if (path == NULL) {
+		rec->len = 0;
+		return;
+	}
+	len = strlen(path);
+	rec->len = (len > G_MAXUINT16) ? G_MAXUINT16 : len;
+	if (len > GAM_TRACE_TAIL) {
+		path += len - GAM_TRACE_TAIL;
+		len = GAM_TRACE_TAIL;
+	}
+	memcpy(rec->tail, path, len);
+}
+
+static gboolean
+gam_trace_write_all(int fd, const void *buf, size_t len)
+{
+	const char *cur = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, cur, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		cur += ret;
+		len -= ret;
+	}
+	return TRUE;
+}
+
+/*
+ * Writes the ring to trace_path, oldest record first. @sig is the fatal
+ * signal being handled or 0.
+ */
+static gboolean
+gam_trace_write(int sig)
+{
+	GamTraceHeader header;
+	struct timeval tv;
+	guint next, start;
+	gboolean ret;
+	int fd;
+
+	if (trace_path[0] == 0)
+		return FALSE;
+	fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+	if (fd < 0)
+		return FALSE;
+
+	next = (guint) g_atomic_int_get(&trace_next);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GAM_TRACE_MAGIC, sizeof(header.magic));
+	header.version = GAM_TRACE_VERSION;
+	header.record_size = sizeof(GamTraceRecord);
+	if (trace_full) {
+		header.records = GAM_TRACE_RECORDS;
+		header.lost = next - GAM_TRACE_RECORDS;
+		start = next & (GAM_TRACE_RECORDS - 1);
+	} else {
+		header.records = next;
+		start = 0;
+	}
+	header.now = gam_stats_now();
+	gettimeofday(&tv, NULL);
+	header.wall = (gint64) tv.tv_sec * 1000000 + tv.tv_usec;
+	header.pid = getpid();
+	header.signal = sig;
+
+	ret = gam_trace_write_all(fd, &header, sizeof(header));
+	if ((ret) && (trace_full)) {
+		ret = gam_trace_write_all(fd, &trace_ring[start],
+			(GAM_TRACE_RECORDS - start) * sizeof(GamTraceRecord));
+		if (ret)
+			ret = gam_trace_write_all(fd, &trace_ring[0],
+					start * sizeof(GamTraceRecord));
+	} else if (ret) {
+		ret = gam_trace_write_all(fd, &trace_ring[0],
+					  next * sizeof(GamTraceRecord));
+	}
+	close(fd);
+	return ret;
+}
+
+static void
+gam_trace_crash(int sig)
+{
+	gam_trace_write(sig);
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/**
+ * gam_trace_init:
+ *
+ * Decides where the trace is dumped and arranges for it to be dumped
+ * if the server crashes. Recording works without it.
+ */
+void
+gam_trace_init(void)
+{
+	char *dir;
+	unsigned int i;
+
+	dir = gam_get_state_dir();
+	if (dir == NULL) {
+		GAM_DEBUG(DEBUG_INFO, "No directory to dump the trace to\n");
+		return;
+	}
+	g_snprintf(trace_path, sizeof(trace_path), "%s/gamin-trace-%d.bin",
+		   dir, (int) getpid());
+	g_free(dir);
+
+	for (i = 0; i < G_N_ELEMENTS(trace_signals); i++)
+		signal(trace_signals[i], gam_trace_crash);
+}
+
+/**
+ * gam_trace_dump:
+ *
+ * Writes the content of the trace ring to gamin-trace-<pid>.bin in the
+ * socket directory, recording goes on meanwhile.
+ *
+ * Returns the path of the dump, or NULL in case of error.
+ */
+const char *
+gam_trace_dump(void)
+{
+	if (!gam_trace_write(0)) {
+		gam_error(DEBUG_INFO, "Failed to dump the trace to %s\n",
+			  trace_path);
+		return (NULL);
+	}
+	GAM_DEBUG(DEBUG_INFO, "Dumped the trace to %s\n", trace_path);
+	return (trace_path);
+}
@@ -0,0 +1,81 @@
+#ifndef __GAM_TRACE_H__
+#define __GAM_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * An always-on binary log of what the server does, see doc/trace.txt.
+ *
+ * A GAM_TRACE() stores a timestamp, a record id, up to four integers
+ * and the end of a path in a fixed ring in memory; nothing is formatted
+ * so it doesn't change the timing of the server. The ring is written to
+ * gamin-trace-<pid>.bin on SIGUSR2 or when the server crashes, and is
+ * decoded offline by gamin-trace.
+ */
+
+#define GAM_TRACE_MAGIC		"GAMTRACE"
+#define GAM_TRACE_VERSION	1
+
+/* Number of records kept, a power of two */
+#define GAM_TRACE_RECORDS	16384
+
+/* How many bytes from the end of a path are kept */
+#define GAM_TRACE_TAIL		36
+
+/* The arguments of each record, keep gamin-trace.c in sync */
+typedef enum {
+	GAM_TRACE_NONE = 0,
+	GAM_TRACE_CONN_OPEN,	/* fd */
+	GAM_TRACE_CONN_CLOSE,	/* fd, pid */
+	GAM_TRACE_REQUEST,	/* fd, pid, type, seq; path */
+	GAM_TRACE_DELIVER,	/* fd, reqno, event; path */
+	GAM_TRACE_QUEUE,	/* fd, reqno, event, coalesced; path */
+	GAM_TRACE_FLUSH,	/* fd, events */
+	GAM_TRACE_SEND,		/* fd, reqno, type, len */
+	GAM_TRACE_SEND_FAILED,	/* fd, reqno */
+	GAM_TRACE_READ,		/* events, bytes */
+	GAM_TRACE_DISPATCH,	/* wd, mask, cookie; name */
+	GAM_TRACE_POLL_STAT,	/* result; path */
+	GAM_TRACE_LAST
+} GamTraceId;
+
+/* 64 bytes, one cache line */
+typedef struct {
+	gint64 time;		/* gam_stats_now(), in microseconds */
+	guint16 id;		/* a GamTraceId */
+	guint16 len;		/* the length of the whole path */
+	gint32 args[4];
+	char tail[GAM_TRACE_TAIL];	/* its last bytes, not terminated */
+} GamTraceRecord;
+
+/* At the start of a dump, followed by the records oldest first */
+typedef struct {
+	char magic[8];
+	guint32 version;
+	guint32 record_size;
+	guint32 records;	/* how many records follow */
+	guint32 lost;		/* older records overwritten in the ring */
+	gint64 now;		/* gam_stats_now() at the time of the dump */
+	gint64 wall;		/* the time of day then, in microseconds */
+	guint32 pid;
+	guint32 signal;		/* the fatal signal, 0 for SIGUSR2 */
+} GamTraceHeader;
+
+void		gam_trace_init		(void);
+void		gam_trace		(GamTraceId id,
+					 gint32 a,
+					 gint32 b,
+					 gint32 c,
+					 gint32 d,
+					 const char *path);
+const char *	gam_trace_dump		(void);
+
+#define GAM_TRACE(id, a, b, c, d, path)	\
+	gam_trace(GAM_TRACE_##id, (gint32) (a), (gint32) (b), \
+		  (gint32) (c), (gint32) (d), (path))
+
+G_END_DECLS
+
+#endif /* __GAM_TRACE_H__ */
@@ -26,13 +26,19 @@
 #include "gam_node.h"
 
 
-#define NODE_DATA(x) (GamNode *)x->data
+/*
+ * The tree is a trie of path components: each node has a list of its
+ * children in insertion order and, once it has more than a few, a hash
+ * of them by name. Lookups and inserts cost one step per component of
+ * the path, listing the children of a node costs their number.
+ */
+#define GAM_TREE_HASH_THRESHOLD 8
 
 struct _GamTree {
-    GNode *root;                /* The root of the tree, which is always a node
+    GamNode *root;              /* The root of the tree, which is always a node
                                  * representing /
                                  */
-    GHashTable *node_hash;      /* a hash table that maps path->node */
+    guint size;                 /* number of nodes below the root */
 };
 
 typedef struct {
@@ -40,15 +46,98 @@ typedef struct {
     GList *list;
 } SubSearchData;
 
-static GNode *
-new_node(GamNode * node)
+static GamNode *
+gam_tree_lookup_child(GamNode * parent, const char *name, gsize len)
 {
-    GNode *gnode;
+    GamNode *child;
+    char buf[256];
+    char *key;
+
+    if (parent->child_hash != NULL) {
+        if (len < sizeof(buf)) {
+            memcpy(buf, name, len);
+            buf[len] = 0;
+            return g_hash_table_lookup(parent->child_hash, buf);
+        }
+        key = g_strndup(name, len);
+        child = g_hash_table_lookup(parent->child_hash, key);
+        g_free(key);
+        return child;
+    }
 
-    gnode = g_node_new(node);
-    node->node = gnode;
+    for (child = parent->children; child != NULL; child = child->next) {
+        if ((!strncmp(child->name, name, len)) && (child->name[len] == 0))
+            return child;
+    }
+    return NULL;
+}
 
-    return gnode;
+static void
+gam_tree_link(GamNode * parent, GamNode * child)
+{
+    GamNode *cur;
+
+    child->parent = parent;
+    child->next = NULL;
+    child->prev = parent->last_child;
+    if (parent->last_child)
+        parent->last_child->next = child;
+    else
+        parent->children = child;
+    parent->last_child = child;
+    parent->n_children++;
+
+    if (parent->child_hash != NULL) {
+        g_hash_table_insert(parent->child_hash, (gpointer) child->name, child);
+    } else if (parent->n_children > GAM_TREE_HASH_THRESHOLD) {
+        parent->child_hash = g_hash_table_new(g_str_hash, g_str_equal);
+        for (cur = parent->children; cur != NULL; cur = cur->next)
+            g_hash_table_insert(parent->child_hash, (gpointer) cur->name, cur);
+    }
+}
+
+static void
+gam_tree_unlink(GamNode * node)
+{
+    GamNode *parent = node->parent;
+
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        parent->children = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        parent->last_child = node->prev;
+    parent->n_children--;
+
+    if (parent->child_hash != NULL) {
+        g_hash_table_remove(parent->child_hash, node->name);
+        if (parent->n_children == 0) {
+            g_hash_table_destroy(parent->child_hash);
+            parent->child_hash = NULL;
+        }
+    }
+    node->parent = node->prev = node->next = NULL;
+}
+
+/* Releases the links below @node, the nodes themselves are not freed */
+static void
+gam_tree_release(GamNode * node)
+{
+    GamNode *child, *next;
+
+    for (child = node->children; child != NULL; child = next) {
+        next = child->next;
+        gam_tree_release(child);
+        child->parent = child->prev = child->next = NULL;
+    }
+    node->children = node->last_child = NULL;
+    node->n_children = 0;
+    if (node->child_hash != NULL) {
+        g_hash_table_destroy(node->child_hash);
+        node->child_hash = NULL;
+    }
 }
 
 
@@ -74,9 +163,7 @@ gam_tree_new(void)
     GamTree *tree;
 
     tree = g_new0(GamTree, 1);
-    tree->root = new_node(gam_node_new("/", NULL, TRUE));
-    tree->node_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                            g_free, NULL);
+    tree->root = gam_node_new("/", NULL, TRUE);
 
     return tree;
 }
@@ -89,8 +176,7 @@ gam_tree_new(void)
 void
 gam_tree_free(GamTree * tree)
 {
-    g_node_destroy(tree->root);
-    g_hash_table_destroy(tree->node_hash);
+    gam_tree_release(tree->root);
 
     g_free(tree);
 }
@@ -106,17 +192,11 @@ gam_tree_free(GamTree * tree)
 gboolean
 gam_tree_add(GamTree * tree, GamNode * parent, GamNode * child)
 {
-    GNode *node;
-
-
-    if (g_hash_table_lookup(tree->node_hash, gam_node_get_path(child)))
+    if (gam_tree_lookup_child(parent, child->name, strlen(child->name)))
         return FALSE;           /* lock ??? */
 
-    node = new_node(child);
-    g_node_append(parent->node, node);
-    g_hash_table_insert(tree->node_hash,
-                        g_strdup(gam_node_get_path(child)), node);
-
+    gam_tree_link(parent, child);
+    tree->size++;
 
     return TRUE;
 }
@@ -134,13 +214,12 @@ gam_tree_remove(GamTree * tree, GamNode * node)
     gboolean ret = FALSE;
 
 
-    if (g_node_is_ancestor(tree->root, node->node)) {
+    if (node->parent != NULL) {
 
-        g_assert(g_node_first_child(node->node) == NULL);
+        g_assert(node->children == NULL);
 
-        g_hash_table_remove(tree->node_hash, gam_node_get_path(node));
-        g_node_unlink(node->node);
-        g_node_destroy(node->node);
+        gam_tree_unlink(node);
+        tree->size--;
         gam_node_free(node);
         ret = TRUE;
     }
@@ -160,16 +239,28 @@ gam_tree_remove(GamTree * tree, GamNode * node)
 GamNode *
 gam_tree_get_at_path(GamTree * tree, const char *path)
 {
-    GNode *node;
+    GamNode *node;
+    const char *cur, *end;
 
     g_return_val_if_fail(tree != NULL, NULL);
     g_return_val_if_fail(path != NULL, NULL);
 
-    node = g_hash_table_lookup(tree->node_hash, path);
-    if (node)
-        return NODE_DATA(node);
-    else
+    if (path[0] != '/')
         return NULL;
+
+    node = tree->root;
+    if (path[1] == 0)
+        return node;
+
+    for (cur = path + 1; ; cur = end + 1) {
+        end = strchr(cur, '/');
+        if (end == NULL)
+            end = cur + strlen(cur);
+
+        node = gam_tree_lookup_child(node, cur, end - cur);
+        if ((node == NULL) || (*end == 0))
+            return node;
+    }
 }
 
 /**
@@ -190,7 +281,7 @@ gam_tree_add_at_path(GamTree * tree, const char *path, gboolean is_dir)
 {
     GamNode *parent;
     GamNode *node;
-    unsigned int i;
+    const char *cur, *end;
     char *path_cpy;
 
     g_return_val_if_fail(strlen(path) > 0, NULL);
@@ -201,35 +292,23 @@ gam_tree_add_at_path(GamTree * tree, const char *path, gboolean is_dir)
     if (g_file_test(path, G_FILE_TEST_EXISTS))
         is_dir = g_file_test(path, G_FILE_TEST_IS_DIR);
 
-    path_cpy = g_strdup(path);
-
-    parent = NODE_DATA(tree->root);
+    parent = tree->root;
     g_assert(parent != NULL);
 
-    for (i = 1; i < strlen(path_cpy); i++) {
-        GamNode *new_parent;
-
-        if (path_cpy[i] == '/') {
-            path_cpy[i] = '\0';
-            new_parent = gam_tree_get_at_path(tree, path_cpy);
-
-            if (new_parent) {
-                parent = new_parent;
-            } else {
-                new_parent = gam_node_new(path_cpy, NULL, TRUE);
-                gam_tree_add(tree, parent, new_parent);
-                parent = new_parent;
-            }
-
-            path_cpy[i] = '/';
+    for (cur = path + 1; (end = strchr(cur, '/')) != NULL; cur = end + 1) {
+        node = gam_tree_lookup_child(parent, cur, end - cur);
+        if (node == NULL) {
+            path_cpy = g_strndup(path, end - path);
+            node = gam_node_new(path_cpy, NULL, TRUE);
+            gam_tree_add(tree, parent, node);
+            g_free(path_cpy);
         }
+        parent = node;
     }
 
     node = gam_node_new(path, NULL, is_dir);
     gam_tree_add(tree, parent, node);
 
-    g_free(path_cpy);
-
     return node;
 }
 
@@ -244,25 +323,15 @@ GList *
 gam_tree_get_children(GamTree * tree, GamNode * root)
 {
     GList *list = NULL;
-    GNode *node, *child;
-    unsigned int i, n;
-    void *data;
+    GamNode *node, *child;
 
     if ((tree == NULL) && (root == NULL))
         return(NULL);
 
-    node = root ? root->node : tree->root;
-    if (node == NULL)
-        return(NULL);
-    n = g_node_n_children(node);
-
-    for (i = 0; i < n; i++) {
-        child = g_node_nth_child(node, i);
-	if (child == NULL) break;
-        data = NODE_DATA(child);
-	if (data == NULL) break;
-        list = g_list_prepend(list, data);
-    }
+    node = root ? root : tree->root;
+
+    for (child = node->children; child != NULL; child = child->next)
+        list = g_list_prepend(list, child);
 
     return list;
 }
@@ -277,7 +346,7 @@ gam_tree_get_children(GamTree * tree, GamNode * root)
 gboolean
 gam_tree_has_children(GamTree * tree, GamNode * node)
 {
-    return(g_node_first_child(node->node) != NULL);
+    return(node->children != NULL);
 }
 
 /**
@@ -289,7 +358,7 @@ gam_tree_has_children(GamTree * tree, GamNode * node)
 guint
 gam_tree_get_size(GamTree * tree)
 {
-    return g_hash_table_size(tree->node_hash);
+    return tree->size;
 }
 
 /** @} */
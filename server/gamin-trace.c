@@ -0,0 +1,231 @@
+/*
+ * gamin-trace: decode a binary trace dumped by gam_server
+ *
+ * gam_server keeps its last records in a ring in memory and writes them
+ * to gamin-trace-<pid>.bin in its socket directory on SIGUSR2 or when it
+ * crashes, see doc/trace.txt. This prints them one per line, with the
+ * time of day, the time since the previous record, and the arguments.
+ *
+ *   gamin-trace [-r] file
+ *
+ * -r prints the arguments as plain numbers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gam_trace.h"
+#include "gam_event.h"
+#include "gam_protocol.h"
+#include "fam.h"
+
+typedef enum {
+    ARG_NONE = 0,
+    ARG_INT,
+    ARG_HEX,
+    ARG_EVENT,                  /* a GaminEventType */
+    ARG_FAMCODE,                /* a FAMCodes */
+    ARG_REQUEST                 /* a GAMReqType */
+} arg_kind;
+
+typedef struct {
+    const char *name;
+    const char *args[4];
+    arg_kind kinds[4];
+} record_format;
+
+/* indexed by GamTraceId */
+static const record_format formats[GAM_TRACE_LAST] = {
+    {"none", {NULL}, {ARG_NONE}},
+    {"conn_open", {"fd"}, {ARG_INT}},
+    {"conn_close", {"fd", "pid"}, {ARG_INT, ARG_INT}},
+    {"request", {"fd", "pid", "type", "seq"},
+     {ARG_INT, ARG_INT, ARG_REQUEST, ARG_INT}},
+    {"deliver", {"fd", "reqno", "event"}, {ARG_INT, ARG_INT, ARG_EVENT}},
+    {"queue", {"fd", "reqno", "event", "coalesced"},
+     {ARG_INT, ARG_INT, ARG_EVENT, ARG_INT}},
+    {"flush", {"fd", "events"}, {ARG_INT, ARG_INT}},
+    {"send", {"fd", "reqno", "type", "len"},
+     {ARG_INT, ARG_INT, ARG_FAMCODE, ARG_INT}},
+    {"send_failed", {"fd", "reqno"}, {ARG_INT, ARG_INT}},
+    {"read", {"events", "bytes"}, {ARG_INT, ARG_INT}},
+    {"dispatch", {"wd", "mask", "cookie"}, {ARG_INT, ARG_HEX, ARG_INT}},
+    {"poll_stat", {"result"}, {ARG_INT}},
+};
+
+static const char *
+request_name(int type)
+{
+    switch (type) {
+        case GAM_REQ_FILE:
+            return ("FILE");
+        case GAM_REQ_DIR:
+            return ("DIR");
+        case GAM_REQ_CANCEL:
+            return ("CANCEL");
+        case GAM_REQ_DEBUG:
+            return ("DEBUG");
+        case GAM_REQ_STATS:
+            return ("STATS");
+        case GAM_REQ_SNAPSHOT:
+            return ("SNAPSHOT");
+    }
+    return (NULL);
+}
+
+static const char *
+famcode_name(int code)
+{
+    switch (code) {
+        case FAMChanged:
+            return ("Changed");
+        case FAMDeleted:
+            return ("Deleted");
+        case FAMCreated:
+            return ("Created");
+        case FAMMoved:
+            return ("Moved");
+        case FAMAcknowledge:
+            return ("Acknowledge");
+        case FAMExists:
+            return ("Exists");
+        case FAMEndExist:
+            return ("EndExist");
+    }
+    return (NULL);
+}
+
+static void
+print_arg(arg_kind kind, gint32 value, int raw)
+{
+    const char *name = NULL;
+
+    if (!raw) {
+        switch (kind) {
+            case ARG_HEX:
+                printf("0x%x", (guint32) value);
+                return;
+            case ARG_EVENT:
+                name = gam_event_to_string((GaminEventType) value);
+                break;
+            case ARG_FAMCODE:
+                name = famcode_name(value);
+                break;
+            case ARG_REQUEST:
+                name = request_name(value);
+                break;
+            default:
+                break;
+        }
+    }
+    if (name != NULL)
+        printf("%s", name);
+    else
+        printf("%d", value);
+}
+
+static void
+print_record(const GamTraceHeader *header, const GamTraceRecord *rec,
+             gint64 prev, int raw)
+{
+    const record_format *format;
+    gint64 wall;
+    time_t sec;
+    struct tm *tm;
+    char buf[32] = "?";
+    int i, len;
+
+    wall = header->wall - (header->now - rec->time);
+    sec = (time_t) (wall / 1000000);
+    tm = localtime(&sec);
+    if (tm != NULL)
+        strftime(buf, sizeof(buf), "%H:%M:%S", tm);
+    printf("%s.%06d %+10.6f ", buf, (int) (wall % 1000000),
+           prev ? (rec->time - prev) / 1000000.0 : 0.0);
+
+    if ((rec->id == GAM_TRACE_NONE) || (rec->id >= GAM_TRACE_LAST)) {
+        printf("unknown(%d) %d %d %d %d\n", rec->id, rec->args[0],
+               rec->args[1], rec->args[2], rec->args[3]);
+        return;
+    }
+    format = &formats[rec->id];
+    printf("%-11s", format->name);
+    for (i = 0; (i < 4) && (format->args[i] != NULL); i++) {
+        printf(" %s ", format->args[i]);
+        print_arg(format->kinds[i], rec->args[i], raw);
+    }
+    if (rec->len > 0) {
+        len = (rec->len > GAM_TRACE_TAIL) ? GAM_TRACE_TAIL : rec->len;
+        printf(" %s%.*s", (rec->len > GAM_TRACE_TAIL) ? "..." : "", len,
+               rec->tail);
+    }
+    printf("\n");
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-r] file\n", name);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    GamTraceHeader header;
+    GamTraceRecord rec;
+    FILE *f;
+    time_t sec;
+    gint64 prev = 0;
+    guint32 i;
+    int opt, raw = 0;
+
+    while ((opt = getopt(argc, argv, "r")) != -1) {
+        switch (opt) {
+            case 'r':
+                raw = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    f = fopen(argv[optind], "rb");
+    if (f == NULL) {
+        perror(argv[optind]);
+        return (1);
+    }
+    if ((fread(&header, sizeof(header), 1, f) != 1) ||
+        (memcmp(header.magic, GAM_TRACE_MAGIC, sizeof(header.magic)))) {
+        fprintf(stderr, "%s: not a gamin trace\n", argv[optind]);
+        return (1);
+    }
+    if ((header.version != GAM_TRACE_VERSION) ||
+        (header.record_size != sizeof(GamTraceRecord))) {
+        fprintf(stderr, "%s: unsupported trace version %u, record size %u\n",
+                argv[optind], header.version, header.record_size);
+        return (1);
+    }
+
+    sec = (time_t) (header.wall / 1000000);
+    printf("# gam_server %u, dumped %s", header.pid, ctime(&sec));
+    if (header.signal != 0)
+        printf("# on signal %u\n", header.signal);
+    printf("# %u records, %u older ones lost\n", header.records,
+           header.lost);
+
+    for (i = 0; i < header.records; i++) {
+        if (fread(&rec, sizeof(rec), 1, f) != 1) {
+            fprintf(stderr, "%s: truncated after %u records\n",
+                    argv[optind], i);
+            return (1);
+        }
+        print_record(&header, &rec, prev, raw);
+        prev = rec.time;
+    }
+    fclose(f);
+    return (0);
+}
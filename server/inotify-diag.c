@@ -27,6 +27,7 @@
 #include <glib.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "inotify-kernel.h"
 #include "inotify-missing.h"
 #include "inotify-path.h"
 #include "inotify-diag.h"
@@ -49,6 +50,7 @@ gboolean id_dump (gpointer userdata)
 	}
 
 	im_diag_dump (ioc);
+	ik_diag_dump (ioc);
 
 	g_io_channel_shutdown (ioc, TRUE, NULL);
 	g_io_channel_unref (ioc);
@@ -37,7 +37,7 @@
 static gboolean		ih_debug_enabled = FALSE;
 #define IH_W if (ih_debug_enabled) g_warning 
 
-static void ih_event_callback (ik_event_t *event, ih_sub_t *sub);
+static void ih_event_callback (ik_event_t *event, ih_sub_t **subs, guint nsubs);
 static void ih_found_callback (ih_sub_t *sub);
 
 /* We share this lock with inotify-kernel.c and inotify-missing.c
@@ -56,6 +56,31 @@ static gboolean initialized = FALSE;
 static event_callback_t user_ecb = NULL;
 static found_callback_t user_fcb = NULL;
 
+/**
+ * Dumps the watched directories from wd on, see ip_snapshot_dirs()
+ */
+gint32
+ih_snapshot_dirs (GString *out, gint32 wd, guint *budget, gboolean *first)
+{
+	G_LOCK(inotify_lock);
+	wd = ip_snapshot_dirs (out, wd, budget, first);
+	G_UNLOCK(inotify_lock);
+	return wd;
+}
+
+/**
+ * Dumps the subscriptions on the missing list from index on, see
+ * im_snapshot()
+ */
+gint
+ih_snapshot_missing (GString *out, gint index, guint *budget, gboolean *first)
+{
+	G_LOCK(inotify_lock);
+	index = im_snapshot (out, index, budget, first);
+	G_UNLOCK(inotify_lock);
+	return index;
+}
+
 /**
  * Initializes the inotify backend.  This must be called before
  * any other functions in this module.
@@ -75,7 +100,7 @@ ih_startup (event_callback_t ecb,
 		return result;
 	}
 
-	result = ip_startup (ih_event_callback);
+	result = ip_startup (ih_event_callback, ih_found_callback);
 	if (!result) {
 		g_warning( "Could not initialize inotify\n");
 		G_UNLOCK(inotify_lock);
@@ -180,17 +205,17 @@ ih_sub_foreach_free (void *callerdata, gboolean (*f)(ih_sub_t *sub, void *caller
 	ih_sub_foreach_worker (callerdata, f, TRUE);
 }
 
-static void ih_event_callback (ik_event_t *event, ih_sub_t *sub)
+static void ih_event_callback (ik_event_t *event, ih_sub_t **subs, guint nsubs)
 {
 	gchar *fullpath;
 	if (event->name)
 	{
-		fullpath = g_strdup_printf ("%s/%s", sub->dirname, event->name);
+		fullpath = g_strdup_printf ("%s/%s", subs[0]->dirname, event->name);
 	} else {
-		fullpath = g_strdup_printf ("%s/", sub->dirname);
+		fullpath = g_strdup_printf ("%s/", subs[0]->dirname);
 	}
 
-	user_ecb (fullpath, event->mask, sub->usersubdata);
+	user_ecb (fullpath, event->mask, subs, nsubs);
 	g_free(fullpath);
 }
 
@@ -27,7 +27,8 @@
 #include "inotify-sub.h"
 #include "inotify-kernel.h"
 
-typedef void (*event_callback_t)(const char *fullpath, guint32 mask, void *subdata);
+/* subs all watch the directory of fullpath */
+typedef void (*event_callback_t)(const char *fullpath, guint32 mask, ih_sub_t **subs, guint nsubs);
 typedef void (*found_callback_t)(const char *fullpath, void *subdata);
 
 gboolean	 ih_startup		(event_callback_t ecb,
@@ -42,4 +43,7 @@ void		 ih_sub_foreach		(void *callerdata, gboolean (*f)(ih_sub_t *sub, void *cal
 /* Return FALSE from 'f' if the subscription should be cancelled and free'd */
 void		 ih_sub_foreach_free	(void *callerdata, gboolean (*f)(ih_sub_t *sub, void *callerdata));
 
+gint32		 ih_snapshot_dirs	(GString *out, gint32 wd, guint *budget, gboolean *first);
+gint		 ih_snapshot_missing	(GString *out, gint index, guint *budget, gboolean *first);
+
 #endif /* __INOTIFY_HELPER_H */
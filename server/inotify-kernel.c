@@ -23,6 +23,10 @@
 #include <string.h>
 #include <glib.h>
 #include "inotify-kernel.h"
+#include "gam_stats.h"
+#include "gam_probes.h"
+#include "gam_trace.h"
+#include "gam_record.h"
 
 #include <sys/inotify.h>
 
@@ -48,6 +52,32 @@ static guint32 ik_move_misses = 0;
 
 static gboolean process_eq_running = FALSE;
 
+/* Watches can be spread over several inotify instances, each drained
+ * by its own reader thread. The wd handed to the upper layers encodes
+ * the shard: kernel wd * ik_n_shards + shard. With a single shard we
+ * read from the main loop as we always did.
+ */
+#define IK_MAX_SHARDS 64
+
+typedef struct {
+	int fd;
+	GThread *thread;
+	gint32 last_wd;
+	/* Updated with atomic operations, the readers bump them */
+	gint watches;
+	gint events;
+	gint reads;
+} ik_shard_t;
+
+static int ik_n_shards = 1;
+static ik_shard_t *ik_shards = NULL;
+static gboolean ik_shards_running = FALSE;
+
+/* When replaying a record there is no inotify instance, the watches
+ * and the events come from the file.
+ */
+static gboolean ik_replaying = FALSE;
+
 /* We use the lock from inotify-helper.c
  *
  * There are two places that we take this lock
@@ -67,8 +97,19 @@ typedef struct ik_event_internal {
 	gboolean sent;
 	GTimeVal hold_until;
 	struct ik_event_internal *pair;
+	/* Link in the reader threads' queue */
+	struct ik_event_internal *next;
 } ik_event_internal_t;
 
+/* Lock-free multiple producer single consumer queue. The reader
+ * threads push onto a stack, the main loop grabs the whole stack at
+ * once and reverses it, which gives back the arrival order.
+ */
+static ik_event_internal_t *ik_mpsc_head = NULL;
+/* Set while a wakeup is sitting in the pipe */
+static gint ik_wake_pending = 0;
+static int ik_wake_pipe[2] = { -1, -1 };
+
 /* In order to perform non-sleeping inotify event chunking we need
  * a custom GSource
  */
@@ -174,6 +215,69 @@ GSourceFuncs ik_source_funcs =
 	NULL
 };
 
+static ik_event_internal_t *ik_event_internal_new (ik_event_t *event);
+static ik_event_t *ik_event_new (char *buffer);
+static gpointer ik_shard_reader (gpointer data);
+static gboolean ik_wake_callback (GIOChannel *source, GIOCondition condition, gpointer data);
+
+/* Must be called before ik_startup and before any lock is taken, it
+ * may have to initialize the thread system.
+ */
+void ik_set_shards (int n)
+{
+	if (n < 1)
+		n = 1;
+	if (n > IK_MAX_SHARDS)
+		n = IK_MAX_SHARDS;
+	ik_n_shards = n;
+
+#if !GLIB_CHECK_VERSION(2,32,0)
+	if (ik_n_shards > 1 && !g_thread_supported ())
+		g_thread_init (NULL);
+#endif
+}
+
+/* Must be called before ik_startup */
+void ik_set_replay (void)
+{
+	ik_replaying = TRUE;
+}
+
+static gboolean ik_startup_shards (void)
+{
+	GIOChannel *ioc;
+	int i;
+
+	if (pipe (ik_wake_pipe) < 0)
+		return FALSE;
+
+	for (i = 0; i < ik_n_shards; i++)
+	{
+		ik_shards[i].fd = inotify_init ();
+		if (ik_shards[i].fd < 0)
+			return FALSE;
+	}
+
+	ioc = g_io_channel_unix_new (ik_wake_pipe[0]);
+	g_io_channel_set_encoding (ioc, NULL, NULL);
+	g_io_channel_set_flags (ioc, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_add_watch (ioc, G_IO_IN, ik_wake_callback, NULL);
+	g_io_channel_unref (ioc);
+
+	for (i = 0; i < ik_n_shards; i++)
+	{
+#if GLIB_CHECK_VERSION(2,32,0)
+		ik_shards[i].thread = g_thread_new ("inotify", ik_shard_reader, &ik_shards[i]);
+#else
+		ik_shards[i].thread = g_thread_create (ik_shard_reader, &ik_shards[i], FALSE, NULL);
+#endif
+		if (ik_shards[i].thread == NULL)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 gboolean ik_startup (void (*cb)(ik_event_t *event))
 {
 	static gboolean initialized = FALSE;
@@ -182,15 +286,45 @@ gboolean ik_startup (void (*cb)(ik_event_t *event))
 	user_cb = cb;
 	/* Ignore multi-calls */
 	if (initialized) {
+		if (ik_replaying)
+			return TRUE;
+		if (ik_n_shards > 1)
+			return ik_shards_running;
 		return inotify_instance_fd >= 0;
 	}
 
+	/* The recorded wds already encode their shard */
+	if (ik_replaying)
+		ik_n_shards = 1;
+	ik_shards = g_new0 (ik_shard_t, ik_n_shards);
+
+	if (ik_replaying)
+	{
+		cookie_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
+		event_queue = g_queue_new ();
+		events_to_process = g_queue_new ();
+		initialized = TRUE;
+		return TRUE;
+	}
+
+	if (ik_n_shards > 1)
+	{
+		cookie_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
+		event_queue = g_queue_new ();
+		events_to_process = g_queue_new ();
+		initialized = TRUE;
+
+		ik_shards_running = ik_startup_shards ();
+		return ik_shards_running;
+	}
+
 	inotify_instance_fd = inotify_init ();
 
 	if (inotify_instance_fd < 0) {
 		return FALSE;
 	}
 	initialized = TRUE;
+	ik_shards[0].fd = inotify_instance_fd;
 
 	inotify_read_ioc = g_io_channel_unix_new(inotify_instance_fd);
 	ik_poll_fd.fd = inotify_instance_fd;
@@ -231,6 +365,7 @@ static ik_event_t *ik_event_new (char *buffer)
    struct inotify_event *kevent = (struct inotify_event *)buffer;
    g_assert (buffer);
    ik_event_t *event = g_new0(ik_event_t,1);
+   event->read_time = gam_stats_now ();
    event->wd = kevent->wd;
    event->mask = kevent->mask;
    event->cookie = kevent->cookie;
@@ -267,34 +402,73 @@ void ik_event_free (ik_event_t *event)
 	g_free(event);
 }
 
+/* The same path always lands on the same shard, so re-arming a watch
+ * gives back the wd we already have.
+ */
+static ik_shard_t *ik_shard_for_path (const char *path)
+{
+	return &ik_shards[g_str_hash (path) % ik_n_shards];
+}
+
+static gint32 ik_shard_wd (ik_shard_t *shard, gint32 wd)
+{
+	if (wd < 0)
+		return wd;
+	return wd * ik_n_shards + (shard - ik_shards);
+}
+
 gint32 ik_watch (const char *path, guint32 mask, int *err)
 {
    gint32 wd = -1;
+   ik_shard_t *shard;
 
    g_assert (path != NULL);
-   g_assert (inotify_instance_fd >= 0);
 
-   wd = inotify_add_watch (inotify_instance_fd, path, mask);
+   if (ik_replaying)
+      return gam_replay_watch (path, err);
+
+   shard = ik_shard_for_path (path);
+   g_assert (shard->fd >= 0);
+
+   wd = inotify_add_watch (shard->fd, path, mask);
 
    if (wd < 0)
    {
       int e = errno;
       // FIXME: debug msg failed to add watch
+      gam_record_watch (path, mask, wd, e);
       if (err)
          *err = e;
       return wd;
    }
 
    g_assert (wd >= 0);
-   return wd;
+
+   /* The kernel hands out increasing wds, an older one is a re-arm */
+   if (wd > shard->last_wd)
+   {
+      shard->last_wd = wd;
+      g_atomic_int_inc (&shard->watches);
+   }
+
+   gam_record_watch (path, mask, ik_shard_wd (shard, wd), 0);
+   return ik_shard_wd (shard, wd);
 }
 
 int ik_ignore(const char *path, gint32 wd)
 {
+	ik_shard_t *shard;
+
 	g_assert (wd >= 0);
-	g_assert (inotify_instance_fd >= 0);
 
-	if (inotify_rm_watch (inotify_instance_fd, wd) < 0)
+	if (ik_replaying)
+		return 0;
+	gam_record_ignore (wd, path);
+
+	shard = &ik_shards[wd % ik_n_shards];
+	g_assert (shard->fd >= 0);
+
+	if (inotify_rm_watch (shard->fd, wd / ik_n_shards) < 0)
 	{
 		//int e = errno;
 		// failed to rm watch
@@ -304,6 +478,41 @@ int ik_ignore(const char *path, gint32 wd)
 	return 0;
 }
 
+int ik_shard_count (void)
+{
+	return ik_n_shards;
+}
+
+void ik_shard_stats (int shard, guint32 *watches, guint32 *events, guint32 *reads)
+{
+	g_assert (shard >= 0 && shard < ik_n_shards);
+
+	if (watches)
+		*watches = g_atomic_int_get (&ik_shards[shard].watches);
+	if (events)
+		*events = g_atomic_int_get (&ik_shards[shard].events);
+	if (reads)
+		*reads = g_atomic_int_get (&ik_shards[shard].reads);
+}
+
+void ik_diag_dump (GIOChannel *ioc)
+{
+	int i;
+
+	g_io_channel_write_chars (ioc, "inotify shards:\n", -1, NULL, NULL);
+	for (i = 0; i < ik_n_shards; i++)
+	{
+		guint32 watches, events, reads;
+		gchar *line;
+
+		ik_shard_stats (i, &watches, &events, &reads);
+		line = g_strdup_printf ("%d: %u watches %u events %u reads\n",
+					i, watches, events, reads);
+		g_io_channel_write_chars (ioc, line, -1, NULL, NULL);
+		g_free (line);
+	}
+}
+
 void ik_move_stats (guint32 *matches, guint32 *misses)
 {
 	if (matches)
@@ -466,13 +675,22 @@ static gboolean ik_read_callback(gpointer user_data)
 	while (buffer_i < buffer_size)
 	{
 		struct inotify_event *event;
+		ik_event_t *ik_event;
 		gsize event_size;
 		event = (struct inotify_event *)&buffer[buffer_i];
 		event_size = sizeof(struct inotify_event) + event->len;
-		g_queue_push_tail (events_to_process, ik_event_internal_new (ik_event_new (&buffer[buffer_i])));
+		if (event->mask & IN_IGNORED)
+			g_atomic_int_add (&ik_shards[0].watches, -1);
+		ik_event = ik_event_new (&buffer[buffer_i]);
+		gam_record_event (ik_event->wd, ik_event->mask, ik_event->cookie, ik_event->name);
+		g_queue_push_tail (events_to_process, ik_event_internal_new (ik_event));
 		buffer_i += event_size;
 		events++;
 	}
+	g_atomic_int_add (&ik_shards[0].events, events);
+	g_atomic_int_inc (&ik_shards[0].reads);
+	GAM_PROBE2 (read_batch, events, buffer_size);
+	GAM_TRACE (READ, events, buffer_size, 0, 0, NULL);
 
 	/* If the event process callback is off, turn it back on */
 	if (!process_eq_running && events)
@@ -485,6 +703,122 @@ static gboolean ik_read_callback(gpointer user_data)
 	return TRUE;
 }
 
+static void ik_mpsc_push (ik_event_internal_t *internal_event)
+{
+	ik_event_internal_t *head;
+
+	do {
+		head = g_atomic_pointer_get (&ik_mpsc_head);
+		internal_event->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange (&ik_mpsc_head, head, internal_event));
+}
+
+static ik_event_internal_t *ik_mpsc_take (void)
+{
+	ik_event_internal_t *head, *prev, *next;
+
+	do {
+		head = g_atomic_pointer_get (&ik_mpsc_head);
+	} while (head && !g_atomic_pointer_compare_and_exchange (&ik_mpsc_head, head, NULL));
+
+	for (prev = NULL; head; head = next)
+	{
+		next = head->next;
+		head->next = prev;
+		prev = head;
+	}
+
+	return prev;
+}
+
+static void ik_wake (void)
+{
+	if (g_atomic_int_compare_and_exchange (&ik_wake_pending, 0, 1))
+	{
+		while (write (ik_wake_pipe[1], "w", 1) < 0 && errno == EINTR)
+			;
+	}
+}
+
+static gpointer ik_shard_reader (gpointer data)
+{
+	ik_shard_t *shard = data;
+	gsize buffer_size = AVERAGE_EVENT_SIZE * MAX_QUEUED_EVENTS;
+	gchar *buffer = g_malloc (buffer_size);
+
+	for (;;)
+	{
+		ssize_t len, buffer_i;
+		gint events;
+
+		len = read (shard->fd, buffer, buffer_size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		buffer_i = 0;
+		events = 0;
+		while (buffer_i < len)
+		{
+			struct inotify_event *kevent = (struct inotify_event *)&buffer[buffer_i];
+			ik_event_t *event = ik_event_new (&buffer[buffer_i]);
+
+			event->wd = ik_shard_wd (shard, event->wd);
+			if (event->mask & IN_IGNORED)
+				g_atomic_int_add (&shard->watches, -1);
+			ik_mpsc_push (ik_event_internal_new (event));
+			buffer_i += sizeof(struct inotify_event) + kevent->len;
+			events++;
+		}
+		g_atomic_int_add (&shard->events, events);
+		g_atomic_int_inc (&shard->reads);
+		GAM_PROBE2 (read_batch, events, len);
+		GAM_TRACE (READ, events, len, 0, 0, NULL);
+
+		ik_wake ();
+	}
+
+	g_free (buffer);
+	return NULL;
+}
+
+static gboolean ik_wake_callback (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	ik_event_internal_t *internal_event, *next;
+	char buf[64];
+	gboolean events = FALSE;
+
+	while (read (ik_wake_pipe[0], buf, sizeof (buf)) > 0)
+		;
+	/* Clear it before taking the queue, a reader pushing after
+	 * that will wake us up again.
+	 */
+	g_atomic_int_set (&ik_wake_pending, 0);
+
+	G_LOCK(inotify_lock);
+	for (internal_event = ik_mpsc_take (); internal_event; internal_event = next)
+	{
+		ik_event_t *event = internal_event->event;
+
+		next = internal_event->next;
+		internal_event->next = NULL;
+		gam_record_event (event->wd, event->mask, event->cookie, event->name);
+		g_queue_push_tail (events_to_process, internal_event);
+		events = TRUE;
+	}
+
+	/* If the event process callback is off, turn it back on */
+	if (!process_eq_running && events)
+	{
+		process_eq_running = TRUE;
+		g_timeout_add (PROCESS_EVENTS_TIME, ik_process_eq_callback, NULL);
+	}
+	G_UNLOCK(inotify_lock);
+
+	return TRUE;
+}
+
 static gboolean
 g_timeval_lt(GTimeVal *val1, GTimeVal *val2)
 {
@@ -624,6 +958,7 @@ ik_process_events ()
 			event->pair->sent = TRUE;
 			event->sent = TRUE;
 			ik_move_matches++;
+			GAM_PROBE1 (move_match, event->event->cookie);
 		} else if (event->event->cookie) {
 			/* If we couldn't pair a MOVED_FROM and MOVED_TO together, we change
 			* the event masks */
@@ -633,12 +968,16 @@ ik_process_events ()
 			if (event->event->mask & IN_MOVED_FROM) {
 				event->event->mask = IN_DELETE|(event->event->mask & IN_ISDIR);
 				ik_move_misses++; // not super accurate, if we aren't watching the destination it still counts as a miss
+				GAM_PROBE1 (move_miss, event->event->cookie);
 			}
 			if (event->event->mask & IN_MOVED_TO)
 				event->event->mask = IN_CREATE|(event->event->mask & IN_ISDIR);
 		}
 
 		/* Push the ik_event_t onto the event queue */
+		event->event->queue_time = gam_stats_now ();
+		gam_stats_latency (GAM_LATENCY_KERNEL_QUEUE, event->event->read_time,
+				   event->event->queue_time);
 		g_queue_push_tail (event_queue, event->event);
 		/* Free the internal event structure */
 		g_free (event);
@@ -649,14 +988,19 @@ gboolean ik_process_eq_callback (gpointer user_data)
 {
     /* Try and move as many events to the event queue */
 	G_LOCK(inotify_lock);
+	gam_record_process ();
 	ik_process_events ();
 
 	while (!g_queue_is_empty (event_queue))
 	{
 		ik_event_t *event = g_queue_pop_head (event_queue);
 
+		gam_stats_latency (GAM_LATENCY_HOLD, event->queue_time,
+				   gam_stats_now ());
+		gam_stats_set_origin (event->read_time);
 		user_cb (event);
 	}
+	gam_stats_set_origin (0);
 
 	if (g_queue_get_length (events_to_process) == 0)
 	{
@@ -668,3 +1012,24 @@ gboolean ik_process_eq_callback (gpointer user_data)
 		return TRUE;
 	}
 }
+
+/* Queues an event of a record as if it had just been read */
+void ik_replay_event (gint32 wd, guint32 mask, guint32 cookie, const char *name)
+{
+	ik_event_t *event;
+
+	event = ik_event_new_dummy (name, wd, mask);
+	event->cookie = cookie;
+	event->read_time = gam_stats_now ();
+
+	G_LOCK(inotify_lock);
+	g_queue_push_tail (events_to_process, ik_event_internal_new (event));
+	g_atomic_int_inc (&ik_shards[0].events);
+	G_UNLOCK(inotify_lock);
+}
+
+/* Processes the queue where the recorded server did */
+void ik_replay_process (void)
+{
+	ik_process_eq_callback (NULL);
+}
@@ -24,8 +24,13 @@ typedef struct ik_event_s {
 	guint32 len;
 	char *  name;
 	struct ik_event_s *pair;
+	/* For the latency statistics, 0 for made up events */
+	gint64 read_time;
+	gint64 queue_time;
 } ik_event_t;
 
+void ik_set_shards (int n);
+void ik_set_replay (void);
 gboolean ik_startup (void (*cb)(ik_event_t *event));
 ik_event_t *ik_event_new_dummy (const char *name, gint32 wd, guint32 mask);
 void ik_event_free (ik_event_t *event);
@@ -36,5 +41,11 @@ int ik_ignore(const char *path, gint32 wd);
 /* The miss count will probably be enflated */
 void ik_move_stats (guint32 *matches, guint32 *misses);
 const char *ik_mask_to_string (guint32 mask);
+int ik_shard_count (void);
+void ik_shard_stats (int shard, guint32 *watches, guint32 *events, guint32 *reads);
+void ik_diag_dump (GIOChannel *ioc);
+
+void ik_replay_event (gint32 wd, guint32 mask, guint32 cookie, const char *name);
+void ik_replay_process (void);
 
 #endif
@@ -27,13 +27,18 @@
 #include <glib.h>
 #include "inotify-missing.h"
 #include "inotify-path.h"
+#include "gam_snapshot.h"
 
 #define SCAN_MISSING_TIME 4000 /* 1/4 Hz */
 
 static gboolean     im_debug_enabled = FALSE;
 #define IM_W if (im_debug_enabled) g_warning
 
-/* We put ih_sub_t's that are missing on this list */
+/* We put ih_sub_t's that are missing on this list. Most missing
+ * subscriptions are parked on an existing ancestor by inotify-path.c
+ * and never get here, this only catches the ones we couldn't watch
+ * at all (no existing ancestor, permissions...).
+ */
 static GList *missing_sub_list = NULL;
 static gboolean im_scan_missing (gpointer user_data);
 static gboolean scan_missing_running = FALSE;
@@ -112,7 +117,9 @@ static gboolean im_scan_missing (gpointer user_data)
 
 		if (not_m)
 		{
-			missing_cb (sub);
+			/* Parked on an ancestor, inotify-path.c reports it */
+			if (!ip_sub_is_parked (sub))
+				missing_cb (sub);
 			IM_W("removed %s from missing list\n", sub->dirname);
 			/* We have to build a list of list nodes to remove from the
 			* missing_sub_list. We do the removal outside of this loop.
@@ -156,3 +163,30 @@ im_diag_dump (GIOChannel *ioc)
 		g_io_channel_write_chars (ioc, "\n", -1, NULL, NULL);
 	}
 }
+
+/* Appends the subscriptions on the missing list from the index'th on,
+ * at most *budget of them. Returns the index to resume from, -1 once
+ * the end of the list is reached. Entries added or removed in between
+ * may be skipped or listed twice.
+ *
+ * inotify_lock must be held
+ */
+gint
+im_snapshot (GString *out, gint index, guint *budget, gboolean *first)
+{
+	GList *l;
+
+	for (l = g_list_nth (missing_sub_list, index); l && (*budget > 0);
+	     l = l->next, index++, (*budget)--)
+	{
+		ih_sub_t *sub = l->data;
+
+		gam_snapshot_item (out, first);
+		g_string_append (out, "{\"path\": ");
+		gam_snapshot_string (out, sub->pathname);
+		g_string_append_printf (out, ", \"dir\": %s}",
+					sub->is_dir ? "true" : "false");
+	}
+
+	return (l == NULL) ? -1 : index;
+}
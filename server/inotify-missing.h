@@ -30,5 +30,6 @@ void im_startup (void (*missing_cb)(ih_sub_t *sub));
 void im_add (ih_sub_t *sub);
 void im_rm (ih_sub_t *sub);
 void im_diag_dump (GIOChannel *ioc);
+gint im_snapshot (GString *out, gint index, guint *budget, gboolean *first);
 
 #endif /* __INOTIFY_MISSING_H */
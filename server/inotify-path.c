@@ -33,8 +33,14 @@
 #include "inotify-kernel.h"
 #include "inotify-path.h"
 #include "inotify-missing.h"
+#include "gam_probes.h"
+#include "gam_trace.h"
+#include "gam_snapshot.h"
 
-#define IP_INOTIFY_MASK (IN_MODIFY|IN_ATTRIB|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE|IN_CREATE|IN_DELETE_SELF|IN_UNMOUNT|IN_MOVE_SELF)
+/* Always armed, we need them to keep track of the watched directories */
+#define IP_INOTIFY_SELF_MASK (IN_DELETE_SELF|IN_UNMOUNT|IN_MOVE_SELF)
+/* All a subscription parked on an ancestor needs to see */
+#define IP_INOTIFY_PARKED_MASK (IN_CREATE|IN_MOVED_TO)
 
 typedef struct ip_watched_dir_s {
 	char *path;
@@ -47,6 +53,8 @@ typedef struct ip_watched_dir_s {
 
 	/* Inotify state */
 	gint32 wd;
+	/* Mask the wd is currently armed with */
+	guint32 mask;
 
 	/* List of inotify subscriptions */
 	GList *subs;
@@ -68,14 +76,21 @@ static GHashTable * sub_dir_hash = NULL;
  * the same wd
  */
 static GHashTable * wd_dir_hash = NULL;
+/* The highest wd ever mapped, the kernel hands them out increasing */
+static gint32 wd_max = 0;
 
 static ip_watched_dir_t *	ip_watched_dir_new (const char *path, int wd);
 static void 			ip_watched_dir_free (ip_watched_dir_t *dir);
 static void 			ip_event_callback (ik_event_t *event);
 
-static void (*event_callback)(ik_event_t *event, ih_sub_t *sub);
+static void (*event_callback)(ik_event_t *event, ih_sub_t **subs, guint nsubs);
+static void (*found_callback)(ih_sub_t *sub);
 
-gboolean ip_startup (void (*cb)(ik_event_t *event, ih_sub_t *sub))
+/* The subscriptions of a directory an event goes to */
+static GPtrArray *dispatch_subs = NULL;
+
+gboolean ip_startup (void (*cb)(ik_event_t *event, ih_sub_t **subs, guint nsubs),
+		     void (*fcb)(ih_sub_t *sub))
 {
 	static gboolean initialized = FALSE;
 	static gboolean result = FALSE;
@@ -85,6 +100,7 @@ gboolean ip_startup (void (*cb)(ik_event_t *event, ih_sub_t *sub))
 	}
 
 	event_callback = cb;
+	found_callback = fcb;
 	result = ik_startup (ip_event_callback);
 
 	if (!result) {
@@ -95,6 +111,7 @@ gboolean ip_startup (void (*cb)(ik_event_t *event, ih_sub_t *sub))
 	path_dir_hash = g_hash_table_new(g_str_hash, g_str_equal);
 	sub_dir_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
 	wd_dir_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
+	dispatch_subs = g_ptr_array_new ();
 
 	return TRUE;
 }
@@ -122,6 +139,101 @@ ip_map_wd_dir (gint32 wd, ip_watched_dir_t *dir)
 	GList *dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER(wd));
 	dir_list = g_list_prepend (dir_list, dir);
 	g_hash_table_replace(wd_dir_hash, GINT_TO_POINTER(dir->wd), dir_list);
+	if (wd > wd_max)
+		wd_max = wd;
+}
+
+/* The events a subscription needs when it watches its own directory */
+static guint32
+ip_sub_events (ih_sub_t *sub)
+{
+	return sub->mask ? sub->mask : IP_INOTIFY_MASK;
+}
+
+/* The events a subscription needs from the directory it is attached to */
+static guint32
+ip_sub_dir_mask (ip_watched_dir_t *dir, ih_sub_t *sub)
+{
+	if (strcmp (dir->path, sub->dirname))
+		return IP_INOTIFY_PARKED_MASK|sub->extra_flags;
+
+	return ip_sub_events (sub)|sub->extra_flags;
+}
+
+/* Record the mask the kernel now has for wd */
+static void
+ip_wd_set_mask (gint32 wd, guint32 mask)
+{
+	GList *dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER(wd));
+
+	for (; dir_list; dir_list = dir_list->next)
+	{
+		ip_watched_dir_t *dir = dir_list->data;
+		dir->mask = mask;
+	}
+}
+
+/* Re-arm the watch of dir with the union of what the subscriptions of
+ * all the directories sharing its wd need, so that the kernel drops
+ * the events nobody listens to.
+ */
+static void
+ip_wd_update_mask (ip_watched_dir_t *dir)
+{
+	GList *dir_list, *l, *subl;
+	ip_watched_dir_t *other;
+	guint32 mask, arm;
+	gint32 wd;
+	int err;
+
+	dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER(dir->wd));
+
+	mask = IP_INOTIFY_SELF_MASK|IN_ONLYDIR;
+	for (l = dir_list; l; l = l->next)
+	{
+		ip_watched_dir_t *d = l->data;
+
+		for (subl = d->subs; subl; subl = subl->next)
+			mask |= ip_sub_dir_mask (d, subl->data);
+	}
+
+	if (mask == dir->mask)
+		return;
+
+	IP_W("Re-arming %s with mask 0x%x (was 0x%x)\n", dir->path, mask, dir->mask);
+	/* Widening can't hurt whatever inode the path leads to now, only
+	 * narrowing has to replace the mask.
+	 */
+	arm = mask;
+	if ((mask & dir->mask) == dir->mask)
+		arm |= IN_MASK_ADD;
+	wd = ik_watch (dir->path, arm, &err);
+	if (wd < 0)
+	{
+		IP_W("Failed\n");
+		return;
+	}
+	if (wd != dir->wd)
+	{
+		/* The path now leads to another inode, leave it to the
+		 * IN_DELETE_SELF/IN_MOVE_SELF handling. That inode may be
+		 * watched already, under the path it was renamed from or
+		 * through a bind mount: then put its own mask back, and
+		 * never drop a wd other directories still use.
+		 */
+		dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER(wd));
+		if (dir_list == NULL)
+		{
+			ik_ignore (dir->path, wd);
+			return;
+		}
+		other = dir_list->data;
+		if (!(arm & IN_MASK_ADD) || (mask & ~other->mask))
+			ik_watch (dir->path, other->mask, &err);
+		return;
+	}
+
+	ip_wd_set_mask (wd, mask);
 }
 
 static gint32
@@ -159,8 +271,10 @@ ip_watch_parent (const char *path, guint mask, int *err, char **parent_path)
 gboolean ip_start_watching (ih_sub_t *sub)
 {
 	gint32 wd;
+	guint32 mask;
 	int err;
 	ip_watched_dir_t *dir;
+	GList *dir_list;
 
 	g_assert (sub);
 	g_assert (!sub->cancelled);
@@ -175,7 +289,8 @@ gboolean ip_start_watching (ih_sub_t *sub)
 	}
 	
 	IP_W("Trying to add inotify watch ");
-	wd = ik_watch (sub->dirname, IP_INOTIFY_MASK|IN_ONLYDIR|sub->extra_flags, &err);
+	mask = ip_sub_events (sub)|IP_INOTIFY_SELF_MASK|IN_ONLYDIR|sub->extra_flags;
+	wd = ik_watch (sub->dirname, mask, &err);
 
         if (wd < 0 && errno == ENOENT)
         {
@@ -185,9 +300,11 @@ gboolean ip_start_watching (ih_sub_t *sub)
                      sub->dirname);
 
                 parent_path = NULL;
-		wd = ip_watch_parent (sub->dirname,
-                                      IP_INOTIFY_MASK|IN_ONLYDIR|sub->extra_flags,
-                                      &err, &parent_path);
+		/* The parent may be watched for other subscriptions already,
+		 * add to its mask rather than narrowing it.
+		 */
+		mask = IP_INOTIFY_PARKED_MASK|IP_INOTIFY_SELF_MASK|IN_ONLYDIR|sub->extra_flags;
+		wd = ip_watch_parent (sub->dirname, mask|IN_MASK_ADD, &err, &parent_path);
 
 		if (wd < 0)
 		{
@@ -196,14 +313,22 @@ gboolean ip_start_watching (ih_sub_t *sub)
 			return FALSE;
 		}
 
+		dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER(wd));
+		if (dir_list != NULL)
+			mask |= ((ip_watched_dir_t *) dir_list->data)->mask;
+
 		IP_W("Found parent '%s', will watch it for now until '%s' becomes available\n",
                      parent_path, sub->dirname);
 
-                dir = ip_watched_dir_new (parent_path, wd);
+		/* Several missing subscriptions can share an ancestor */
+		dir = g_hash_table_lookup (path_dir_hash, parent_path);
+		if (dir == NULL)
+		{
+			dir = ip_watched_dir_new (parent_path, wd);
+			ip_map_wd_dir (wd, dir);
+			ip_map_path_dir (dir->path, dir);
+		}
                 g_free (parent_path);
-
-		ip_map_wd_dir (wd, dir);
-		ip_map_path_dir (parent_path, dir);
         } else if (wd < 0) {
 		IP_W("Failed\n");
 		return FALSE;
@@ -217,8 +342,14 @@ gboolean ip_start_watching (ih_sub_t *sub)
 		ip_map_path_dir (sub->dirname, dir);
 	}
 
+	/* inotify_add_watch replaced whatever mask the inode had, other
+	 * directories on the same wd may need more than we just asked for.
+	 */
+	ip_wd_set_mask (wd, mask);
+
 out:
 	ip_map_sub_dir (sub, dir);
+	ip_wd_update_mask (dir);
 
 	return TRUE;
 }
@@ -295,12 +426,41 @@ gboolean ip_stop_watching  (ih_sub_t *sub)
         ip_unmap_wd_dir (dir->wd, dir);
 		ip_unmap_path_dir (dir->path, dir);
         ip_watched_dir_free (dir);
+	} else {
+		ip_wd_update_mask (dir);
 	}
 
 	return TRUE;
 }
 
 
+/* A subscription is parked when the directory it wants does not exist
+ * yet and it is attached to the watch of its nearest existing ancestor.
+ */
+gboolean
+ip_sub_is_parked (ih_sub_t *sub)
+{
+	ip_watched_dir_t *dir;
+
+	dir = g_hash_table_lookup (sub_dir_hash, sub);
+	if (!dir)
+		return FALSE;
+
+	return strcmp (dir->path, sub->dirname) != 0;
+}
+
+/* TRUE if path is dirname or one of its ancestors */
+static gboolean
+ip_path_leads_to (const char *path, const char *dirname)
+{
+	size_t len = strlen (path);
+
+	if (strncmp (path, dirname, len))
+		return FALSE;
+
+	return dirname[len] == '\0' || dirname[len] == '/';
+}
+
 static ip_watched_dir_t *
 ip_watched_dir_new (const char *path, gint32 wd)
 {
@@ -323,134 +483,136 @@ ip_watched_dir_free (ip_watched_dir_t * dir)
 static void ip_wd_delete (gpointer data, gpointer user_data)
 {
 	ip_watched_dir_t *dir = data;
-	GList *l = NULL;
-
-	for (l = dir->subs; l; l = l->next)
-	{
-		ih_sub_t *sub = l->data;
+	GList *subs, *l = NULL;
 
-		/* Add subscription to missing list */
-		im_add (sub);
-	}
+	subs = g_list_copy (dir->subs);
 	ip_unmap_all_subs (dir);
 	/* Unassociate the path and the directory */
 	ip_unmap_path_dir (dir->path, dir);
 	ip_watched_dir_free (dir);
+
+	/* Park the subscriptions on the closest ancestor that still
+	 * exists, the periodic missing scan only gets the ones we
+	 * can't watch at all. The directory may already be back if it
+	 * was recreated in the same batch of events.
+	 */
+	for (l = subs; l; l = l->next)
+	{
+		ih_sub_t *sub = l->data;
+
+		if (!ip_start_watching (sub))
+			im_add (sub);
+		else if (!ip_sub_is_parked (sub))
+			found_callback (sub);
+	}
+	g_list_free (subs);
 }
 
-static void ip_event_dispatch (GList *dir_list, GList *pair_dir_list, ik_event_t *event)
+static GList *
+ip_event_dispatch_dir (ip_watched_dir_t *dir, ik_event_t *event, GList *resubscription_list)
 {
-	GList *dirl;
-        GList *subl, *resubscription_list;
+	GList *subl;
+	char *event_path = NULL;
 
-	if (!event)
-		return;
+	for (subl = dir->subs; subl; subl = subl->next)
+	{
+		ih_sub_t *sub = subl->data;
 
-	/* TODO:
-	 *
-	 * Figure out how we will deliver move events
-	 */
+		/* The subscription is parked on an ancestor of the directory
+		 * it wants, we only care about the next component of its path
+		 * showing up so that we can move the watch one step closer.
+		 */
+		if (strcmp (dir->path, sub->dirname))
+		{
+			if (!(event->mask & (IN_CREATE|IN_MOVED_TO)) || !event->name)
+				continue;
 
-        resubscription_list = NULL;
-	for (dirl = dir_list; dirl; dirl = dirl->next)
-	{
-		ip_watched_dir_t *dir = dirl->data;
-                char *event_path;
+			if (event_path == NULL)
+				event_path = g_build_filename (dir->path, event->name, NULL);
+
+			if (ip_path_leads_to (event_path, sub->dirname) &&
+			    !g_list_find (resubscription_list, sub))
+			{
+				IP_W("Adding directory %s to resubscription list (because of event %s)\n",
+				     sub->dirname, event_path);
+				resubscription_list = g_list_prepend (resubscription_list, sub);
+			}
+			continue;
+		}
 
-                event_path = g_build_filename (dir->path, event->name, NULL);
+		/* If the event and the subscription have a filename
+		 * they need to match before the event could be delivered.
+		 */
+		if (event->name && sub->filename) {
+			if (strcmp (event->name, sub->filename))
+				continue;
+		/* If the event doesn't have a filename, but the subscription does
+		 * we shouldn't deliever the event */
+		} else if (sub->filename)
+			continue;
 
+		/* The wd may be armed for the benefit of other subscriptions */
+		if (!(event->mask & (ip_sub_events (sub)|IP_INOTIFY_SELF_MASK)))
+			continue;
 
+		g_ptr_array_add (dispatch_subs, sub);
+	}
 
-		for (subl = dir->subs; subl; subl = subl->next)
-		{
-			ih_sub_t *sub = subl->data;
+	/* All of them see the same path, hand them over at once */
+	if (dispatch_subs->len > 0)
+	{
+		event_callback (event, (ih_sub_t **) dispatch_subs->pdata,
+				dispatch_subs->len);
+		g_ptr_array_set_size (dispatch_subs, 0);
+	}
 
-			/* If the event and the subscription have a filename
-			 * they need to match before the event could be delivered.
-			 */
-			if (event->name && sub->filename) {
+	g_free (event_path);
+	return resubscription_list;
+}
 
-                               if (strcmp (event->name, sub->filename))
-                                {
-					continue;
-                                }
+static void ip_event_dispatch (GList *dir_list, GList *pair_dir_list, ik_event_t *event)
+{
+	GList *dirl;
+	GList *subl, *resubscription_list;
 
-			/* If the event doesn't have a filename, but the subscription does
-			 * we shouldn't deliever the event */
-			} else if (sub->filename)
-				continue;
+	if (!event)
+		return;
 
-                        if (g_str_has_prefix (sub->dirname, event_path)) {
-
-                            IP_W("Adding directory %s to resubscription list (because of event %s)", 
-                                 sub->dirname, event_path);
-
-                            resubscription_list = g_list_prepend (resubscription_list, sub);
-
-                            if (strcmp (sub->dirname, event_path) == 0) {
-                                        char *subscription_dir;
-
-                                        IP_W("directory '%s' is now available!", 
-                                             sub->dirname);
-
-                                        /* Normally, the subscription directory name,
-                                         * matches the directory getting watched.  This 
-                                         * isn't necessarily true, though, if we're watching
-                                         * a parent since the directory we're actually interested 
-                                         * in doesn't exist anymore.  When the directory we *are*
-                                         * interested in shows up, we find out relative to the
-                                         * directory we're watching.  We need to fudge our subscription
-                                         * temporarily to account for that.
-                                         *
-                                         * FIXME: This is a hack, we should send the dirname that the 
-                                         * event came from, along with the subscription, or store a 
-                                         * full path in the event structure
-                                         */
-                                        subscription_dir = sub->dirname;
-                                        sub->dirname = dir->path;
-                                        event_callback (event, sub);
-                                        sub->dirname = subscription_dir;
-                            }
-
-                            continue;
-                        }
-
-			event_callback (event, sub);
-		}
+	/* TODO:
+	 *
+	 * Figure out how we will deliver move events
+	 */
 
-                g_free (event_path);
-	}
+	resubscription_list = NULL;
+	for (dirl = dir_list; dirl; dirl = dirl->next)
+		resubscription_list = ip_event_dispatch_dir (dirl->data, event, resubscription_list);
 
 	if (event->pair)
 	for (dirl = pair_dir_list; dirl; dirl = dirl->next)
+		resubscription_list = ip_event_dispatch_dir (dirl->data, event->pair, resubscription_list);
+
+	/* Move the parked subscriptions down their path. Once one reaches
+	 * its own directory it is reported exactly like a subscription
+	 * that left the missing list.
+	 */
+	for (subl = resubscription_list; subl; subl = subl->next)
 	{
-		ip_watched_dir_t *dir = dirl->data;
+		ih_sub_t *sub = subl->data;
 
-		for (subl = dir->subs; subl; subl = subl->next)
+		ip_stop_watching (sub);
+		if (!ip_start_watching (sub))
 		{
-			ih_sub_t *sub = subl->data;
-
-			/* If the event and the subscription have a filename
-			 * they need to match before the event could be delivered.
-			 */
-			if (event->pair->name && sub->filename) {
-				if (strcmp (event->pair->name, sub->filename))
-					continue;
-			/* If the event doesn't have a filename, but the subscription does
-			 * we shouldn't deliever the event */
-			} else if (sub->filename)
-				continue;
+			im_add (sub);
+			continue;
+		}
 
-			event_callback (event->pair, sub);
+		if (!ip_sub_is_parked (sub))
+		{
+			IP_W("directory '%s' is now available!\n", sub->dirname);
+			found_callback (sub);
 		}
 	}
-
-        for (subl = resubscription_list; subl; subl = subl->next)
-        {
-            ip_stop_watching (subl->data);
-            ip_start_watching (subl->data);
-        }
-        g_list_free (resubscription_list);
+	g_list_free (resubscription_list);
 }
 
 static void
@@ -470,8 +632,12 @@ ip_event_callback (ik_event_t *event)
 	if (event->pair)
 		pair_dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER(event->pair->wd));
 
-	if (event->mask & IP_INOTIFY_MASK) {
+	if (event->mask & (IP_INOTIFY_MASK|IN_CLOSE_WRITE)) {
+		GAM_PROBE3 (dispatch, event->wd, event->mask, event->name);
+		GAM_TRACE (DISPATCH, event->wd, event->mask, event->cookie, 0,
+			   event->name);
 		ip_event_dispatch (dir_list, pair_dir_list, event);
+		GAM_PROBE1 (dispatch_done, event->wd);
 	        dir_list = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER(event->wd));
         }
 
@@ -486,3 +652,33 @@ ip_event_callback (ik_event_t *event)
 
 	ik_event_free (event);
 }
+
+/* Appends the directories watched by wd and the following ones as JSON
+ * objects, at most *budget of them. Walking by wd rather than over a
+ * hash table lets the caller resume later from the returned wd, -1
+ * once they are all done.
+ *
+ * inotify_lock must be held
+ */
+gint32
+ip_snapshot_dirs (GString *out, gint32 wd, guint *budget, gboolean *first)
+{
+	GList *l;
+
+	for (; (wd <= wd_max) && (*budget > 0); wd++, (*budget)--)
+	{
+		for (l = g_hash_table_lookup (wd_dir_hash, GINT_TO_POINTER(wd)); l; l = l->next)
+		{
+			ip_watched_dir_t *dir = l->data;
+
+			gam_snapshot_item (out, first);
+			g_string_append_printf (out, "{\"wd\": %d, \"path\": ", dir->wd);
+			gam_snapshot_string (out, dir->path);
+			g_string_append_printf (out, ", \"mask\": %u, \"subscriptions\": %u, \"children\": %u}",
+						dir->mask, g_list_length (dir->subs),
+						g_list_length (dir->children));
+		}
+	}
+
+	return (wd > wd_max) ? -1 : wd;
+}
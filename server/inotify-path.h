@@ -20,8 +20,20 @@
 #include "inotify-kernel.h"
 #include "inotify-sub.h"
 
-gboolean ip_startup (void (*event_cb)(ik_event_t *event, ih_sub_t *sub));
+/* What a plain subscription needs. The gamin protocol has no way for a
+ * client to ask for creations and deletions only: every FAMMonitor*
+ * subscription gets Changed events, so a directory with any of them
+ * attached is armed with the whole mask. Only the watches on which
+ * nothing but parked subscriptions hang are narrowed, and subscriptions
+ * with an event set of their own (ih_sub_t mask) get exactly that.
+ */
+#define IP_INOTIFY_MASK (IN_MODIFY|IN_ATTRIB|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE|IN_CREATE|IN_DELETE_SELF|IN_UNMOUNT|IN_MOVE_SELF)
+
+gboolean ip_startup (void (*event_cb)(ik_event_t *event, ih_sub_t **subs, guint nsubs),
+		     void (*found_cb)(ih_sub_t *sub));
 gboolean ip_start_watching (ih_sub_t *sub);
 gboolean ip_stop_watching  (ih_sub_t *sub);
+gboolean ip_sub_is_parked  (ih_sub_t *sub);
+gint32   ip_snapshot_dirs  (GString *out, gint32 wd, guint *budget, gboolean *first);
 
 #endif
@@ -32,6 +32,8 @@ typedef struct {
 	char *dirname;
 	char *filename;
 	guint32 extra_flags;
+	/* inotify events the subscription needs, 0 for all of them */
+	guint32 mask;
 	gboolean cancelled;
 	void *usersubdata;
 } ih_sub_t;
@@ -0,0 +1,220 @@
+/*
+ * bench.c: helpers shared by the gam_server benchmarks, see bench.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "fam.h"
+#include "bench.h"
+
+static int machine = 0;
+
+double
+bench_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec + tv.tv_usec / 1000000.0);
+}
+
+/*
+ * The server is up once its socket shows in /proc/net/unix, abstract or
+ * not. Without /proc give it a second.
+ */
+static int
+bench_server_listening(bench_server *server)
+{
+    static int no_proc = 0;
+    char line[512];
+    FILE *f;
+    int found = 0;
+
+    if (no_proc)
+        return (1);
+    f = fopen("/proc/net/unix", "r");
+    if (f == NULL) {
+        no_proc = 1;
+        sleep(1);
+        return (1);
+    }
+    while ((!found) && (fgets(line, sizeof(line), f) != NULL))
+        if (strstr(line, server->session) != NULL)
+            found = 1;
+    fclose(f);
+    return (found);
+}
+
+int
+bench_server_start(bench_server *server, const char *path,
+                   const char *backend)
+{
+    const char *pollonly = NULL;
+    double start;
+    int status;
+
+    if (path == NULL)
+        path = getenv("GAMIN_DEBUG_SERVER");
+    if (path == NULL)
+        path = "../server/gam_server";
+    if (access(path, X_OK) != 0) {
+        fprintf(stderr, "can't run %s, use -s to give gam_server\n", path);
+        return (-1);
+    }
+
+    unsetenv("GAM_TEST_DNOTIFY");
+    unsetenv("GAM_TEST_INOTIFY");
+    if (backend != NULL) {
+        if (!strcmp(backend, "inotify")) {
+            setenv("GAM_TEST_INOTIFY", "1", 1);
+        } else if (!strcmp(backend, "dnotify")) {
+            setenv("GAM_TEST_DNOTIFY", "1", 1);
+        } else if (!strcmp(backend, "poll")) {
+            pollonly = "--pollonly";
+        } else {
+            fprintf(stderr, "unknown backend %s\n", backend);
+            return (-1);
+        }
+    }
+
+    /* if a client ever has to start one, it's the same server */
+    snprintf(server->session, sizeof(server->session), "gam-bench-%d",
+             (int) getpid());
+    setenv("GAM_CLIENT_ID", server->session, 1);
+    setenv("GAMIN_DEBUG_SERVER", path, 1);
+
+    server->pid = fork();
+    if (server->pid < 0) {
+        perror("fork");
+        server->pid = 0;
+        return (-1);
+    }
+    if (server->pid == 0) {
+        if (pollonly != NULL)
+            execl(path, path, "--notimeout", pollonly, server->session,
+                  (char *) NULL);
+        else
+            execl(path, path, "--notimeout", server->session, (char *) NULL);
+        perror(path);
+        _exit(1);
+    }
+
+    for (start = bench_now(); bench_now() - start < 10.0;) {
+        if (waitpid(server->pid, &status, WNOHANG) == server->pid) {
+            fprintf(stderr, "%s exited at startup\n", path);
+            server->pid = 0;
+            return (-1);
+        }
+        if (bench_server_listening(server))
+            return (0);
+        usleep(10000);
+    }
+    fprintf(stderr, "%s didn't start listening\n", path);
+    bench_server_stop(server);
+    return (-1);
+}
+
+void
+bench_server_stop(bench_server *server)
+{
+    if (server->pid <= 0)
+        return;
+    kill(server->pid, SIGTERM);
+    while ((waitpid(server->pid, NULL, 0) < 0) && (errno == EINTR));
+    server->pid = 0;
+}
+
+int
+bench_server_usage(bench_server *server, double *cpu, long *rss_kb)
+{
+    char path[64], buf[1024], *cur;
+    unsigned long utime, stime;
+    long size, resident;
+    FILE *f;
+    size_t len;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", server->pid);
+    f = fopen(path, "r");
+    if (f == NULL)
+        return (-1);
+    len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = 0;
+    /* the command name may contain anything, skip it */
+    cur = strrchr(buf, ')');
+    if ((cur == NULL) ||
+        (sscanf(cur + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                "%lu %lu", &utime, &stime) != 2))
+        return (-1);
+    *cpu = (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+
+    snprintf(path, sizeof(path), "/proc/%d/statm", server->pid);
+    f = fopen(path, "r");
+    if (f == NULL)
+        return (-1);
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    *rss_kb = resident * (getpagesize() / 1024);
+    return (0);
+}
+
+int
+bench_server_connections(void)
+{
+    static char buf[64 * 1024];
+    char *cur;
+    int len;
+
+    len = FAMGetStats(buf, sizeof(buf));
+    if ((len < 0) || (len >= (int) sizeof(buf)))
+        return (-1);
+    for (cur = buf; cur != NULL; cur = strchr(cur, '\n')) {
+        if (*cur == '\n')
+            cur++;
+        if (!strncmp(cur, "connections ", 12))
+            return (atoi(cur + 12));
+    }
+    return (-1);
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+    double da = *(const double *) a, db = *(const double *) b;
+
+    return ((da < db) ? -1 : (da > db) ? 1 : 0);
+}
+
+double
+bench_percentile(double *values, int nb, double p)
+{
+    if (nb <= 0)
+        return (0.0);
+    qsort(values, nb, sizeof(double), compare_doubles);
+    return (values[(int) ((nb - 1) * p / 100.0 + 0.5)]);
+}
+
+void
+bench_set_machine(int value)
+{
+    machine = value;
+}
+
+void
+bench_report(const char *name, double value, const char *unit)
+{
+    if (!machine)
+        printf("%-28s %14.3f %s\n", name, value, unit);
+    else if ((value == (double) (long) value) && (value < 1e15) &&
+             (value > -1e15))
+        printf("%s %ld\n", name, (long) value);
+    else
+        printf("%s %.3f\n", name, value);
+}
@@ -0,0 +1,39 @@
+/*
+ * Helpers shared by the benchmarks talking to a real gam_server: running
+ * a private server, measuring its CPU time and memory, and reporting the
+ * results either for humans or as "name value" lines to compare between
+ * releases.
+ */
+#ifndef __GAM_BENCH_H__
+#define __GAM_BENCH_H__
+
+typedef struct {
+    int pid;                    /* of the gam_server, 0 if not running */
+    char session[64];           /* its GAM_CLIENT_ID */
+} bench_server;
+
+/*
+ * Starts the gam_server at @path, or from $GAMIN_DEBUG_SERVER, or the one
+ * of the build tree, with --notimeout and a session of its own which is
+ * exported to the clients of this process. @backend is NULL for the
+ * default one, "inotify", "dnotify" or "poll".
+ */
+int bench_server_start(bench_server *server, const char *path,
+                       const char *backend);
+void bench_server_stop(bench_server *server);
+
+/* CPU time in seconds used so far, and resident memory in kB */
+int bench_server_usage(bench_server *server, double *cpu, long *rss_kb);
+
+/* Its number of connections, including the one used to ask, or -1 */
+int bench_server_connections(void);
+
+double bench_now(void);
+
+/* Sorts @values, returns the @p percentile of them, 0 if there's none */
+double bench_percentile(double *values, int nb, double p);
+
+void bench_set_machine(int machine);
+void bench_report(const char *name, double value, const char *unit);
+
+#endif /* __GAM_BENCH_H__ */
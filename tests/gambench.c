@@ -0,0 +1,404 @@
+/*
+ * gam-bench: end-to-end throughput and latency of gam_server
+ *
+ * Starts a private gam_server with --notimeout and connects M clients,
+ * each monitoring the same K directories. It then runs a fixed sequence
+ * of file operations at a target rate, each file being created, written
+ * to, renamed and deleted, the files going round the directories. Every
+ * event received is matched with the operation which caused it to get
+ * the delivery latency. Reports the events delivered per second, the
+ * p50 and p99 latencies, and the CPU time and memory of the server.
+ *
+ *   gam-bench [-s server] [-b backend] [-c clients] [-k dirs]
+ *             [-r ops/s] [-t seconds] [-d dir] [-m]
+ *
+ * The same options give the same sequence of operations. -m prints
+ * "name value" lines, to keep and compare between releases.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include "fam.h"
+#include "bench.h"
+
+/* how long to wait for the last events once the operations are done */
+#define DRAIN_IDLE 1.0
+#define DRAIN_MAX 10.0
+
+enum {
+    OP_CREATE = 0,
+    OP_MODIFY,
+    OP_RENAME,
+    OP_DELETE,
+    OP_NB
+};
+
+typedef struct {
+    FAMConnection fc;
+    FAMRequest *requests;
+    int end_exists;             /* how many EndExist were received */
+} client_t;
+
+static const char *base;
+static int nb_clients = 4, nb_dirs = 16;
+static client_t *clients;
+static struct pollfd *fds;
+
+static double *op_time;         /* when each operation was done */
+static long nb_ops;
+static char *matched;           /* per operation and client */
+static double *latencies;       /* of each matched event, in microseconds */
+static long nb_latencies;
+static long nb_events, nb_matched;
+static double last_event;
+
+static void
+file_path(char *buf, size_t len, long file, char prefix)
+{
+    snprintf(buf, len, "%s/d%03ld/%c%ld", base, file % nb_dirs, prefix,
+             file);
+}
+
+/*
+ * Operation @op of the sequence, files going through the 4 steps in turn
+ */
+static void
+do_op(long op)
+{
+    char path[1024], path2[1024];
+    long file = op / OP_NB;
+    int fd;
+
+    file_path(path, sizeof(path), file, 'f');
+    switch (op % OP_NB) {
+        case OP_CREATE:
+            fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0)
+                close(fd);
+            break;
+        case OP_MODIFY:
+            fd = open(path, O_WRONLY | O_APPEND);
+            if (fd >= 0) {
+                if (write(fd, "x", 1) < 0)
+                    perror(path);
+                close(fd);
+            }
+            break;
+        case OP_RENAME:
+            file_path(path2, sizeof(path2), file, 'r');
+            rename(path, path2);
+            break;
+        case OP_DELETE:
+            file_path(path, sizeof(path), file, 'r');
+            unlink(path);
+            break;
+    }
+}
+
+/*
+ * Finds the operation an event comes from, the Deleted of the old name
+ * of a rename isn't counted.
+ */
+static long
+event_op(FAMEvent *fe)
+{
+    long file;
+    char prefix;
+    int step;
+
+    if (sscanf(fe->filename, "%c%ld", &prefix, &file) != 2)
+        return (-1);
+    if ((prefix == 'f') && (fe->code == FAMCreated))
+        step = OP_CREATE;
+    else if ((prefix == 'f') && (fe->code == FAMChanged))
+        step = OP_MODIFY;
+    else if ((prefix == 'r') && (fe->code == FAMCreated))
+        step = OP_RENAME;
+    else if ((prefix == 'r') && (fe->code == FAMDeleted))
+        step = OP_DELETE;
+    else
+        return (-1);
+    if ((file < 0) || (file * OP_NB + step >= nb_ops))
+        return (-1);
+    return (file * OP_NB + step);
+}
+
+static int
+read_events(int index)
+{
+    client_t *client = &clients[index];
+    FAMEvent fe;
+    double now;
+    long op;
+    int ret, nb = 0;
+
+    while ((ret = FAMPending(&client->fc)) > 0) {
+        if (FAMNextEvent(&client->fc, &fe) < 0)
+            return (-1);
+        now = bench_now();
+        if (fe.code == FAMEndExist) {
+            client->end_exists++;
+            continue;
+        }
+        if ((fe.code == FAMExists) || (fe.code == FAMAcknowledge))
+            continue;
+        nb_events++;
+        last_event = now;
+        nb++;
+        op = event_op(&fe);
+        if ((op < 0) || (op_time[op] == 0.0) ||
+            (matched[op * nb_clients + index]))
+            continue;
+        matched[op * nb_clients + index] = 1;
+        nb_matched++;
+        latencies[nb_latencies++] = (now - op_time[op]) * 1000000.0;
+    }
+    if (ret < 0)
+        return (-1);
+    return (nb);
+}
+
+/*
+ * Waits at most @timeout seconds for events and reads them
+ */
+static int
+wait_events(double timeout)
+{
+    int i, nb = 0, ret;
+
+    if (timeout < 0)
+        timeout = 0;
+    if (poll(fds, nb_clients, (int) (timeout * 1000)) < 0) {
+        if (errno == EINTR)
+            return (0);
+        perror("poll");
+        return (-1);
+    }
+    for (i = 0; i < nb_clients; i++) {
+        if (fds[i].revents == 0)
+            continue;
+        if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            fprintf(stderr, "connection %d to the server lost\n", i);
+            return (-1);
+        }
+        ret = read_events(i);
+        if (ret < 0) {
+            fprintf(stderr, "failed to read events of connection %d\n", i);
+            return (-1);
+        }
+        nb += ret;
+    }
+    return (nb);
+}
+
+static int
+setup(void)
+{
+    char path[1024];
+    double start;
+    int i, j, done;
+
+    if ((mkdir(base, 0700) < 0) && (errno != EEXIST)) {
+        perror(base);
+        return (-1);
+    }
+    for (j = 0; j < nb_dirs; j++) {
+        snprintf(path, sizeof(path), "%s/d%03d", base, j);
+        if ((mkdir(path, 0700) < 0) && (errno != EEXIST)) {
+            perror(path);
+            return (-1);
+        }
+    }
+
+    clients = calloc(nb_clients, sizeof(client_t));
+    fds = calloc(nb_clients, sizeof(struct pollfd));
+    if ((clients == NULL) || (fds == NULL))
+        return (-1);
+    for (i = 0; i < nb_clients; i++) {
+        if (FAMOpen2(&clients[i].fc, "gam-bench") < 0) {
+            fprintf(stderr, "failed to connect client %d\n", i);
+            return (-1);
+        }
+        fds[i].fd = FAMCONNECTION_GETFD(&clients[i].fc);
+        fds[i].events = POLLIN;
+        clients[i].requests = calloc(nb_dirs, sizeof(FAMRequest));
+        if (clients[i].requests == NULL)
+            return (-1);
+        for (j = 0; j < nb_dirs; j++) {
+            snprintf(path, sizeof(path), "%s/d%03d", base, j);
+            if (FAMMonitorDirectory(&clients[i].fc, path,
+                                    &clients[i].requests[j], NULL) < 0) {
+                fprintf(stderr, "failed to monitor %s\n", path);
+                return (-1);
+            }
+        }
+    }
+
+    /* all the monitors are in place once they all got their EndExist */
+    for (start = bench_now(); bench_now() - start < DRAIN_MAX;) {
+        for (i = 0, done = 1; i < nb_clients; i++)
+            if (clients[i].end_exists < nb_dirs)
+                done = 0;
+        if (done)
+            return (0);
+        if (wait_events(0.1) < 0)
+            return (-1);
+    }
+    fprintf(stderr, "the monitors didn't all get set up\n");
+    return (-1);
+}
+
+static void
+cleanup(void)
+{
+    char path[1024];
+    int i;
+
+    for (i = 0; i < nb_clients; i++)
+        FAMClose(&clients[i].fc);
+    /* the last file may have stopped half way */
+    file_path(path, sizeof(path), (nb_ops - 1) / OP_NB, 'f');
+    unlink(path);
+    file_path(path, sizeof(path), (nb_ops - 1) / OP_NB, 'r');
+    unlink(path);
+    for (i = 0; i < nb_dirs; i++) {
+        snprintf(path, sizeof(path), "%s/d%03d", base, i);
+        rmdir(path);
+    }
+    rmdir(base);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-s server] [-b backend] [-c clients] "
+            "[-k dirs]\n\t[-r ops/s] [-t seconds] [-d dir] [-m]\n", name);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    bench_server server;
+    const char *server_path = NULL, *backend = NULL;
+    char dir[64];
+    double rate = 1000.0, duration = 5.0;
+    double start, end, now, next, cpu_start, cpu_end;
+    long op = 0, rss;
+    int opt, ret = 0;
+
+    snprintf(dir, sizeof(dir), "/tmp/gam-bench-%d", (int) getpid());
+    base = dir;
+    while ((opt = getopt(argc, argv, "s:b:c:k:r:t:d:m")) != -1) {
+        switch (opt) {
+            case 's':
+                server_path = optarg;
+                break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 'c':
+                nb_clients = atoi(optarg);
+                break;
+            case 'k':
+                nb_dirs = atoi(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 't':
+                duration = atof(optarg);
+                break;
+            case 'd':
+                base = optarg;
+                break;
+            case 'm':
+                bench_set_machine(1);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if ((nb_clients <= 0) || (nb_dirs <= 0) || (nb_dirs > 1000) ||
+        (rate <= 0) || (duration <= 0) || (optind != argc))
+        usage(argv[0]);
+
+    nb_ops = (long) (rate * duration);
+    op_time = calloc(nb_ops, sizeof(double));
+    matched = calloc(nb_ops, nb_clients);
+    latencies = malloc(nb_ops * nb_clients * sizeof(double));
+    if ((op_time == NULL) || (matched == NULL) || (latencies == NULL)) {
+        fprintf(stderr, "out of memory\n");
+        return (1);
+    }
+
+    if (bench_server_start(&server, server_path, backend) < 0)
+        return (1);
+    if (setup() < 0) {
+        ret = 1;
+        goto done;
+    }
+    if (bench_server_usage(&server, &cpu_start, &rss) < 0)
+        cpu_start = 0;
+
+    start = bench_now();
+    while (op < nb_ops) {
+        now = bench_now();
+        while ((op < nb_ops) && (start + op / rate <= now)) {
+            op_time[op] = bench_now();
+            do_op(op);
+            op++;
+        }
+        next = start + op / rate;
+        if ((op < nb_ops) && (wait_events(next - bench_now()) < 0)) {
+            ret = 1;
+            goto done;
+        }
+    }
+    end = bench_now();
+    if (last_event < end)
+        last_event = end;
+    while ((bench_now() - last_event < DRAIN_IDLE) &&
+           (bench_now() - end < DRAIN_MAX)) {
+        if (wait_events(DRAIN_IDLE / 10) < 0) {
+            ret = 1;
+            goto done;
+        }
+    }
+    if (bench_server_usage(&server, &cpu_end, &rss) < 0) {
+        cpu_end = cpu_start;
+        rss = 0;
+    }
+
+    bench_report("clients", nb_clients, "");
+    bench_report("dirs", nb_dirs, "");
+    bench_report("ops", nb_ops, "");
+    bench_report("ops_per_s", nb_ops / (end - start), "ops/s");
+    bench_report("events", nb_events, "");
+    bench_report("events_matched", nb_matched, "");
+    bench_report("events_missed", (double) nb_ops * nb_clients - nb_matched,
+                 "");
+    bench_report("events_per_s", nb_events / (last_event - start),
+                 "events/s");
+    bench_report("latency_p50_us",
+                 bench_percentile(latencies, nb_latencies, 50), "us");
+    bench_report("latency_p99_us",
+                 bench_percentile(latencies, nb_latencies, 99), "us");
+    bench_report("latency_max_us",
+                 bench_percentile(latencies, nb_latencies, 100), "us");
+    bench_report("server_cpu_s", cpu_end - cpu_start, "s");
+    bench_report("server_cpu_percent",
+                 100.0 * (cpu_end - cpu_start) / (last_event - start), "%");
+    bench_report("server_rss_kb", rss, "kB");
+
+  done:
+    if (clients != NULL)
+        cleanup();
+    bench_server_stop(&server);
+    return (ret);
+}
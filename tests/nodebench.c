@@ -0,0 +1,164 @@
+/*
+ * nodebench: memory and time needed by the server's poll tree
+ *
+ * Builds a GamTree of about a million nodes, laid out like a large
+ * source checkout (directories of a thousand files), then looks each
+ * node up again and tears the tree down. Reports the resident memory
+ * used per node and the time taken by each phase.
+ *
+ *   gam-nodebench [nb_nodes]
+ */
+#include "server_config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "gam_node.h"
+#include "gam_tree.h"
+#include "gam_server.h"
+
+#define FILES_PER_DIR 1000
+
+/*
+ * The parts of the server the tree code calls into, the benchmark
+ * doesn't use subscriptions or events.
+ */
+void
+gam_server_emit_event_subs(const char *path, int is_dir_node,
+                           GaminEventType event, GamSubscription **subs,
+                           guint nsubs, int force)
+{
+}
+
+gboolean
+gam_subscription_is_dir(GamSubscription *sub)
+{
+    return (FALSE);
+}
+
+void gam_show_debug(void);
+void gam_got_signal(void);
+
+void
+gam_show_debug(void)
+{
+}
+
+void
+gam_got_signal(void)
+{
+}
+
+static long
+rss_kb(void)
+{
+    FILE *f;
+    long size = 0, resident = 0;
+
+    f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return (0);
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return (resident * (getpagesize() / 1024));
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec + tv.tv_usec / 1000000.0);
+}
+
+static void
+node_path(char *buf, size_t len, int i)
+{
+    snprintf(buf, len, "/srv/nodebench/d%04d/sub/file-%06d.c",
+             i / FILES_PER_DIR, i);
+}
+
+int
+main(int argc, char **argv)
+{
+    GamTree *tree;
+    GamNode *root, *dir = NULL, *node;
+    GamNode **nodes;
+    char path[256];
+    long rss_before, rss_after;
+    double start, t_build, t_lookup, t_free;
+    int nb = 1000000, i;
+
+    if (argc > 1)
+        nb = atoi(argv[1]);
+    if (nb <= 0) {
+        fprintf(stderr, "usage: %s [nb_nodes]\n", argv[0]);
+        return (1);
+    }
+    nodes = malloc(nb * sizeof(GamNode *));
+    if (nodes == NULL)
+        return (1);
+
+    tree = gam_tree_new();
+    root = gam_tree_add_at_path(tree, "/srv/nodebench", TRUE);
+    rss_before = rss_kb();
+
+    start = now();
+    for (i = 0; i < nb; i++) {
+        if (i % FILES_PER_DIR == 0) {
+            snprintf(path, sizeof(path), "/srv/nodebench/d%04d",
+                     i / FILES_PER_DIR);
+            node = gam_node_new(path, NULL, TRUE);
+            gam_tree_add(tree, root, node);
+            snprintf(path, sizeof(path), "/srv/nodebench/d%04d/sub",
+                     i / FILES_PER_DIR);
+            dir = gam_node_new(path, NULL, TRUE);
+            gam_tree_add(tree, node, dir);
+        }
+        node_path(path, sizeof(path), i);
+        nodes[i] = gam_node_new(path, NULL, FALSE);
+        gam_tree_add(tree, dir, nodes[i]);
+    }
+    t_build = now() - start;
+    rss_after = rss_kb();
+
+    start = now();
+    for (i = 0; i < nb; i++) {
+        node_path(path, sizeof(path), i);
+        if (gam_tree_get_at_path(tree, path) != nodes[i]) {
+            fprintf(stderr, "lookup of %s failed\n", path);
+            return (1);
+        }
+    }
+    t_lookup = now() - start;
+
+    start = now();
+    for (i = nb - 1; i >= 0; i--) {
+        node = nodes[i];
+        dir = gam_node_parent(node);
+        gam_tree_remove(tree, node);
+        if ((i % FILES_PER_DIR == 0) && (dir != NULL)) {
+            node = gam_node_parent(dir);
+            gam_tree_remove(tree, dir);
+            gam_tree_remove(tree, node);
+        }
+    }
+    t_free = now() - start;
+
+    printf("nodes %d\n", nb);
+    printf("rss_kb %ld\n", rss_after - rss_before);
+    printf("bytes_per_node %.1f\n",
+           (rss_after - rss_before) * 1024.0 / nb);
+    printf("build_s %.3f\n", t_build);
+    printf("lookup_s %.3f\n", t_lookup);
+    printf("free_s %.3f\n", t_free);
+    printf("tree_size_after %u\n", gam_tree_get_size(tree));
+
+    gam_tree_free(tree);
+    free(nodes);
+    return (0);
+}
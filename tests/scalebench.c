@@ -0,0 +1,336 @@
+/*
+ * gam-scalebench: memory and setup time of gam_server against the
+ * number of subscriptions
+ *
+ * Builds trees of the given sizes under /tmp, directories of a hundred
+ * files a hundred directories to a parent, and has one client monitor
+ * each directory with FAMMonitorDirectory, as an indexer would. For each
+ * backend and size a fresh server is started and the benchmark reports
+ * the time until the first and the last EndExist, the resident memory
+ * of the server per subscription, and the time taken to cancel all the
+ * monitors and to close the connection.
+ *
+ *   gam-scalebench [-s server] [-b backend] [-d dir] [-m] [sizes...]
+ *
+ * The sizes default to 10000 100000 1000000 files and directories, the
+ * backends to inotify, dnotify and poll. -m prints "name value" lines.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include "fam.h"
+#include "bench.h"
+
+#define FILES_PER_DIR 100
+#define DIRS_PER_PARENT 100
+
+/* give up waiting for the server after that many seconds without events */
+#define IDLE_TIMEOUT 30.0
+
+static const char *base;
+static const char *backends[] = { "inotify", "dnotify", "poll", NULL };
+
+typedef struct {
+    FAMConnection fc;
+    FAMRequest *requests;
+    int nb_dirs;
+    int end_exists;
+    int acks;
+    long events;
+    double first_end_exist;
+} client_t;
+
+static void
+dir_path(char *buf, size_t len, int dir)
+{
+    snprintf(buf, len, "%s/p%03d/d%05d", base, dir / DIRS_PER_PARENT, dir);
+}
+
+static int
+nb_dirs_for(long size)
+{
+    return ((int) ((size + FILES_PER_DIR) / (FILES_PER_DIR + 1)));
+}
+
+/*
+ * Creates or removes the tree, @size files and directories in all
+ */
+static int
+build_tree(long size, int create)
+{
+    char path[1024];
+    int nb_dirs = nb_dirs_for(size), dir, file, fd;
+    size_t len;
+
+    if ((create) && (mkdir(base, 0700) < 0) && (errno != EEXIST)) {
+        perror(base);
+        return (-1);
+    }
+    for (dir = 0; dir < nb_dirs; dir++) {
+        if ((create) && (dir % DIRS_PER_PARENT == 0)) {
+            snprintf(path, sizeof(path), "%s/p%03d", base,
+                     dir / DIRS_PER_PARENT);
+            if ((mkdir(path, 0700) < 0) && (errno != EEXIST)) {
+                perror(path);
+                return (-1);
+            }
+        }
+        dir_path(path, sizeof(path), dir);
+        if ((create) && (mkdir(path, 0700) < 0) && (errno != EEXIST)) {
+            perror(path);
+            return (-1);
+        }
+        len = strlen(path);
+        for (file = 0; file < FILES_PER_DIR; file++) {
+            snprintf(path + len, sizeof(path) - len, "/f%03d", file);
+            if (!create) {
+                unlink(path);
+                continue;
+            }
+            fd = open(path, O_WRONLY | O_CREAT, 0644);
+            if (fd < 0) {
+                perror(path);
+                return (-1);
+            }
+            close(fd);
+        }
+        path[len] = 0;
+        if (!create)
+            rmdir(path);
+        if ((!create) && ((dir + 1) % DIRS_PER_PARENT == 0 ||
+                          dir + 1 == nb_dirs)) {
+            snprintf(path, sizeof(path), "%s/p%03d", base,
+                     dir / DIRS_PER_PARENT);
+            rmdir(path);
+        }
+    }
+    if (!create)
+        rmdir(base);
+    return (0);
+}
+
+static int
+read_events(client_t *client, double start)
+{
+    FAMEvent fe;
+    int ret;
+
+    while ((ret = FAMPending(&client->fc)) > 0) {
+        if (FAMNextEvent(&client->fc, &fe) < 0)
+            return (-1);
+        client->events++;
+        if (fe.code == FAMEndExist) {
+            if (client->end_exists++ == 0)
+                client->first_end_exist = bench_now() - start;
+        } else if (fe.code == FAMAcknowledge) {
+            client->acks++;
+        }
+    }
+    return (ret);
+}
+
+/*
+ * Reads events until @count reaches @target, failing if the server
+ * stays quiet for too long.
+ */
+static int
+wait_for(client_t *client, int *count, int target, double start)
+{
+    struct pollfd pfd;
+    double last = bench_now();
+    long events;
+
+    pfd.fd = FAMCONNECTION_GETFD(&client->fc);
+    pfd.events = POLLIN;
+    while (*count < target) {
+        events = client->events;
+        if ((poll(&pfd, 1, 100) < 0) && (errno != EINTR)) {
+            perror("poll");
+            return (-1);
+        }
+        if (read_events(client, start) < 0) {
+            fprintf(stderr, "connection to the server lost\n");
+            return (-1);
+        }
+        if (client->events != events)
+            last = bench_now();
+        else if (bench_now() - last > IDLE_TIMEOUT) {
+            fprintf(stderr, "timeout, got %d of %d\n", *count, target);
+            return (-1);
+        }
+    }
+    return (0);
+}
+
+static void
+report(const char *backend, long size, const char *name, double value,
+       const char *unit)
+{
+    char buf[128];
+
+    snprintf(buf, sizeof(buf), "%s.%ld.%s", backend, size, name);
+    bench_report(buf, value, unit);
+}
+
+static int
+run(const char *server_path, const char *backend, long size)
+{
+    bench_server server;
+    client_t client;
+    char path[1024];
+    double start, t_first, t_all, t_cancel, t_close, cpu;
+    long rss_before, rss_after, rss_cancel;
+    int i, ret = -1;
+
+    memset(&client, 0, sizeof(client));
+    client.nb_dirs = nb_dirs_for(size);
+    client.requests = calloc(client.nb_dirs, sizeof(FAMRequest));
+    if (client.requests == NULL)
+        return (-1);
+
+    if (bench_server_start(&server, server_path, backend) < 0) {
+        free(client.requests);
+        return (-1);
+    }
+    if (FAMOpen2(&client.fc, "gam-scalebench") < 0) {
+        fprintf(stderr, "failed to connect to the server\n");
+        goto done;
+    }
+    if (bench_server_usage(&server, &cpu, &rss_before) < 0)
+        rss_before = 0;
+
+    /* read as we go, the server doesn't wait for us to be done */
+    start = bench_now();
+    for (i = 0; i < client.nb_dirs; i++) {
+        dir_path(path, sizeof(path), i);
+        if (FAMMonitorDirectory(&client.fc, path, &client.requests[i],
+                                NULL) < 0) {
+            fprintf(stderr, "failed to monitor %s\n", path);
+            goto done;
+        }
+        if (read_events(&client, start) < 0)
+            goto done;
+    }
+    if (wait_for(&client, &client.end_exists, client.nb_dirs, start) < 0)
+        goto done;
+    t_first = client.first_end_exist;
+    t_all = bench_now() - start;
+    if (bench_server_usage(&server, &cpu, &rss_after) < 0)
+        rss_after = 0;
+
+    start = bench_now();
+    for (i = 0; i < client.nb_dirs; i++) {
+        if (FAMCancelMonitor(&client.fc, &client.requests[i]) < 0) {
+            fprintf(stderr, "failed to cancel monitor %d\n", i);
+            goto done;
+        }
+        if (read_events(&client, start) < 0)
+            goto done;
+    }
+    if (wait_for(&client, &client.acks, client.nb_dirs, start) < 0)
+        goto done;
+    t_cancel = bench_now() - start;
+    if (bench_server_usage(&server, &cpu, &rss_cancel) < 0)
+        rss_cancel = 0;
+
+    start = bench_now();
+    FAMClose(&client.fc);
+    while (bench_server_connections() > 1) {
+        if (bench_now() - start > IDLE_TIMEOUT) {
+            fprintf(stderr, "the connection wasn't closed\n");
+            goto done;
+        }
+        usleep(1000);
+    }
+    t_close = bench_now() - start;
+
+    report(backend, size, "subscriptions", client.nb_dirs, "");
+    report(backend, size, "events", client.events, "");
+    report(backend, size, "first_endexist_s", t_first, "s");
+    report(backend, size, "all_endexist_s", t_all, "s");
+    report(backend, size, "server_rss_kb", rss_after, "kB");
+    report(backend, size, "bytes_per_subscription",
+           (rss_after - rss_before) * 1024.0 / client.nb_dirs, "bytes");
+    report(backend, size, "bytes_per_entry",
+           (rss_after - rss_before) * 1024.0 / size, "bytes");
+    report(backend, size, "cancel_s", t_cancel, "s");
+    report(backend, size, "rss_after_cancel_kb", rss_cancel, "kB");
+    report(backend, size, "close_s", t_close, "s");
+    report(backend, size, "server_cpu_s", cpu, "s");
+    ret = 0;
+
+  done:
+    bench_server_stop(&server);
+    free(client.requests);
+    return (ret);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-s server] [-b backend] [-d dir] [-m] "
+            "[sizes...]\n", name);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *server_path = NULL, *backend = NULL;
+    static long default_sizes[] = { 10000, 100000, 1000000 };
+    long *sizes = default_sizes;
+    int nb_sizes = 3, i, j, opt, ret = 0;
+    char dir[64];
+
+    snprintf(dir, sizeof(dir), "/tmp/gam-scalebench-%d", (int) getpid());
+    base = dir;
+    while ((opt = getopt(argc, argv, "s:b:d:m")) != -1) {
+        switch (opt) {
+            case 's':
+                server_path = optarg;
+                break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 'd':
+                base = optarg;
+                break;
+            case 'm':
+                bench_set_machine(1);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        nb_sizes = argc - optind;
+        sizes = malloc(nb_sizes * sizeof(long));
+        if (sizes == NULL)
+            return (1);
+        for (i = 0; i < nb_sizes; i++) {
+            sizes[i] = atol(argv[optind + i]);
+            if (sizes[i] <= 0)
+                usage(argv[0]);
+        }
+    }
+
+    for (i = 0; (i < nb_sizes) && (ret == 0); i++) {
+        if (build_tree(sizes[i], 1) < 0) {
+            ret = 1;
+        } else if (backend != NULL) {
+            if (run(server_path, backend, sizes[i]) < 0)
+                ret = 1;
+        } else {
+            for (j = 0; backends[j] != NULL; j++)
+                if (run(server_path, backends[j], sizes[i]) < 0)
+                    ret = 1;
+        }
+        build_tree(sizes[i], 0);
+    }
+    return (ret);
+}
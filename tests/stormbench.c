@@ -0,0 +1,416 @@
+/*
+ * gam-stormbench: gam_server under a storm of connections
+ *
+ * Desktop logins start dozens of gamin clients in the same second. This
+ * forks P processes which, all at once, open N connections between them
+ * with FAMOpen, each connection then monitoring K directories, and later
+ * close them all at once. It is run without and then with monitors, a
+ * fresh server each time, and reports:
+ *
+ *  - the connect latency, from FAMOpen until the credentials of the
+ *    server were read and checked by gamin_check_cred, and with monitors
+ *    until their EndExist, which means the server checked ours too
+ *  - how fast the server accepted them, as seen in its statistics
+ *  - how long it took the server to clean up after the FAMClose storm
+ *  - its memory per connection and its CPU time
+ *
+ *   gam-stormbench [-s server] [-b backend] [-n connections]
+ *                  [-p processes] [-k monitors] [-d dir] [-m]
+ *
+ * -m prints "name value" lines.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "fam.h"
+#include "bench.h"
+
+#define FILES_PER_DIR 10
+
+/* give up waiting for the server after that many seconds */
+#define TIMEOUT 60.0
+
+static const char *base;
+static int nb_conns = 2000, nb_procs = 8, nb_monitors = 1;
+
+typedef struct {
+    int pid;
+    int nb;                     /* connections it opens */
+    int result;                 /* pipe its latencies come from */
+} worker_t;
+
+static int
+read_all(int fd, void *buf, size_t len)
+{
+    char *cur = buf;
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = read(fd, cur, len);
+        if ((ret < 0) && (errno == EINTR))
+            continue;
+        if (ret <= 0)
+            return (-1);
+        cur += ret;
+        len -= ret;
+    }
+    return (0);
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+    const char *cur = buf;
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(fd, cur, len);
+        if ((ret < 0) && (errno == EINTR))
+            continue;
+        if (ret <= 0)
+            return (-1);
+        cur += ret;
+        len -= ret;
+    }
+    return (0);
+}
+
+/*
+ * Opens a connection, and doesn't come back until the authentication
+ * went through both ways, as far as the client can tell.
+ */
+static int
+connect_one(FAMConnection *fc, FAMRequest *requests, int monitors)
+{
+    struct pollfd pfd;
+    FAMEvent fe;
+    int i, end_exists = 0;
+    double start;
+
+    if (FAMOpen2(fc, "gam-stormbench") < 0)
+        return (-1);
+    for (i = 0; i < monitors; i++)
+        if (FAMMonitorDirectory(fc, base, &requests[i], NULL) < 0)
+            return (-1);
+
+    pfd.fd = FAMCONNECTION_GETFD(fc);
+    pfd.events = POLLIN;
+    for (start = bench_now(); bench_now() - start < TIMEOUT;) {
+        if ((poll(&pfd, 1, 1000) < 0) && (errno != EINTR))
+            return (-1);
+        if (pfd.revents == 0)
+            continue;
+        /* the first read is the credentials of the server */
+        if (FAMPending(fc) < 0)
+            return (-1);
+        if (monitors == 0)
+            return (0);
+        while (FAMPending(fc) > 0) {
+            if (FAMNextEvent(fc, &fe) < 0)
+                return (-1);
+            if ((fe.code == FAMEndExist) && (++end_exists == monitors))
+                return (0);
+        }
+    }
+    return (-1);
+}
+
+/*
+ * A worker process: waits for @go to be closed, opens its connections,
+ * sends back their connect latencies in microseconds, -1 for a failure,
+ * then closes them all when @stop is closed.
+ */
+static void
+worker(int nb, int go, int stop, int result)
+{
+    FAMConnection *fcs;
+    FAMRequest *requests;
+    double *latencies, start;
+    char c;
+    int i;
+
+    fcs = calloc(nb, sizeof(FAMConnection));
+    requests = calloc((size_t) nb * nb_monitors + 1, sizeof(FAMRequest));
+    latencies = calloc(nb, sizeof(double));
+    if ((fcs == NULL) || (requests == NULL) || (latencies == NULL))
+        _exit(1);
+
+    while ((read(go, &c, 1) < 0) && (errno == EINTR));
+    for (i = 0; i < nb; i++) {
+        start = bench_now();
+        if (connect_one(&fcs[i], &requests[i * nb_monitors],
+                        nb_monitors) < 0) {
+            latencies[i] = -1;
+            fcs[i].fd = -1;
+            continue;
+        }
+        latencies[i] = (bench_now() - start) * 1000000.0;
+    }
+    if (write_all(result, latencies, nb * sizeof(double)) < 0)
+        _exit(1);
+
+    while ((read(stop, &c, 1) < 0) && (errno == EINTR));
+    for (i = 0; i < nb; i++)
+        if (fcs[i].fd >= 0)
+            FAMClose(&fcs[i]);
+    _exit(0);
+}
+
+/*
+ * Waits until the server has @target connections besides the one used
+ * to ask, returns how long it took or -1.
+ */
+static double
+wait_connections(int target, double start)
+{
+    int nb;
+
+    while (bench_now() - start < TIMEOUT) {
+        nb = bench_server_connections();
+        if (nb < 0)
+            return (-1);
+        if (nb - 1 == target)
+            return (bench_now() - start);
+        usleep(1000);
+    }
+    fprintf(stderr, "the server didn't get to %d connections\n", target);
+    return (-1);
+}
+
+static void
+report(const char *phase, const char *name, double value, const char *unit)
+{
+    char buf[128];
+
+    snprintf(buf, sizeof(buf), "%s.%s", phase, name);
+    bench_report(buf, value, unit);
+}
+
+static int
+run(const char *server_path, const char *backend, int monitors,
+    const char *phase)
+{
+    bench_server server;
+    worker_t *workers;
+    double *latencies, start, t_open, t_accept, t_close, cpu;
+    long rss_before, rss_open, rss_close;
+    int go[2], stop[2], result[2];
+    int i, nb = 0, failed = 0, opened = 0, ret = -1;
+
+    workers = calloc(nb_procs, sizeof(worker_t));
+    latencies = calloc(nb_conns, sizeof(double));
+    if ((workers == NULL) || (latencies == NULL))
+        return (-1);
+    if (bench_server_start(&server, server_path, backend) < 0)
+        goto free;
+    if (bench_server_usage(&server, &cpu, &rss_before) < 0)
+        rss_before = 0;
+
+    if ((pipe(go) < 0) || (pipe(stop) < 0)) {
+        perror("pipe");
+        goto done;
+    }
+    nb_monitors = monitors;
+    for (i = 0; i < nb_procs; i++) {
+        workers[i].nb = nb_conns / nb_procs + (i < nb_conns % nb_procs);
+        if (pipe(result) < 0) {
+            perror("pipe");
+            goto done;
+        }
+        workers[i].pid = fork();
+        if (workers[i].pid == 0) {
+            close(go[1]);
+            close(stop[1]);
+            close(result[0]);
+            worker(workers[i].nb, go[0], stop[0], result[1]);
+        }
+        close(result[1]);
+        workers[i].result = result[0];
+        if (workers[i].pid < 0) {
+            perror("fork");
+            goto done;
+        }
+    }
+    close(go[0]);
+    close(stop[0]);
+
+    /* all the workers start at the same time */
+    start = bench_now();
+    close(go[1]);
+    for (i = 0; i < nb_procs; i++) {
+        if (read_all(workers[i].result, &latencies[nb],
+                     workers[i].nb * sizeof(double)) < 0) {
+            fprintf(stderr, "worker %d failed\n", i);
+            goto done;
+        }
+        nb += workers[i].nb;
+    }
+    t_open = bench_now() - start;
+    for (i = 0, opened = 0; i < nb; i++) {
+        if (latencies[i] < 0)
+            failed++;
+        else
+            latencies[opened++] = latencies[i];
+    }
+    t_accept = wait_connections(opened, start);
+    if (t_accept < 0)
+        goto done;
+    if (bench_server_usage(&server, &cpu, &rss_open) < 0)
+        rss_open = 0;
+
+    start = bench_now();
+    close(stop[1]);
+    t_close = wait_connections(0, start);
+    if (t_close < 0)
+        goto done;
+    if (bench_server_usage(&server, &cpu, &rss_close) < 0)
+        rss_close = 0;
+
+    report(phase, "connections", opened, "");
+    report(phase, "failed", failed, "");
+    report(phase, "monitors_per_connection", monitors, "");
+    report(phase, "connect_p50_us", bench_percentile(latencies, opened, 50),
+           "us");
+    report(phase, "connect_p99_us", bench_percentile(latencies, opened, 99),
+           "us");
+    report(phase, "connect_max_us",
+           bench_percentile(latencies, opened, 100), "us");
+    report(phase, "open_s", t_open, "s");
+    report(phase, "accepted_per_s", opened / t_accept, "conn/s");
+    report(phase, "close_s", t_close, "s");
+    report(phase, "closed_per_s", opened / t_close, "conn/s");
+    report(phase, "server_rss_kb", rss_open, "kB");
+    report(phase, "bytes_per_connection",
+           opened ? (rss_open - rss_before) * 1024.0 / opened : 0, "bytes");
+    report(phase, "rss_after_close_kb", rss_close, "kB");
+    report(phase, "server_cpu_s", cpu, "s");
+    ret = 0;
+
+  done:
+    for (i = 0; i < nb_procs; i++) {
+        if (workers[i].pid <= 0)
+            continue;
+        if (ret < 0)
+            kill(workers[i].pid, SIGKILL);
+        while ((waitpid(workers[i].pid, NULL, 0) < 0) && (errno == EINTR));
+        close(workers[i].result);
+    }
+    bench_server_stop(&server);
+  free:
+    free(workers);
+    free(latencies);
+    return (ret);
+}
+
+static int
+setup(void)
+{
+    char path[1024];
+    int i, fd;
+
+    if ((mkdir(base, 0700) < 0) && (errno != EEXIST)) {
+        perror(base);
+        return (-1);
+    }
+    for (i = 0; i < FILES_PER_DIR; i++) {
+        snprintf(path, sizeof(path), "%s/f%d", base, i);
+        fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) {
+            perror(path);
+            return (-1);
+        }
+        close(fd);
+    }
+    return (0);
+}
+
+static void
+cleanup(void)
+{
+    char path[1024];
+    int i;
+
+    for (i = 0; i < FILES_PER_DIR; i++) {
+        snprintf(path, sizeof(path), "%s/f%d", base, i);
+        unlink(path);
+    }
+    rmdir(base);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-s server] [-b backend] [-n connections]\n"
+            "\t[-p processes] [-k monitors] [-d dir] [-m]\n", name);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *server_path = NULL, *backend = NULL;
+    struct rlimit limit;
+    char dir[64];
+    int monitors = 1, opt, ret = 0;
+
+    snprintf(dir, sizeof(dir), "/tmp/gam-stormbench-%d", (int) getpid());
+    base = dir;
+    while ((opt = getopt(argc, argv, "s:b:n:p:k:d:m")) != -1) {
+        switch (opt) {
+            case 's':
+                server_path = optarg;
+                break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 'n':
+                nb_conns = atoi(optarg);
+                break;
+            case 'p':
+                nb_procs = atoi(optarg);
+                break;
+            case 'k':
+                monitors = atoi(optarg);
+                break;
+            case 'd':
+                base = optarg;
+                break;
+            case 'm':
+                bench_set_machine(1);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if ((nb_conns <= 0) || (nb_procs <= 0) || (nb_procs > nb_conns) ||
+        (monitors <= 0) || (optind != argc))
+        usage(argv[0]);
+
+    /* the server and the workers inherit it */
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if ((rlim_t) nb_conns + 64 > limit.rlim_cur)
+            fprintf(stderr, "warning: %d connections with a limit of %ld "
+                    "file descriptors\n", nb_conns, (long) limit.rlim_cur);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (setup() < 0)
+        return (1);
+    if (run(server_path, backend, 0, "idle") < 0)
+        ret = 1;
+    if (run(server_path, backend, monitors, "monitored") < 0)
+        ret = 1;
+    cleanup();
+    return (ret);
+}